@@ -0,0 +1,90 @@
+// client.c
+// Command-line client for the compression daemon.
+// Usage: client [-s socket-path] compress|decompress <input> <output>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main_socket.h"
+
+int main(int argc, char** argv) {
+  const char* path = DAEMON_DEFAULT_SOCKET;
+  int a = 1;
+  if (a + 1 < argc && strcmp(argv[a], "-s") == 0) {
+    path = argv[a + 1];
+    a += 2;
+  }
+  if (argc - a != 3 || (strcmp(argv[a], "compress") != 0 &&
+                        strcmp(argv[a], "decompress") != 0)) {
+    fprintf(stderr,
+            "usage: %s [-s socket-path] compress|decompress <input> "
+            "<output>\n",
+            argv[0]);
+    return 1;
+  }
+  uint8_t op = argv[a][0] == 'c' ? DAEMON_OP_COMPRESS : DAEMON_OP_DECOMPRESS;
+
+  FILE* in = fopen(argv[a + 1], "rb");
+  if (!in) {
+    fprintf(stderr, "Error: cannot open %s\n", argv[a + 1]);
+    return 1;
+  }
+  size_t cap = 4096, len = 0, got;
+  unsigned char* buf = malloc(cap);
+  while (buf && (got = fread(buf + len, 1, cap - len, in)) > 0) {
+    len += got;
+    if (len == cap) {
+      unsigned char* grown = len < DAEMON_MAX_PAYLOAD ? realloc(buf, cap * 2)
+                                                      : NULL;
+      if (!grown) {
+        free(buf);
+        buf = NULL;
+        break;
+      }
+      buf = grown;
+      cap *= 2;
+    }
+  }
+  fclose(in);
+  if (!buf || len > DAEMON_MAX_PAYLOAD) {
+    fprintf(stderr, "Error: %s is too large for the daemon\n", argv[a + 1]);
+    free(buf);
+    return 1;
+  }
+
+  int fd = sock_connect(path);
+  if (fd < 0) {
+    free(buf);
+    fprintf(stderr, "Error: cannot connect to %s\n", path);
+    return 1;
+  }
+  unsigned char* reply = NULL;
+  size_t reply_cap = 0;
+  uint32_t reply_len = 0;
+  uint8_t status = DAEMON_STATUS_ERROR;
+  int r = daemon_call(fd, op, buf, (uint32_t)len, &reply, &reply_cap,
+                      &reply_len, &status);
+  close(fd);
+  free(buf);
+  if (r != 0 || status != DAEMON_STATUS_OK) {
+    fprintf(stderr, "Error: daemon request failed%s%.*s\n", r ? "" : ": ",
+            r ? 0 : (int)reply_len, r ? "" : (const char*)reply);
+    free(reply);
+    return 1;
+  }
+
+  FILE* out = fopen(argv[a + 2], "wb");
+  int ok = out && fwrite(reply, 1, reply_len, out) == reply_len;
+  if (out && fclose(out) != 0)
+    ok = 0;
+  free(reply);
+  if (!ok) {
+    fprintf(stderr, "Error: cannot write %s\n", argv[a + 2]);
+    return 1;
+  }
+  printf("%zu bytes -> %u bytes (%s)\n", len, reply_len, argv[a + 2]);
+  return 0;
+}
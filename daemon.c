@@ -0,0 +1,215 @@
+// daemon.c
+// Long-running compression service on a Unix domain socket.
+// Usage: daemon [-s socket-path] [-w workers] [-t table-file]...
+// Each worker thread owns a warm message_ctx (BWT workspace and stage
+// buffers) plus its own request/response buffers, accepts a connection and
+// serves length-prefixed compress/decompress requests on it until the
+// client hangs up.  Nothing is allocated per request once a worker has seen
+// its largest payload.  With -t, a request is coded with the first table or
+// with an inline table of its own, whichever frame is smaller, and all the
+// tables are available to decompress; without, frames carry inline tables.
+// A payload that does not shrink either way is sent back as a stored frame.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "main_socket.h"
+
+#define DEFAULT_WORKERS 4
+#define MAX_TABLES 64
+
+struct huff_table;
+struct huff_table* huff_table_load(const char* path);  // from main_huffman.c
+void huff_table_free(struct huff_table* t);           // from main_huffman.c
+struct message_ctx;
+struct message_ctx* message_ctx_create(void);    // from main_message.c
+void message_ctx_free(struct message_ctx* ctx);  // from main_message.c
+size_t message_bound(size_t input_len);          // from main_message.c
+size_t compress_message(struct message_ctx* ctx,
+                        const struct huff_table* table,
+                        const unsigned char* input,
+                        size_t input_len,
+                        unsigned char* output,
+                        size_t output_capacity);  // from main_message.c
+const unsigned char* decompress_message(struct message_ctx* ctx,
+                                        struct huff_table* const* tables,
+                                        int ntables,
+                                        const unsigned char* input,
+                                        size_t input_len,
+                                        size_t max_len,
+                                        size_t* output_len);  // main_message.c
+
+struct worker {
+  pthread_t thread;
+  int listen_fd;
+  struct message_ctx* ctx;
+  unsigned char* in;
+  size_t in_cap;
+  unsigned char* out;
+  size_t out_cap;
+  unsigned long long served;
+};
+
+static struct huff_table* tables[MAX_TABLES];
+static int ntables;
+static const char* socket_path = DAEMON_DEFAULT_SOCKET;
+
+static void on_signal(int sig) {
+  (void)sig;
+  unlink(socket_path);
+  _exit(0);
+}
+
+static int reserve(unsigned char** p, size_t* cap, size_t need) {
+  if (need <= *cap)
+    return 0;
+  unsigned char* q = realloc(*p, need);
+  if (!q)
+    return -1;
+  *p = q;
+  *cap = need;
+  return 0;
+}
+
+static int send_error(int fd, const char* msg) {
+  return sock_send(fd, DAEMON_STATUS_ERROR, msg, (uint32_t)strlen(msg));
+}
+
+/* Serve requests on one connection until EOF or a transport error. */
+static void serve(struct worker* w, int fd) {
+  for (;;) {
+    uint8_t op;
+    uint32_t len;
+    if (sock_recv_header(fd, &op, &len) != 0)
+      return;
+    if (len > DAEMON_MAX_PAYLOAD || reserve(&w->in, &w->in_cap, len + 1)) {
+      send_error(fd, "payload too large");
+      return;
+    }
+    if (sock_read_all(fd, w->in, len) != 0)
+      return;
+
+    int r;
+    if (op == DAEMON_OP_COMPRESS) {
+      size_t cap = message_bound(len);
+      size_t n = 0;
+      if (reserve(&w->out, &w->out_cap, cap) == 0)
+        n = compress_message(w->ctx, ntables ? tables[0] : NULL, w->in, len,
+                             w->out, cap);
+      r = n && n <= DAEMON_MAX_PAYLOAD
+              ? sock_send(fd, DAEMON_STATUS_OK, w->out, (uint32_t)n)
+              : send_error(fd, "compression failed");
+    } else if (op == DAEMON_OP_DECOMPRESS) {
+      size_t n = 0;
+      const unsigned char* orig =
+          decompress_message(w->ctx, tables, ntables, w->in, len,
+                             DAEMON_MAX_PAYLOAD, &n);
+      r = orig && n <= DAEMON_MAX_PAYLOAD
+              ? sock_send(fd, DAEMON_STATUS_OK, orig, (uint32_t)n)
+              : send_error(fd, "decompression failed");
+    } else {
+      r = send_error(fd, "unknown operation");
+    }
+    if (r != 0)
+      return;
+    w->served++;
+  }
+}
+
+static void* worker_main(void* arg) {
+  struct worker* w = arg;
+  for (;;) {
+    int fd = accept(w->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("accept");
+      return NULL;
+    }
+    serve(w, fd);
+    close(fd);
+  }
+}
+
+int main(int argc, char** argv) {
+  int nworkers = DEFAULT_WORKERS;
+  for (int a = 1; a < argc; a++) {
+    if (strcmp(argv[a], "-s") == 0 && a + 1 < argc) {
+      socket_path = argv[++a];
+    } else if (strcmp(argv[a], "-w") == 0 && a + 1 < argc) {
+      nworkers = atoi(argv[++a]);
+    } else if (strcmp(argv[a], "-t") == 0 && a + 1 < argc &&
+               ntables < MAX_TABLES) {
+      const char* path = argv[++a];
+      if (!(tables[ntables] = huff_table_load(path))) {
+        fprintf(stderr, "Error: cannot load Huffman table %s\n", path);
+        return 1;
+      }
+      ntables++;
+    } else {
+      fprintf(stderr,
+              "usage: %s [-s socket-path] [-w workers] [-t table-file]...\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (nworkers < 1)
+    nworkers = 1;
+
+  // a client that disconnects mid-response must not kill the daemon
+  signal(SIGPIPE, SIG_IGN);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  int listen_fd = sock_listen(socket_path);
+  if (listen_fd < 0) {
+    fprintf(stderr, "Error: cannot listen on %s\n", socket_path);
+    return 1;
+  }
+
+  struct worker* workers = calloc((size_t)nworkers, sizeof(*workers));
+  if (!workers) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < nworkers; i++) {
+    workers[i].listen_fd = listen_fd;
+    workers[i].ctx = message_ctx_create();
+    if (!workers[i].ctx ||
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i])) {
+      fprintf(stderr, "Error: cannot start worker %d\n", i);
+      unlink(socket_path);
+      return 1;
+    }
+  }
+  printf("Listening on %s with %d workers (%d pretrained tables)\n",
+         socket_path, nworkers, ntables);
+  fflush(stdout);
+
+  for (int i = 0; i < nworkers; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  for (int i = 0; i < nworkers; i++) {
+    message_ctx_free(workers[i].ctx);
+    free(workers[i].in);
+    free(workers[i].out);
+  }
+  free(workers);
+  for (int i = 0; i < ntables; i++)
+    huff_table_free(tables[i]);
+  close(listen_fd);
+  unlink(socket_path);
+  return 0;
+}
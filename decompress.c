@@ -1,175 +1,712 @@
 // decompress.c
-// Reverse pipeline: output.bin (Huffman) -> intermediate.rle -> mtf.bin -> bwt
-// -> recovered.txt Expects metadata in output.bin.meta written as: int32_t
-// primary_index; uint32_t original_length; Uses functions from your existing
-// files:
-//   void decompress_huffman(const char* input_file, const char* output_file);
-//   // main_huffman.c void decompress_rle(const char* input, const char*
-//   output);                // main_rle.c char* bwt_decode(const char* bwt, int
-//   original_index);                     // main_bwt.c
+// Reverse pipeline: output.bin (Huffman payloads) -> RLE -> MTF -> BWT
+// -> recovered.txt, one block at a time.  The block layout comes from
+// output.bin.meta (see main_container.h), which records for every block its
+// payload offset/length, original length, BWT primary index and the number
+// of RLE symbols the Huffman decoder has to produce.
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
-/* Declarations from your existing modules (we don't reimplement them here) */
-void decompress_huffman(const char* input_file,
-                        const char* output_file);  // from main_huffman.c
-void decompress_rle(const char* input, const char* output);  // from main_rle.c
-char* bwt_decode(const char* bwt, int original_index);       // from main_bwt.c
-unsigned char* mtf_decode(const unsigned char* input,
-                          size_t input_len,
-                          size_t* output_len);
-
-static long filesize(const char* path) {
-  FILE* f = fopen(path, "rb");
-  if (!f)
+#include "main_aio.h"
+#include "main_archive.h"
+#include "main_container.h"
+#include "main_dedup.h"
+#include "main_fmindex.h"
+#include "main_memory.h"
+
+/* Declarations from the other modules (we don't reimplement them here) */
+unsigned char* decompress_block(const unsigned char* payload,
+                                const struct block_entry* entry);  // main_block.c
+
+uint32_t crc32c_update(uint32_t crc,
+                       const void* data,
+                       size_t len);  // from main_crc32c.c
+
+struct batch_reader;
+struct batch_reader* batch_open(const char* path);  // from main_batch.c
+void batch_close(struct batch_reader* r);           // from main_batch.c
+uint64_t batch_count(const struct batch_reader* r);  // from main_batch.c
+unsigned char* batch_get(struct batch_reader* r,
+                         uint64_t record_id,
+                         size_t* len);  // from main_batch.c
+
+struct huff_table;
+struct huff_table* huff_table_load(const char* path);  // from main_huffman.c
+void huff_table_free(struct huff_table* t);           // from main_huffman.c
+struct message_ctx;
+struct message_ctx* message_ctx_create(void);     // from main_message.c
+void message_ctx_free(struct message_ctx* ctx);   // from main_message.c
+const unsigned char* decompress_message(struct message_ctx* ctx,
+                                        struct huff_table* const* tables,
+                                        int ntables,
+                                        const unsigned char* input,
+                                        size_t input_len,
+                                        size_t max_len,
+                                        size_t* output_len);  // main_message.c
+
+/* Longest stretch grep prints on either side of a match when no newline
+   ends the line sooner; and how much it reads at a time looking for one. */
+#define GREP_MAX_CONTEXT (1u << 20)
+#define GREP_CHUNK 256
+
+/* Open output.bin.fmi and check that it belongs to output.bin. */
+static struct fm_index* open_search_index(void) {
+  struct meta_info meta;
+  if (meta_read("output.bin.meta", &meta) != 0) {
+    fprintf(stderr, "Error: cannot read output.bin.meta\n");
+    return NULL;
+  }
+  struct fm_index* x = fmi_open("output.bin.fmi");
+  if (!x) {
+    fprintf(stderr, "Error: output.bin.fmi missing or malformed (build it "
+                    "with compressor -F or compressor index)\n");
+  } else if (!fmi_matches(x, meta.original_len, meta.stream_crc)) {
+    fprintf(stderr, "Error: output.bin.fmi is out of date (rebuild it with "
+                    "compressor index)\n");
+    fmi_close(x);
+    x = NULL;
+  }
+  meta_free(&meta);
+  return x;
+}
+
+/* count <pattern>...: occurrences of each pattern, from the FM-index. */
+static int count_command(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s count <pattern>...\n", argv[0]);
+    return 1;
+  }
+  struct fm_index* x = open_search_index();
+  if (!x)
+    return 1;
+  for (int a = 2; a < argc; a++) {
+    size_t m = strlen(argv[a]);
+    uint64_t n = m ? fmi_count(x, (const unsigned char*)argv[a], m) : 0;
+    printf("%llu\t%s\n", (unsigned long long)n, argv[a]);
+  }
+  fmi_close(x);
+  return 0;
+}
+
+/* Find where the occurrences of pattern start; prints the error itself. */
+static uint64_t* locate_pattern(const struct fm_index* x,
+                                const char* pattern,
+                                uint64_t* count) {
+  *count = 0;
+  if (!*pattern)
+    return NULL;
+  uint64_t* pos =
+      fmi_locate(x, (const unsigned char*)pattern, strlen(pattern), count);
+  if (*count == UINT64_MAX)
+    fprintf(stderr, "Error: output.bin.fmi is corrupt or memory ran out\n");
+  return pos;
+}
+
+/* locate <pattern>: input offset of every occurrence, ascending. */
+static int locate_command(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s locate <pattern>\n", argv[0]);
+    return 1;
+  }
+  struct fm_index* x = open_search_index();
+  if (!x)
+    return 1;
+  uint64_t count;
+  uint64_t* pos = locate_pattern(x, argv[2], &count);
+  for (uint64_t i = 0; count != UINT64_MAX && i < count; i++)
+    printf("%llu\n", (unsigned long long)pos[i]);
+  free(pos);
+  fmi_close(x);
+  return count == UINT64_MAX ? 1 : 0;
+}
+
+/* Bounds of the line around pos: from just past the newline before it to
+   the next newline (or the ends of the input, or GREP_MAX_CONTEXT away). */
+static int line_bounds(const struct fm_index* x,
+                       uint64_t pos,
+                       uint64_t* start,
+                       uint64_t* end) {
+  unsigned char chunk[GREP_CHUNK];
+  uint64_t total = fmi_length(x);
+  uint64_t s = pos;
+  while (s > 0 && pos - s < GREP_MAX_CONTEXT) {
+    size_t len = s < GREP_CHUNK ? (size_t)s : GREP_CHUNK;
+    if (fmi_extract(x, s - len, len, chunk) != 0)
+      return -1;
+    const unsigned char* nl = NULL;
+    for (size_t i = len; i-- > 0 && !nl;)
+      if (chunk[i] == '\n')
+        nl = chunk + i;
+    if (nl) {
+      s -= len - (size_t)(nl - chunk) - 1;
+      break;
+    }
+    s -= len;
+  }
+  uint64_t e = pos;
+  while (e < total && e - pos < GREP_MAX_CONTEXT) {
+    size_t len = total - e < GREP_CHUNK ? (size_t)(total - e) : GREP_CHUNK;
+    if (fmi_extract(x, e, len, chunk) != 0)
+      return -1;
+    const unsigned char* nl = memchr(chunk, '\n', len);
+    if (nl) {
+      e += (size_t)(nl - chunk);
+      break;
+    }
+    e += len;
+  }
+  *start = s;
+  *end = e;
+  return 0;
+}
+
+/* grep <pattern>: print every line of the input holding the pattern, once,
+   read back from the FM-index without decoding any block. */
+static int grep_command(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s grep <pattern>\n", argv[0]);
+    return 1;
+  }
+  struct fm_index* x = open_search_index();
+  if (!x)
+    return 1;
+  uint64_t count;
+  uint64_t* pos = locate_pattern(x, argv[2], &count);
+  int failed = count == UINT64_MAX;
+  uint64_t printed = 0;  // end of the last line printed
+  unsigned char* line = NULL;
+  for (uint64_t i = 0; !failed && i < count; i++) {
+    uint64_t start, end;
+    unsigned char* grown = NULL;
+    if (i > 0 && pos[i] < printed)
+      continue;  // another match on the same line
+    if (line_bounds(x, pos[i], &start, &end) != 0 ||
+        !(grown = realloc(line, (size_t)(end - start) + 1)) ||
+        fmi_extract(x, start, (size_t)(end - start), line = grown) != 0) {
+      fprintf(stderr, "Error: cannot read back offset %llu\n",
+              (unsigned long long)pos[i]);
+      failed = 1;
+      break;
+    }
+    line[end - start] = '\n';
+    fwrite(line, 1, (size_t)(end - start) + 1, stdout);
+    printed = end + 1;
+  }
+  free(line);
+  free(pos);
+  fmi_close(x);
+  return failed;
+}
+
+/* Tags of the requests the main decode keeps in flight. */
+enum { IO_READ, IO_WRITE };
+
+/* Check index entry i against the payloads before it (they end at *pos)
+   and start reading its payload into a new buffer, *payload. */
+static int read_payload(struct aio_queue* io,
+                        int fd,
+                        const struct meta_info* meta,
+                        uint64_t i,
+                        uint64_t* pos,
+                        unsigned char** payload) {
+  const struct block_entry* b = &meta->blocks[i];
+  if (b->offset != *pos || b->raw_len > meta->block_size) {
+    fprintf(stderr, "Block %llu: inconsistent index entry\n",
+            (unsigned long long)i);
     return -1;
-  if (fseek(f, 0, SEEK_END) != 0) {
-    fclose(f);
+  }
+  *payload = mem_alloc(b->comp_len ? (size_t)b->comp_len : 1);
+  if (!*payload ||
+      aio_read(io, fd, *payload, (size_t)b->comp_len, b->offset, IO_READ) !=
+          0) {
+    fprintf(stderr, "Block %llu: out of memory\n", (unsigned long long)i);
+    mem_free(*payload);
+    *payload = NULL;
     return -1;
   }
-  long s = ftell(f);
-  fclose(f);
-  return s;
+  *pos += b->comp_len;
+  return 0;
 }
 
-int main(void) {
-  const char* huff_in = "output.bin";
-  const char* meta_file = "output.bin.meta";
-  const char* rle_tmp = "intermediate.rle";
-  const char* mtf_tmp = "mtf.bin";
-  const char* final_txt = "recovered.txt";
+/* Wait for the block being written, if any, and free it. */
+static int finish_write(struct aio_queue* io,
+                        unsigned char** writing,
+                        uint64_t len) {
+  if (!*writing)
+    return 0;
+  int64_t res;
+  int err = aio_wait_tag(io, IO_WRITE, &res) != 0 || res != (int64_t)len;
+  mem_free(*writing);
+  *writing = NULL;
+  return err ? -1 : 0;
+}
 
-  // 1) Read metadata (primary index and original length)
-  FILE* m = fopen(meta_file, "rb");
-  if (!m) {
-    fprintf(stderr,
-            "Error: metadata file '%s' not found. Expected primary index + "
-            "original length.\n",
-            meta_file);
+/* message <input> <output> <table-file>...: decode one message frame; the
+   frame names its table, which must be among the ones given. */
+static int message_command(int argc, char** argv) {
+  if (argc < 5) {
+    fprintf(stderr, "usage: %s message <input> <output> <table-file>...\n",
+            argv[0]);
     return 1;
   }
-  int32_t primary_index = -1;
-  uint32_t original_len = 0;
-  if (fread(&primary_index, sizeof(primary_index), 1, m) != 1 ||
-      fread(&original_len, sizeof(original_len), 1, m) != 1) {
-    fclose(m);
-    fprintf(stderr, "Error: failed to read metadata from %s\n", meta_file);
+  int ntables = argc - 4;
+  struct huff_table** tables = calloc((size_t)ntables, sizeof(*tables));
+  if (!tables)
     return 1;
+  int ok = 1;
+  for (int i = 0; i < ntables && ok; i++) {
+    tables[i] = huff_table_load(argv[4 + i]);
+    if (!tables[i]) {
+      fprintf(stderr, "Error: cannot load Huffman table %s\n", argv[4 + i]);
+      ok = 0;
+    }
+  }
+
+  unsigned char* frame = NULL;
+  size_t frame_len = 0;
+  FILE* in = ok ? fopen(argv[2], "rb") : NULL;
+  if (in) {
+    // frames are small; grow the buffer until the whole file is in
+    size_t cap = 4096, got;
+    frame = malloc(cap);
+    while (frame && (got = fread(frame + frame_len, 1, cap - frame_len, in)) > 0) {
+      frame_len += got;
+      if (frame_len == cap) {
+        unsigned char* grown = realloc(frame, cap * 2);
+        if (!grown)
+          break;
+        frame = grown;
+        cap *= 2;
+      }
+    }
+    fclose(in);
+  } else if (ok) {
+    fprintf(stderr, "Error opening %s\n", argv[2]);
+    ok = 0;
   }
-  fclose(m);
-  printf("Read metadata: primary_index=%d, original_length=%u\n", primary_index,
-         original_len);
 
-  // 2) Huffman-decode output.bin -> intermediate.rle
-  printf("Running Huffman decompression: %s -> %s\n", huff_in, rle_tmp);
-  decompress_huffman(huff_in,
-                     rle_tmp);  // uses your main_huffman.c function.
-                                // :contentReference[oaicite:3]{index=3}
+  size_t out_len = 0;
+  struct message_ctx* ctx = message_ctx_create();
+  const unsigned char* orig =
+      ok && frame && ctx ? decompress_message(ctx, tables, ntables, frame,
+                                              frame_len, SIZE_MAX, &out_len)
+                         : NULL;
+  free(frame);
 
-  // Check RLE file exists
-  long rle_size = filesize(rle_tmp);
-  if (rle_size <= 0) {
-    fprintf(stderr,
-            "Error: RLE intermediate '%s' is empty or missing (size=%ld)\n",
-            rle_tmp, rle_size);
+  FILE* out = orig ? fopen(argv[3], "wb") : NULL;
+  ok = out && fwrite(orig, 1, out_len, out) == out_len;
+  if (out && fclose(out) != 0)
+    ok = 0;
+  message_ctx_free(ctx);
+  for (int i = 0; i < ntables; i++)
+    huff_table_free(tables[i]);
+  free(tables);
+  if (!ok) {
+    fprintf(stderr, "Error: message decompression failed\n");
     return 1;
   }
-  printf("Intermediate RLE size: %ld bytes\n", rle_size);
+  printf("Message decoded: %zu bytes -> %s\n", out_len, argv[3]);
+  return 0;
+}
 
-  // 3) RLE-decode -> mtf.bin
-  printf("Running RLE decompression: %s -> %s\n", rle_tmp, mtf_tmp);
-  decompress_rle(rle_tmp, mtf_tmp);  // uses your main_rle.c function.
-                                     // :contentReference[oaicite:4]{index=4}
+/* get <file.tcb> <record-id>: print one record of a batch to stdout,
+   decoding only the block that holds it. */
+static int get_command(int argc, char** argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s get <file.tcb> <record-id>\n", argv[0]);
+    return 1;
+  }
+  struct batch_reader* r = batch_open(argv[2]);
+  if (!r) {
+    fprintf(stderr, "Error: %s is not a readable record batch\n", argv[2]);
+    return 1;
+  }
+  uint64_t id = strtoull(argv[3], NULL, 10);
+  size_t len = 0;
+  unsigned char* rec = batch_get(r, id, &len);
+  if (!rec) {
+    fprintf(stderr, "Error: record %llu not found (batch has %llu)\n",
+            (unsigned long long)id, (unsigned long long)batch_count(r));
+    batch_close(r);
+    return 1;
+  }
+  fwrite(rec, 1, len, stdout);
+  fputc('\n', stdout);
+  free(rec);
+  batch_close(r);
+  return 0;
+}
 
-  long mtf_size = filesize(mtf_tmp);
-  if (mtf_size <= 0) {
-    fprintf(stderr,
-            "Error: MTF intermediate '%s' is empty or missing (size=%ld)\n",
-            mtf_tmp, mtf_size);
+/* restore <store-dir> <recipe> <output>: rebuild a deduplicated file. */
+static int restore_command(int argc, char** argv) {
+  if (argc != 5) {
+    fprintf(stderr, "usage: %s restore <store-dir> <recipe> <output>\n",
+            argv[0]);
     return 1;
   }
-  printf("MTF buffer size: %ld bytes\n", mtf_size);
+  if (dedup_restore_file(argv[2], argv[3], argv[4]) != 0) {
+    fprintf(stderr, "Error: restore failed\n");
+    return 1;
+  }
+  printf("Restored %s -> %s\n", argv[3], argv[4]);
+  return 0;
+}
 
-  // 4) Read mtf.bin into memory
-  FILE* f = fopen(mtf_tmp, "rb");
-  if (!f) {
-    fprintf(stderr, "Error opening %s\n", mtf_tmp);
+/* list <archive.tca>: size and name of every file. */
+static int list_command(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s list <archive.tca>\n", argv[0]);
     return 1;
   }
-  unsigned char* mtf_buf = malloc(mtf_size ? (size_t)mtf_size : 1);
-  if (!mtf_buf) {
-    fclose(f);
-    fprintf(stderr, "Out of memory\n");
+  struct archive_reader* r = archive_open(argv[2]);
+  if (!r) {
+    fprintf(stderr, "Error: %s is not a readable archive\n", argv[2]);
     return 1;
   }
-  size_t got = fread(mtf_buf, 1, (size_t)mtf_size, f);
-  fclose(f);
-  if ((long)got != mtf_size) {
-    free(mtf_buf);
-    fprintf(stderr, "Error reading %s\n", mtf_tmp);
+  for (uint64_t i = 0; i < archive_count(r); i++) {
+    size_t len;
+    const char* name = archive_name(r, i, &len);
+    printf("%12llu  %.*s\n", (unsigned long long)archive_size(r, i), (int)len,
+           name);
+  }
+  archive_close(r);
+  return 0;
+}
+
+/* extract <archive.tca> <name> <output>: one file, decoding only the
+   blocks that hold it ("-" writes to stdout).
+   extract <archive.tca> --all <dest-dir>: every file. */
+static int extract_command(int argc, char** argv) {
+  if (argc != 5) {
+    fprintf(stderr,
+            "usage: %s extract <archive.tca> <name> <output>\n"
+            "       %s extract <archive.tca> --all <dest-dir>\n",
+            argv[0], argv[0]);
     return 1;
   }
+  struct archive_reader* r = archive_open(argv[2]);
+  if (!r) {
+    fprintf(stderr, "Error: %s is not a readable archive\n", argv[2]);
+    return 1;
+  }
+  int err;
+  if (strcmp(argv[3], "--all") == 0) {
+    err = archive_unpack(r, argv[4]) != 0;
+    if (!err)
+      printf("Extracted %llu files to %s\n",
+             (unsigned long long)archive_count(r), argv[4]);
+  } else {
+    int64_t i = archive_find(r, argv[3]);
+    if (i < 0) {
+      fprintf(stderr, "Error: %s is not in %s\n", argv[3], argv[2]);
+      archive_close(r);
+      return 1;
+    }
+    int to_stdout = strcmp(argv[4], "-") == 0;
+    FILE* out = to_stdout ? stdout : fopen(argv[4], "wb");
+    err = !out || archive_extract(r, (uint64_t)i, out) != 0;
+    if (out && !to_stdout && fclose(out) != 0)
+      err = 1;
+    if (err)
+      fprintf(stderr, "Error: cannot extract %s\n", argv[3]);
+  }
+  archive_close(r);
+  return err;
+}
+
+/* Shared state of a --test run: workers claim blocks by index. */
+struct test_job {
+  const struct meta_info* meta;
+  const char* path;
+  pthread_mutex_t lock;
+  uint64_t next;
+  uint64_t bad;
+};
+
+static void* test_worker(void* arg) {
+  struct test_job* job = arg;
+  FILE* in = fopen(job->path, "rb");
+  unsigned char* payload = NULL;
+  size_t cap = 0;
+  for (;;) {
+    pthread_mutex_lock(&job->lock);
+    uint64_t i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if (i >= job->meta->nblocks)
+      break;
+    const struct block_entry* b = &job->meta->blocks[i];
+    uint64_t cost = mem_block_cost(MEM_DECOMPRESS, b->raw_len, NULL);
+    int ok = in != NULL && b->raw_len <= job->meta->block_size &&
+             mem_acquire(cost) == 0;
+    int reserved = ok;
+    if (ok && b->comp_len > cap) {
+      unsigned char* grown = realloc(payload, (size_t)b->comp_len);
+      if (grown) {
+        payload = grown;
+        cap = (size_t)b->comp_len;
+      }
+      ok = grown != NULL;
+    }
+    unsigned char* orig = NULL;
+    if (ok && file_seek(in, b->offset) == 0 &&
+        fread(payload, 1, (size_t)b->comp_len, in) == b->comp_len)
+      orig = decompress_block(payload, b);  // verifies the block checksum
+    if (reserved)
+      mem_release(cost);
+    if (!orig) {
+      fprintf(stderr, "Block %llu: FAILED\n", (unsigned long long)i);
+      pthread_mutex_lock(&job->lock);
+      job->bad++;
+      pthread_mutex_unlock(&job->lock);
+    }
+    mem_free(orig);
+  }
+  free(payload);
+  if (in)
+    fclose(in);
+  return NULL;
+}
 
-  // 5) inverse MTF
-  printf("Running inverse MTF (length %zu)\n", got);
-  size_t bwt_len = 0;
-  unsigned char* bwt_buf = mtf_decode(mtf_buf, got, &bwt_len);
-  free(mtf_buf);
-  if (!bwt_buf) {
-    fprintf(stderr, "MTF decode failed\n");
+/* --test [-t threads]: decode every block of output.bin on a pool of
+   threads and check the block and stream checksums, without writing the
+   restored data anywhere. */
+static int test_command(int argc, char** argv) {
+  int threads = 0;
+  if (argc == 4 && strcmp(argv[2], "-t") == 0) {
+    threads = atoi(argv[3]);
+  } else if (argc != 2) {
+    fprintf(stderr, "usage: %s --test [-t threads]\n", argv[0]);
     return 1;
   }
+#ifndef _WIN32
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (threads <= 0)
+    threads = 1;
 
-  // ensure null-terminated string for bwt_decode (it expects a C string)
-  char* bwt_cstr = malloc(bwt_len + 1);
-  if (!bwt_cstr) {
-    free(bwt_buf);
-    fprintf(stderr, "Out of memory\n");
+  struct meta_info meta;
+  if (meta_read("output.bin.meta", &meta) != 0) {
+    fprintf(stderr, "Error: cannot read output.bin.meta\n");
     return 1;
   }
-  memcpy(bwt_cstr, bwt_buf, bwt_len);
-  bwt_cstr[bwt_len] = '\0';
-  free(bwt_buf);
+  struct mem_plan plan = {meta.block_size, threads, 1, 0, 0};
+  if (mem_limit() && mem_plan_decompress(mem_limit(), &plan) != 0) {
+    fprintf(stderr, "Error: --max-memory is too small for blocks of %u "
+                    "bytes\n", meta.block_size);
+    meta_free(&meta);
+    return 1;
+  }
+  threads = plan.workers;
+  // the index itself: contiguous payloads, lengths adding up, stream CRC
+  uint64_t pos = 0, total = 0;
+  int failed = 0;
+  for (uint64_t i = 0; i < meta.nblocks; i++) {
+    if (meta.blocks[i].offset != pos)
+      failed = 1;
+    pos += meta.blocks[i].comp_len;
+    total += meta.blocks[i].raw_len;
+  }
+  uint32_t crc = 0;
+  int checksummed = meta_combined_crc(&meta, &crc) == 0;
+  if (failed || total != meta.original_len ||
+      (checksummed && crc != meta.stream_crc)) {
+    fprintf(stderr, "Error: the block index is inconsistent\n");
+    failed = 1;
+  }
+
+  struct test_job job = {&meta, "output.bin", PTHREAD_MUTEX_INITIALIZER, 0, 0};
+  pthread_t* tids = malloc((size_t)threads * sizeof(*tids));
+  int started = 0;
+  for (; !failed && tids && started < threads; started++)
+    if (pthread_create(&tids[started], NULL, test_worker, &job) != 0)
+      break;
+  if (started == 0 && !failed)
+    test_worker(&job);
+  for (int t = 0; t < started; t++)
+    pthread_join(tids[t], NULL);
+  free(tids);
+
+  if (!failed && job.bad == 0)
+    printf("OK: %llu blocks, %llu bytes%s\n", (unsigned long long)meta.nblocks,
+           (unsigned long long)meta.original_len,
+           checksummed ? ", CRC32C verified" : " (no checksums in this index)");
+  else if (!failed)
+    fprintf(stderr, "FAILED: %llu of %llu blocks\n",
+            (unsigned long long)job.bad, (unsigned long long)meta.nblocks);
+  meta_free(&meta);
+  return failed || job.bad ? 1 : 0;
+}
 
-  // 6) inverse BWT
-  printf("Running inverse BWT (primary index %d, length %zu)\n", primary_index,
-         bwt_len);
-  char* orig = bwt_decode(
-      bwt_cstr, primary_index);  // uses your main_bwt.c function.
-                                 // :contentReference[oaicite:5]{index=5}
-  free(bwt_cstr);
-  if (!orig) {
-    fprintf(stderr, "BWT decode failed\n");
+int main(int argc, char** argv) {
+  uint64_t budget;
+  if (mem_take_option(&argc, argv, &budget) != 0) {
+    fprintf(stderr, "Error: --max-memory takes a size such as 512M or 2G\n");
     return 1;
   }
+  mem_set_limit(budget);
 
-  // 7) Optionally check that orig length matches original_len (metadata)
-  size_t outlen = strlen(orig);
-  if ((uint32_t)outlen != original_len) {
+  if (argc > 1 && strcmp(argv[1], "message") == 0)
+    return message_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "get") == 0)
+    return get_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "restore") == 0)
+    return restore_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "--test") == 0)
+    return test_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "list") == 0)
+    return list_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "extract") == 0)
+    return extract_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "count") == 0)
+    return count_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "locate") == 0)
+    return locate_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "grep") == 0)
+    return grep_command(argc, argv);
+
+  const char* huff_in = "output.bin";
+  const char* meta_file = "output.bin.meta";
+  const char* final_txt = "recovered.txt";
+
+  // 1) Read the block index
+  struct meta_info meta;
+  if (meta_read(meta_file, &meta) != 0) {
     fprintf(stderr,
-            "Warning: decoded length %zu differs from metadata original length "
-            "%u\n",
-            outlen, original_len);
-    // still proceed to write what we got
+            "Error: metadata file '%s' missing or not a version 2-%d block "
+            "index.\n",
+            meta_file, META_VERSION);
+    return 1;
+  }
+  printf("Read metadata: %llu blocks, original_length=%llu\n",
+         (unsigned long long)meta.nblocks,
+         (unsigned long long)meta.original_len);
+  struct mem_plan plan = {meta.block_size, 1, 1, 2, 0};
+  if (budget && mem_plan_decompress(budget, &plan) != 0) {
+    fprintf(stderr, "Error: --max-memory %llu is too small for blocks of %u "
+                    "bytes (needs %llu)\n",
+            (unsigned long long)budget, meta.block_size,
+            (unsigned long long)mem_plan_cost(MEM_DECOMPRESS, &plan));
+    meta_free(&meta);
+    return 1;
   }
 
-  // 8) Write final output
+  FILE* in = fopen(huff_in, "rb");
+  if (!in) {
+    meta_free(&meta);
+    fprintf(stderr, "Error opening %s\n", huff_in);
+    return 1;
+  }
   FILE* out = fopen(final_txt, "wb");
-  if (!out) {
-    free(orig);
+  struct aio_queue* io = out ? aio_create(4) : NULL;
+  if (!io) {
+    if (out)
+      fclose(out);
+    fclose(in);
+    meta_free(&meta);
     fprintf(stderr, "Cannot open %s for writing\n", final_txt);
     return 1;
   }
-  fwrite(orig, 1, outlen, out);
-  fclose(out);
-  free(orig);
+  int in_fd = file_fd(in);
+  int out_fd = file_fd(out);
+
+  // 2) Decode the blocks in order; payloads are stored back to back.  The
+  // next payload is read and the previous block written in the background
+  // (main_aio.c) while a block decodes, unless the memory plan had to drop
+  // the room for them (then each transfer is waited for).
+  int overlap = plan.queue >= 2;
+  uint32_t crc = 0;
+  uint64_t written = 0;
+  uint64_t pos = 0;
+  unsigned char* next = NULL;     // payload being read
+  unsigned char* writing = NULL;  // block being written
+  uint64_t writing_len = 0;
+  int failed = meta.nblocks > 0 &&
+               read_payload(io, in_fd, &meta, 0, &pos, &next) != 0;
+  for (uint64_t i = 0; i < meta.nblocks && !failed; i++) {
+    const struct block_entry* b = &meta.blocks[i];
+    int64_t res;
+    unsigned char* payload = next;
+    next = NULL;
+    if (aio_wait_tag(io, IO_READ, &res) != 0 || res != (int64_t)b->comp_len) {
+      fprintf(stderr, "Block %llu: truncated payload\n", (unsigned long long)i);
+      mem_free(payload);
+      failed = 1;
+      break;
+    }
+    if (overlap && i + 1 < meta.nblocks &&
+        read_payload(io, in_fd, &meta, i + 1, &pos, &next) != 0) {
+      mem_free(payload);
+      failed = 1;
+      break;
+    }
+
+    unsigned char* orig = decompress_block(payload, b);
+    mem_free(payload);
+    if (!orig) {
+      fprintf(stderr, "Block %llu: decode failed\n", (unsigned long long)i);
+      failed = 1;
+      break;
+    }
+    crc = crc32c_update(crc, orig, (size_t)b->raw_len);
+    if (finish_write(io, &writing, writing_len) != 0 ||
+        aio_write(io, out_fd, orig, (size_t)b->raw_len, written, IO_WRITE) !=
+            0) {
+      fprintf(stderr, "Error writing %s\n", final_txt);
+      mem_free(orig);
+      failed = 1;
+      break;
+    }
+    writing = orig;
+    writing_len = b->raw_len;
+    written += b->raw_len;
+    if (!overlap && finish_write(io, &writing, writing_len) != 0) {
+      fprintf(stderr, "Error writing %s\n", final_txt);
+      failed = 1;
+      break;
+    }
+    if (!overlap && i + 1 < meta.nblocks &&
+        read_payload(io, in_fd, &meta, i + 1, &pos, &next) != 0) {
+      failed = 1;
+      break;
+    }
+  }
+  if (finish_write(io, &writing, writing_len) != 0 && !failed) {
+    fprintf(stderr, "Error writing %s\n", final_txt);
+    failed = 1;
+  }
+  aio_destroy(io);  // waits for a read still in flight after a failure
+  mem_free(next);
+  fclose(in);
+  if (fclose(out) != 0)
+    failed = 1;
 
-  printf("Decompression complete — result written to %s (size %zu bytes)\n",
-         final_txt, outlen);
+  // 3) Check the total against the metadata
+  if (!failed && written != meta.original_len) {
+    fprintf(stderr,
+            "Error: decoded length %llu differs from metadata original length "
+            "%llu\n",
+            (unsigned long long)written, (unsigned long long)meta.original_len);
+    failed = 1;
+  }
+  uint32_t expected;
+  if (!failed && meta_combined_crc(&meta, &expected) == 0 &&
+      (crc != expected || crc != meta.stream_crc)) {
+    fprintf(stderr, "Error: stream checksum mismatch\n");
+    failed = 1;
+  }
+  meta_free(&meta);
+  if (failed)
+    return 1;
 
-  // done
+  printf("Decompression complete — result written to %s (size %llu bytes)\n",
+         final_txt, (unsigned long long)written);
   return 0;
 }
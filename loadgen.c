@@ -0,0 +1,231 @@
+// loadgen.c
+// Load generator for the compression daemon: opens several connections,
+// sends the same payload over and over and reports latency percentiles.
+// Usage: loadgen [-s socket-path] [-c connections] [-n requests] [-r]
+//                [-p daemon-pid] <payload-file>
+//   -c  concurrent connections (threads), default 4
+//   -n  requests per connection, default 1000
+//   -r  round trip: decompress every compressed frame and verify it; the
+//       reported latency then covers both requests
+//   -p  leak check: run the load once unmeasured to warm the daemon up,
+//       then again, and fail if the daemon's resident memory (from
+//       /proc/<pid>/status) grew by more than LEAK_SLACK_KB in between
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "main_socket.h"
+
+/* Growth of the daemon's resident set over a warm run that still counts as
+   flat: allocator noise, far below a per-request leak. */
+#define LEAK_SLACK_KB 512
+
+struct client {
+  pthread_t thread;
+  const char* path;
+  const unsigned char* payload;
+  uint32_t payload_len;
+  int requests;
+  int round_trip;
+  double* latency_us;  // one per request
+  int done;
+  int failed;
+  uint64_t compressed_bytes;
+};
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static void* client_main(void* arg) {
+  struct client* c = arg;
+  int fd = sock_connect(c->path);
+  if (fd < 0) {
+    c->failed = 1;
+    return NULL;
+  }
+  unsigned char* frame = NULL;
+  unsigned char* orig = NULL;
+  size_t frame_cap = 0, orig_cap = 0;
+  for (int i = 0; i < c->requests; i++) {
+    uint32_t frame_len = 0, orig_len = 0;
+    uint8_t status = DAEMON_STATUS_ERROR;
+    double t0 = now_us();
+    if (daemon_call(fd, DAEMON_OP_COMPRESS, c->payload, c->payload_len,
+                    &frame, &frame_cap, &frame_len, &status) != 0 ||
+        status != DAEMON_STATUS_OK) {
+      c->failed = 1;
+      break;
+    }
+    if (c->round_trip &&
+        (daemon_call(fd, DAEMON_OP_DECOMPRESS, frame, frame_len, &orig,
+                     &orig_cap, &orig_len, &status) != 0 ||
+         status != DAEMON_STATUS_OK || orig_len != c->payload_len ||
+         memcmp(orig, c->payload, orig_len) != 0)) {
+      c->failed = 1;
+      break;
+    }
+    c->latency_us[i] = now_us() - t0;
+    c->compressed_bytes += frame_len;
+    c->done++;
+  }
+  close(fd);
+  free(frame);
+  free(orig);
+  return NULL;
+}
+
+/* VmRSS of process pid in KiB, or -1 if it cannot be read. */
+static long resident_kb(long pid) {
+  char path[64], line[256];
+  snprintf(path, sizeof(path), "/proc/%ld/status", pid);
+  FILE* f = fopen(path, "r");
+  if (!f)
+    return -1;
+  long kb = -1;
+  while (fgets(line, sizeof(line), f))
+    if (sscanf(line, "VmRSS: %ld", &kb) == 1)
+      break;
+  fclose(f);
+  return kb;
+}
+
+/* Run the clients to completion. */
+static void run_clients(struct client* clients, int nconn) {
+  for (int i = 0; i < nconn; i++)
+    pthread_create(&clients[i].thread, NULL, client_main, &clients[i]);
+  for (int i = 0; i < nconn; i++)
+    pthread_join(clients[i].thread, NULL);
+}
+
+static int cmp_double(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t n, double p) {
+  size_t i = (size_t)(p / 100.0 * (double)(n - 1) + 0.5);
+  return sorted[i < n ? i : n - 1];
+}
+
+int main(int argc, char** argv) {
+  const char* path = DAEMON_DEFAULT_SOCKET;
+  int nconn = 4, nreq = 1000, round_trip = 0;
+  long daemon_pid = 0;
+  int a = 1;
+  for (; a < argc - 1; a++) {
+    if (strcmp(argv[a], "-s") == 0 && a + 2 < argc)
+      path = argv[++a];
+    else if (strcmp(argv[a], "-c") == 0 && a + 2 < argc)
+      nconn = atoi(argv[++a]);
+    else if (strcmp(argv[a], "-n") == 0 && a + 2 < argc)
+      nreq = atoi(argv[++a]);
+    else if (strcmp(argv[a], "-p") == 0 && a + 2 < argc)
+      daemon_pid = atol(argv[++a]);
+    else if (strcmp(argv[a], "-r") == 0)
+      round_trip = 1;
+    else
+      break;
+  }
+  if (a != argc - 1 || nconn < 1 || nreq < 1) {
+    fprintf(stderr,
+            "usage: %s [-s socket-path] [-c connections] [-n requests] [-r] "
+            "[-p daemon-pid] <payload-file>\n",
+            argv[0]);
+    return 1;
+  }
+
+  FILE* f = fopen(argv[a], "rb");
+  unsigned char* payload = malloc(DAEMON_MAX_PAYLOAD);
+  size_t len = f && payload ? fread(payload, 1, DAEMON_MAX_PAYLOAD, f) : 0;
+  if (f)
+    fclose(f);
+  if (!f || !payload) {
+    fprintf(stderr, "Error: cannot read %s\n", argv[a]);
+    free(payload);
+    return 1;
+  }
+
+  struct client* clients = calloc((size_t)nconn, sizeof(*clients));
+  double* all = malloc((size_t)nconn * (size_t)nreq * sizeof(double));
+  if (!clients || !all) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < nconn; i++) {
+    clients[i].path = path;
+    clients[i].payload = payload;
+    clients[i].payload_len = (uint32_t)len;
+    clients[i].requests = nreq;
+    clients[i].round_trip = round_trip;
+    clients[i].latency_us = all + (size_t)i * (size_t)nreq;
+  }
+  long rss_warm = -1;
+  if (daemon_pid) {
+    run_clients(clients, nconn);
+    rss_warm = resident_kb(daemon_pid);
+    if (rss_warm < 0) {
+      fprintf(stderr, "Error: cannot read the memory of process %ld\n",
+              daemon_pid);
+      return 1;
+    }
+    for (int i = 0; i < nconn; i++) {
+      clients[i].done = 0;
+      clients[i].compressed_bytes = 0;
+    }
+  }
+  double t0 = now_us();
+  run_clients(clients, nconn);
+  double elapsed_s = (now_us() - t0) / 1e6;
+  size_t total = 0;
+  uint64_t compressed = 0;
+  int failed = 0;
+  for (int i = 0; i < nconn; i++) {
+    // compact the completed samples to the front
+    memmove(all + total, clients[i].latency_us,
+            (size_t)clients[i].done * sizeof(double));
+    total += (size_t)clients[i].done;
+    compressed += clients[i].compressed_bytes;
+    failed |= clients[i].failed;
+  }
+
+  if (total == 0) {
+    fprintf(stderr, "Error: no request succeeded (is the daemon running?)\n");
+    return 1;
+  }
+  qsort(all, total, sizeof(double), cmp_double);
+  printf("requests    : %zu over %d connections%s\n", total, nconn,
+         round_trip ? " (compress + decompress)" : "");
+  printf("payload     : %zu bytes -> %.1f bytes avg\n", len,
+         (double)compressed / (double)total);
+  printf("throughput  : %.0f req/s\n", (double)total / elapsed_s);
+  printf("latency p50 : %.1f us\n", percentile(all, total, 50));
+  printf("latency p90 : %.1f us\n", percentile(all, total, 90));
+  printf("latency p99 : %.1f us\n", percentile(all, total, 99));
+  printf("latency max : %.1f us\n", all[total - 1]);
+  if (failed)
+    fprintf(stderr, "Warning: some connections failed or did not verify\n");
+  if (daemon_pid) {
+    long rss = resident_kb(daemon_pid);
+    printf("daemon RSS  : %ld KiB after warm-up, %ld KiB after the run\n",
+           rss_warm, rss);
+    if (rss < 0 || rss - rss_warm > LEAK_SLACK_KB) {
+      fprintf(stderr, "Error: daemon memory grew over the run (leak?)\n");
+      failed = 1;
+    }
+  }
+
+  free(all);
+  free(clients);
+  free(payload);
+  return failed;
+}
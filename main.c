@@ -1,162 +1,895 @@
 // main.c
-// Pipeline: read <user file> -> BWT -> MTF -> RLE -> Huffman (output.bin)
-// Produces output.bin (Huffman payload) and output.bin.meta (primary index +
-// original length)
+// Pipeline: read <user file> block by block -> BWT -> MTF -> RLE -> Huffman
+// Produces output.bin (Huffman payloads, one per block) and output.bin.meta
+// (block index: offsets, lengths and primary indices; see main_container.h)
+// The input is streamed, so files larger than memory (and larger than 4 GB)
+// are handled; only one block is resident at a time.
 
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* Prototypes for functions implemented in your uploaded files */
-char* bwt_encode(const char* input, int* original_index);  // from main_bwt.c
-void compress_huffman_s(const char* input_file,
-                        const char* output_file);          // from main_huffman.c
-size_t compress_rle_buffer(const unsigned char* input,
-                           size_t input_len,
-                           unsigned char* output,
-                           size_t output_capacity);
-
-/* MTF encode (you must implement this somewhere, e.g. mtf.c) */
-unsigned char* mtf_encode(const unsigned char* input,
-                          size_t input_len,
-                          size_t* out_len);
-
-int main(void) {
-  char input_path[512];
-  const char* intermediate_rle = "intermediate.rle";
+#include "main_aio.h"
+#include "main_archive.h"
+#include "main_container.h"
+#include "main_dedup.h"
+#include "main_fmindex.h"
+#include "main_memory.h"
+
+/* Block size used to split the input; each block is transformed on its own
+   with 32-bit in-memory indices. */
+#define DEFAULT_BLOCK_SIZE (4u << 20)
+
+/* Default block size for record batches: smaller blocks make a point
+   lookup decode less data. */
+#define DEFAULT_BATCH_BLOCK_SIZE (1u << 20)
+
+/* Same trade-off for archives, where a block is also the unit of work of
+   one compression thread. */
+#define DEFAULT_ARCHIVE_BLOCK_SIZE (1u << 20)
+
+/* Prototypes for functions implemented in the other modules */
+unsigned char* compress_block(const unsigned char* block,
+                              uint32_t len,
+                              const struct block_options* opts,
+                              struct block_entry* entry);  // main_block.c
+unsigned char* compress_block_inplace(unsigned char* block,
+                                      uint32_t len,
+                                      const struct block_options* opts,
+                                      struct block_entry* entry);  // main_block.c
+int compress_block_external(const char* input_path,
+                            uint64_t offset,
+                            uint64_t len,
+                            const struct block_options* opts,
+                            FILE* out,
+                            struct block_entry* entry);  // main_block.c
+uint32_t crc32c_update(uint32_t crc,
+                       const void* data,
+                       size_t len);  // from main_crc32c.c
+uint32_t split_block(const unsigned char* buf,
+                     uint32_t n,
+                     uint32_t min_len,
+                     int at_end);  // from main_split.c
+
+struct batch_writer;
+struct batch_writer* batch_create(const char* path,
+                                  uint32_t block_size);  // main_batch.c
+int batch_add(struct batch_writer* w,
+              const void* record,
+              size_t len,
+              uint64_t* record_id);                // main_batch.c
+int batch_finish(struct batch_writer* w);          // main_batch.c
+
+struct huff_table;
+struct huff_table* huff_table_load(const char* path);  // from main_huffman.c
+void huff_table_free(struct huff_table* t);           // from main_huffman.c
+int huff_table_save(const char* path,
+                    uint32_t id,
+                    const unsigned freq[256]);  // from main_huffman.c
+int message_train_sample(const unsigned char* input,
+                         size_t input_len,
+                         unsigned long long counts[256]);  // main_message.c
+size_t message_bound(size_t input_len);                  // main_message.c
+struct message_ctx;
+size_t compress_message(struct message_ctx* ctx,
+                        const struct huff_table* table,
+                        const unsigned char* input,
+                        size_t input_len,
+                        unsigned char* output,
+                        size_t output_capacity);  // from main_message.c
+
+struct pipeline_stats {
+  uint64_t bwt_len;
+  uint64_t mtf_len;
+  uint64_t rle_len;
+  uint64_t out_len;
+  uint64_t split_blocks;  // ended early by the adaptive splitter
+};
+
+/* Fit a compression run to the --max-memory limit, if there is one: the
+   read-ahead block and the payload being written go first (*overlap is
+   cleared), then the sort threads, then (unless it is fixed) the block
+   size.  With a scratch directory the disk-backed builder gets half the
+   limit for its heap unless -M set one. */
+static int plan_memory(uint32_t* block_size,
+                       struct block_options* opts,
+                       int fixed_block,
+                       int* overlap) {
+  uint64_t budget = mem_limit();
+  *overlap = 1;
+  if (budget == 0)
+    return 0;
+  if (opts->scratch_dir) {
+    if (opts->memory_budget == 0)
+      opts->memory_budget = budget / 2;
+    return 0;
+  }
+  enum mem_op op = opts->fast         ? MEM_COMPRESS_FAST
+                   : opts->low_memory ? MEM_COMPRESS_INPLACE
+                                      : MEM_COMPRESS;
+  struct mem_plan p = {*block_size, 1, opts->threads, 2, opts->lzp};
+  if (mem_plan_compress(budget, op, !fixed_block, &p) != 0) {
+    fprintf(stderr,
+            "Error: --max-memory %llu is too small for blocks of %u bytes "
+            "(needs %llu)\n",
+            (unsigned long long)budget, p.block_size,
+            (unsigned long long)mem_plan_cost(op, &p));
+    return -1;
+  }
+  *block_size = p.block_size;
+  opts->threads = p.sort_threads;
+  *overlap = p.queue >= 2;
+  return 0;
+}
+
+/* Tags of the requests compress_file keeps in flight. */
+enum { IO_READ, IO_WRITE };
+
+/* Start reading the block at *pos (up to block_size bytes before end) into
+   buf; nothing if the input is exhausted. */
+static int read_ahead(struct aio_queue* io,
+                      int fd,
+                      unsigned char* buf,
+                      uint64_t* pos,
+                      uint64_t end,
+                      uint32_t block_size) {
+  uint64_t len = end - *pos < block_size ? end - *pos : block_size;
+  if (len == 0)
+    return 0;
+  if (aio_read(io, fd, buf, (size_t)len, *pos, IO_READ) != 0)
+    return -1;
+  *pos += len;
+  return 0;
+}
+
+/* Wait for the payload being written, if any, and free it. */
+static int finish_write(struct aio_queue* io,
+                        unsigned char** writing,
+                        uint64_t len) {
+  if (!*writing)
+    return 0;
+  int64_t res;
+  int err = aio_wait_tag(io, IO_WRITE, &res) != 0 || res != (int64_t)len;
+  mem_free(*writing);
+  *writing = NULL;
+  return err ? -1 : 0;
+}
+
+/* Whether the input still holds every block kept from an appended
+   container: the CRC32C stored for each must match its source bytes.
+   Returns 0 if they all match, -1 on a mismatch or read error, and 1 if a
+   kept block has no checksum (indexes before version 4), which cannot be
+   checked. */
+static int check_kept_blocks(FILE* f, const struct meta_info* meta) {
+  for (uint64_t i = 0; i < meta->nblocks; i++)
+    if (!(meta->blocks[i].flags & BLOCK_FLAG_CRC))
+      return 1;
+  if (file_seek(f, 0) != 0)
+    return -1;
+  unsigned char buf[1 << 16];
+  for (uint64_t i = 0; i < meta->nblocks; i++) {
+    const struct block_entry* b = &meta->blocks[i];
+    uint32_t crc = 0;
+    for (uint64_t left = b->raw_len; left > 0;) {
+      size_t want = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+      if (fread(buf, 1, want, f) != want)
+        return -1;
+      crc = crc32c_update(crc, buf, want);
+      left -= want;
+    }
+    if (crc != (uint32_t)b->checksum)
+      return -1;
+  }
+  return 0;
+}
+
+/* Move len bytes of f from src down to dst (dst < src). */
+static int move_down(FILE* f, uint64_t dst, uint64_t src, uint64_t len) {
+  unsigned char buf[1 << 16];
+  for (uint64_t done = 0; done < len;) {
+    size_t n = len - done < sizeof(buf) ? (size_t)(len - done) : sizeof(buf);
+    if (file_seek(f, src + done) != 0 || fread(buf, 1, n, f) != n ||
+        file_seek(f, dst + done) != 0 || fwrite(buf, 1, n, f) != n)
+      return -1;
+    done += n;
+  }
+  return fflush(f) == 0 ? 0 : -1;
+}
+
+/* Compress input_path into output.bin + output.bin.meta.  With append set,
+   an existing container of an earlier, shorter version of the same file is
+   extended instead: only bytes past the indexed length are compressed.  A
+   partial last block is dropped and rebuilt from the source together with
+   the new bytes, so blocks stay full; every other payload is left as it is
+   and only the index is rewritten.  The indexed prefix of the source must
+   not have changed since (log files that only grow); every kept block is
+   checked against its CRC32C, and a container without them cannot be
+   appended to.  Until the new blocks are all written the old container
+   stays valid: they go after the dropped block, and a failed run cuts them
+   off again.  Under --max-memory
+   the block size shrinks to fit unless fixed_block is set (an appended
+   container keeps its own).  With fm_index set, output.bin.fmi is
+   (re)built afterwards for count/locate/grep (main_fmindex.h).  A nonzero
+   min_block makes block_size the largest block: each one ends early where
+   the data changes character (main_split.c), but not before min_block
+   bytes. */
+static int compress_file(const char* input_path,
+                         uint32_t block_size,
+                         uint32_t min_block,
+                         struct block_options* opts,
+                         int append,
+                         int fixed_block,
+                         int fm_index) {
   const char* output_bin = "output.bin";
   const char* meta_file = "output.bin.meta";
+  const char* index_file = "output.bin.fmi";
 
-  // --- Ask user for input file path ---
-  printf("Enter input file path: ");
-  if (!fgets(input_path, sizeof(input_path), stdin)) {
-    fprintf(stderr, "Error: failed to read input path\n");
-    return 1;
+  struct meta_info meta;
+  uint64_t offset = 0;  // end of the kept payloads in output.bin
+  uint64_t shift = 0;   // the dropped payload, written after until commit
+  if (append) {
+    if (meta_read(meta_file, &meta) != 0) {
+      fprintf(stderr, "Error: cannot read %s\n", meta_file);
+      return 1;
+    }
+    block_size = meta.block_size;
+    uint32_t max_block =
+        opts->scratch_dir ? MAX_EXTERNAL_BLOCK_SIZE : MAX_BLOCK_SIZE;
+    if (block_size == 0 || block_size > max_block) {
+      meta_free(&meta);
+      fprintf(stderr, "Error: %s has an unusable block size\n", meta_file);
+      return 1;
+    }
+    if (meta.nblocks > 0 &&
+        meta.blocks[meta.nblocks - 1].raw_len < block_size) {
+      meta.nblocks--;
+      meta.original_len -= meta.blocks[meta.nblocks].raw_len;
+      shift = meta.blocks[meta.nblocks].comp_len;
+    }
+    if (meta.nblocks > 0)
+      offset = meta.blocks[meta.nblocks - 1].offset +
+               meta.blocks[meta.nblocks - 1].comp_len;
   }
-  // remove trailing newline (if any)
-  size_t ip_len = strlen(input_path);
-  if (ip_len > 0 && (input_path[ip_len - 1] == '\n' || input_path[ip_len - 1] == '\r')) {
-    input_path[ip_len - 1] = '\0';
+  int overlap;
+  if (plan_memory(&block_size, opts, fixed_block || append, &overlap) != 0) {
+    if (append)
+      meta_free(&meta);
+    return 1;
   }
+  if (!append)
+    meta_init(&meta, block_size);
 
-  // --- Read entire file into buffer ---
   FILE* f = fopen(input_path, "rb");
   if (!f) {
+    meta_free(&meta);
     fprintf(stderr, "Error: cannot open %s\n", input_path);
     return 1;
   }
-  fseek(f, 0, SEEK_END);
-  long fsize = ftell(f);
-  fseek(f, 0, SEEK_SET);
-  if (fsize < 0) {
+  int64_t file_len = 0;
+  if (file_seek_end(f) != 0 || (file_len = file_tell(f)) < 0 ||
+      file_seek(f, meta.original_len) != 0 ||
+      (uint64_t)file_len < meta.original_len) {
+    fclose(f);
+    meta_free(&meta);
+    fprintf(stderr, "Error: %s is shorter than the compressed data\n",
+            input_path);
+    return 1;
+  }
+  int kept = append ? check_kept_blocks(f, &meta) : 0;
+  if (kept != 0 || file_seek(f, meta.original_len) != 0) {
+    fclose(f);
+    meta_free(&meta);
+    if (kept > 0)
+      fprintf(stderr,
+              "Error: %s has blocks without checksums, so the source cannot "
+              "be checked; compress it anew instead of appending\n",
+              meta_file);
+    else
+      fprintf(stderr,
+              "Error: %s has changed where it was already compressed; "
+              "compress it anew instead of appending\n",
+              input_path);
+    return 1;
+  }
+  FILE* out = fopen(output_bin, append ? "r+b" : "wb");
+  if (!out || (append && file_seek(out, offset + shift) != 0)) {
+    if (out)
+      fclose(out);
     fclose(f);
-    fprintf(stderr, "Error reading file size\n");
+    meta_free(&meta);
+    fprintf(stderr, "Cannot write %s\n", output_bin);
     return 1;
   }
+  uint64_t kept_blocks = meta.nblocks;
+  uint64_t kept_len = meta.original_len;
+  uint64_t kept_end = offset;
 
-  char* inbuf = malloc(fsize + 1);
-  if (!inbuf) {
+  // The disk-backed builder reads its block straight from the input file.
+  // In memory, the next block is read and the previous payload written in
+  // the background (main_aio.c) while a block compresses; with overlap
+  // cleared by the memory plan there is one buffer and each write is waited
+  // for.  An adaptive split shortens the read block; the bytes after the
+  // cut are read again (from the page cache) as the start of the next one.
+  int external = opts->scratch_dir != NULL;
+  int nbuf = external ? 0 : overlap ? 2 : 1;
+  unsigned char* inbuf[2] = {NULL, NULL};
+  for (int b = 0; b < nbuf; b++)
+    inbuf[b] = mem_alloc(block_size);
+  struct aio_queue* io = external ? NULL : aio_create(4);
+  if (!external && (!inbuf[0] || (nbuf == 2 && !inbuf[1]) || !io)) {
+    aio_destroy(io);
+    mem_free(inbuf[0]);
+    mem_free(inbuf[1]);
     fclose(f);
+    fclose(out);
+    meta_free(&meta);
     fprintf(stderr, "Out of memory\n");
     return 1;
   }
-  size_t read = fread(inbuf, 1, fsize, f);
+  const char* io_backend = io ? aio_backend(io) : NULL;
+  int in_fd = file_fd(f);
+  int out_fd = file_fd(out);
+  uint64_t read_pos = meta.original_len;  // end of the reads issued
+  unsigned char* writing = NULL;          // payload being written
+  uint64_t writing_len = 0;
+  int cur = 0;                            // inbuf holding the next block
+
+  // --- Stream the input one block at a time ---
+  struct pipeline_stats stats = {0};
+  int failed = !external && read_ahead(io, in_fd, inbuf[0], &read_pos,
+                                       (uint64_t)file_len, block_size) != 0;
+  while (!failed) {
+    struct block_entry entry = {0};
+    entry.offset = offset;
+    uint64_t got;
+    if (external) {
+      uint64_t left = (uint64_t)file_len - meta.original_len;
+      if (left == 0)
+        break;
+      got = left < block_size ? left : block_size;
+      if (compress_block_external(input_path, meta.original_len, got, opts,
+                                  out, &entry) != 0 ||
+          meta_push(&meta, &entry) != 0) {
+        failed = 1;
+        break;
+      }
+    } else {
+      got = read_pos - meta.original_len;  // the read in flight
+      if (got == 0)
+        break;
+      int64_t res;
+      if (aio_wait_tag(io, IO_READ, &res) != 0 || res != (int64_t)got) {
+        fprintf(stderr, "Error reading %s\n", input_path);
+        failed = 1;
+        break;
+      }
+      unsigned char* block = inbuf[cur];
+      if (min_block) {
+        uint64_t cut = split_block(block, (uint32_t)got, min_block,
+                                   read_pos == (uint64_t)file_len);
+        if (cut < got)
+          stats.split_blocks++;
+        got = cut;
+        read_pos = meta.original_len + got;
+      }
+      if (nbuf == 2 && read_ahead(io, in_fd, inbuf[cur ^ 1], &read_pos,
+                                  (uint64_t)file_len, block_size) != 0) {
+        failed = 1;
+        break;
+      }
+      unsigned char* payload =
+          opts->low_memory
+              ? compress_block_inplace(block, (uint32_t)got, opts, &entry)
+              : compress_block(block, (uint32_t)got, opts, &entry);
+      if (!payload || meta_push(&meta, &entry) != 0 ||
+          finish_write(io, &writing, writing_len) != 0 ||
+          aio_write(io, out_fd, payload, (size_t)entry.comp_len,
+                    offset + shift, IO_WRITE) != 0) {
+        mem_free(payload);
+        failed = 1;
+        break;
+      }
+      writing = payload;
+      writing_len = entry.comp_len;
+      if ((!overlap && finish_write(io, &writing, writing_len) != 0) ||
+          (nbuf == 1 && read_ahead(io, in_fd, inbuf[0], &read_pos,
+                                   (uint64_t)file_len, block_size) != 0)) {
+        failed = 1;
+        break;
+      }
+      cur ^= nbuf - 1;
+    }
+    stats.bwt_len += got;
+    stats.mtf_len += got;
+    stats.rle_len += entry.sym_len;
+    stats.out_len += entry.comp_len;
+    offset += entry.comp_len;
+    meta.original_len += got;
+  }
+  if (io && finish_write(io, &writing, writing_len) != 0) {
+    fprintf(stderr, "Error writing %s\n", output_bin);
+    failed = 1;
+  }
+  aio_destroy(io);  // waits for a read still in flight after a failure
+  mem_free(inbuf[0]);
+  mem_free(inbuf[1]);
   fclose(f);
-  inbuf[read] = '\0';  // null-terminate for bwt routines that use strlen
+  if (!failed && fflush(out) != 0)
+    failed = 1;
 
-  // --- BWT ---
-  int primary_index = -1;
-  char* bwt_out = bwt_encode(inbuf, &primary_index);  // from main_bwt.c
-  if (!bwt_out) {
-    fprintf(stderr, "BWT failed\n");
-    free(inbuf);
+  if (failed) {
+    // the old index does not reach past the dropped payload
+    if (append)
+      file_truncate(out, kept_end + shift);
+    fclose(out);
+    meta_free(&meta);
+    fprintf(stderr, "Compression failed\n");
     return 1;
   }
-  size_t bwt_len = strlen(bwt_out);
 
-  // --- MTF ---
-  size_t mtf_len = 0;
-  unsigned char* mtf_out =
-      mtf_encode((const unsigned char*)bwt_out, bwt_len, &mtf_len);
-  if (!mtf_out) {
-    fprintf(stderr, "MTF failed\n");
-    free(inbuf);
-    free(bwt_out);
+  // --- write metadata (block index) ---
+  // An appended container gets an index of its kept blocks alone before the
+  // new payloads move over the dropped one, so that the index on disk
+  // always matches output.bin.  Blocks kept from an index without checksums
+  // leave stream_crc at 0.
+  int meta_failed = 0;
+  if (shift) {
+    struct meta_info kept = meta;
+    kept.nblocks = kept_blocks;
+    kept.original_len = kept_len;
+    if (meta_combined_crc(&kept, &kept.stream_crc) != 0)
+      kept.stream_crc = 0;
+    meta_failed = meta_write(meta_file, &kept) != 0 ||
+                  move_down(out, kept_end, kept_end + shift, offset - kept_end);
+  }
+  if (!meta_failed && file_truncate(out, offset) != 0)
+    meta_failed = 1;
+  if (fclose(out) != 0)
+    meta_failed = 1;
+  if (meta_combined_crc(&meta, &meta.stream_crc) != 0)
+    meta.stream_crc = 0;
+  if (meta_failed || meta_write(meta_file, &meta) != 0) {
+    fprintf(stderr, "Error: can't write metadata file %s\n", meta_file);
+    meta_free(&meta);
+    return 1;
+  }
+  if (fm_index && fmi_create(output_bin, &meta, index_file) != 0) {
+    fprintf(stderr, "Error: can't build the FM-index %s\n", index_file);
+    meta_free(&meta);
     return 1;
   }
 
-  // --- RLE ---
-  size_t rle_capacity = mtf_len * 2 + 16;  // safe upper bound
-  unsigned char* rle_out = malloc(rle_capacity);
-  if (!rle_out) {
-    fprintf(stderr, "Out of memory (RLE)\n");
-    free(inbuf);
-    free(bwt_out);
-    free(mtf_out);
+  printf("Pipeline complete.\n");
+  printf("Input file : %s\n", input_path);
+  printf("Input bytes : %llu\n", (unsigned long long)meta.original_len);
+  printf("Blocks      : %llu (block size %u)\n",
+         (unsigned long long)meta.nblocks, block_size);
+  if (append)
+    printf("New blocks  : %llu\n",
+           (unsigned long long)(meta.nblocks - kept_blocks));
+  if (min_block)
+    printf("Split       : %llu blocks ended at a content change (min %u)\n",
+           (unsigned long long)stats.split_blocks, min_block);
+  if (opts->fast) {
+    printf("Level       : fast (LZ77)\n");
+  } else {
+    printf("BWT length  : %llu\n", (unsigned long long)stats.bwt_len);
+    printf("MTF length  : %llu\n", (unsigned long long)stats.mtf_len);
+    printf("RLE length  : %llu\n", (unsigned long long)stats.rle_len);
+  }
+  printf("Final Huffman output : %s (%llu bytes", output_bin,
+         (unsigned long long)offset);
+  if (append)
+    printf(", %llu appended", (unsigned long long)stats.out_len);
+  printf(")\n");
+  printf("Metadata written to %s (block index)\n", meta_file);
+  if (fm_index)
+    printf("FM-index written to %s\n", index_file);
+  if (io_backend)
+    printf("File I/O    : %s\n", io_backend);
+  if (mem_limit()) {
+    uint64_t now, peak;
+    mem_usage(&now, &peak);
+    printf("Memory      : %llu bytes counted at the peak (limit %llu)\n",
+           (unsigned long long)peak, (unsigned long long)mem_limit());
+  }
+
+  meta_free(&meta);
+  return 0;
+}
+
+/* Read a whole (small) file into memory; used for training samples and
+   messages.  Returns an allocated buffer (caller frees) or NULL. */
+static unsigned char* read_file(const char* path, size_t* len) {
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+  size_t cap = 4096, n = 0;
+  unsigned char* buf = malloc(cap);
+  size_t got;
+  while (buf && (got = fread(buf + n, 1, cap - n, f)) > 0) {
+    n += got;
+    if (n == cap) {
+      unsigned char* grown = realloc(buf, cap * 2);
+      if (!grown) {
+        free(buf);
+        buf = NULL;
+        break;
+      }
+      buf = grown;
+      cap *= 2;
+    }
+  }
+  fclose(f);
+  *len = n;
+  return buf;
+}
+
+/* train <table-id> <table-file> [--lines] <sample>...
+   Builds a pretrained Huffman table from the RLE symbol statistics of the
+   samples.  With --lines every line of a sample counts as one message,
+   which matches how line-delimited event logs are compressed later. */
+static int train_command(int argc, char** argv) {
+  if (argc < 5) {
+    fprintf(stderr,
+            "usage: %s train <table-id> <table-file> [--lines] <sample>...\n",
+            argv[0]);
     return 1;
   }
-  size_t rle_len = compress_rle_buffer(mtf_out, mtf_len, rle_out, rle_capacity);
-  if (rle_len == 0) {
-    fprintf(stderr, "RLE failed (insufficient buffer?)\n");
-    free(inbuf);
-    free(bwt_out);
-    free(mtf_out);
-    free(rle_out);
+  uint32_t id = (uint32_t)strtoul(argv[2], NULL, 10);
+  const char* table_path = argv[3];
+  if (id == 0) {
+    fprintf(stderr, "Error: table id 0 is reserved for inline tables\n");
     return 1;
   }
+  int lines = 0;
+  int first = 4;
+  if (strcmp(argv[first], "--lines") == 0) {
+    lines = 1;
+    first++;
+  }
+
+  unsigned long long counts[256] = {0};
+  unsigned long long samples = 0;
+  for (int a = first; a < argc; a++) {
+    size_t len = 0;
+    unsigned char* buf = read_file(argv[a], &len);
+    if (!buf) {
+      fprintf(stderr, "Error: cannot read %s\n", argv[a]);
+      return 1;
+    }
+    size_t start = 0;
+    while (start < len) {
+      size_t end = len;
+      if (lines) {
+        unsigned char* nl = memchr(buf + start, '\n', len - start);
+        if (nl)
+          end = (size_t)(nl - buf) + 1;
+      }
+      if (message_train_sample(buf + start, end - start, counts) != 0) {
+        free(buf);
+        fprintf(stderr, "Error: training failed on %s\n", argv[a]);
+        return 1;
+      }
+      samples++;
+      start = end;
+    }
+    free(buf);
+  }
 
-  // --- write intermediate RLE to file (binary) ---
-  FILE* rfile = fopen(intermediate_rle, "wb");
-  if (!rfile) {
-    fprintf(stderr, "Cannot write %s\n", intermediate_rle);
-    free(inbuf);
-    free(bwt_out);
-    free(mtf_out);
-    free(rle_out);
+  // scale to 16 bits and keep every symbol codable
+  unsigned long long max = 1;
+  for (int i = 0; i < 256; i++)
+    if (counts[i] > max)
+      max = counts[i];
+  unsigned freq[256];
+  for (int i = 0; i < 256; i++)
+    freq[i] = 1 + (unsigned)(counts[i] * 65535ull / max);
+
+  if (huff_table_save(table_path, id, freq) != 0) {
+    fprintf(stderr, "Error: cannot write %s\n", table_path);
     return 1;
   }
-  if (fwrite(rle_out, 1, rle_len, rfile) != rle_len) {
-    fprintf(stderr, "Failed to write intermediate file\n");
-    fclose(rfile);
-    free(inbuf);
-    free(bwt_out);
-    free(mtf_out);
-    free(rle_out);
+  printf("Trained table %u from %llu samples -> %s\n", id, samples,
+         table_path);
+  return 0;
+}
+
+/* message <table-file> <input> <output>: compress one small payload as a
+   frame that refers to the pretrained table instead of carrying one. */
+static int message_command(int argc, char** argv) {
+  if (argc != 5) {
+    fprintf(stderr, "usage: %s message <table-file> <input> <output>\n",
+            argv[0]);
+    return 1;
+  }
+  struct huff_table* table = huff_table_load(argv[2]);
+  if (!table) {
+    fprintf(stderr, "Error: cannot load Huffman table %s\n", argv[2]);
+    return 1;
+  }
+  size_t len = 0;
+  unsigned char* buf = read_file(argv[3], &len);
+  if (!buf) {
+    huff_table_free(table);
+    fprintf(stderr, "Error: cannot read %s\n", argv[3]);
     return 1;
   }
-  fclose(rfile);
+  size_t cap = message_bound(len);
+  unsigned char* frame = malloc(cap);
+  size_t frame_len = frame ? compress_message(NULL, table, buf, len, frame, cap) : 0;
+  free(buf);
+  huff_table_free(table);
 
-  // --- Huffman compress the intermediate file into output.bin ---
-  compress_huffman_s(intermediate_rle, output_bin);
+  FILE* out = frame_len ? fopen(argv[4], "wb") : NULL;
+  int ok = out && fwrite(frame, 1, frame_len, out) == frame_len;
+  if (out && fclose(out) != 0)
+    ok = 0;
+  free(frame);
+  if (!ok) {
+    fprintf(stderr, "Error: message compression failed\n");
+    return 1;
+  }
+  printf("Message: %zu bytes -> %zu bytes (%s)\n", len, frame_len, argv[4]);
+  return 0;
+}
 
-  // --- write metadata (primary index and original length) ---
-  FILE* meta = fopen(meta_file, "wb");
-  if (meta) {
-    int32_t idx = (int32_t)primary_index;
-    uint32_t orig_len = (uint32_t)read;
-    fwrite(&idx, sizeof(idx), 1, meta);
-    fwrite(&orig_len, sizeof(orig_len), 1, meta);
-    fclose(meta);
-  } else {
-    fprintf(stderr, "Warning: can't write metadata file %s\n", meta_file);
+/* batch [-b block-size] <output.tcb> <records-file>
+   Packs every line of records-file (without its newline) as one record;
+   record IDs are line numbers starting at 0. */
+static int batch_command(int argc, char** argv) {
+  uint32_t block_size = DEFAULT_BATCH_BLOCK_SIZE;
+  int a = 2;
+  if (a + 1 < argc && strcmp(argv[a], "-b") == 0) {
+    block_size = (uint32_t)strtoul(argv[a + 1], NULL, 10);
+    a += 2;
+  }
+  if (argc - a != 2 || block_size == 0) {
+    fprintf(stderr, "usage: %s batch [-b block-size] <output.tcb> <records>\n",
+            argv[0]);
+    return 1;
+  }
+  FILE* in = fopen(argv[a + 1], "rb");
+  if (!in) {
+    fprintf(stderr, "Error: cannot open %s\n", argv[a + 1]);
+    return 1;
+  }
+  struct batch_writer* w = batch_create(argv[a], block_size);
+  if (!w) {
+    fclose(in);
+    fprintf(stderr, "Error: cannot write %s\n", argv[a]);
+    return 1;
   }
 
-  printf("Pipeline complete.\n");
-  printf("Input file : %s\n", input_path);
-  printf("Input bytes : %zu\n", (size_t)read);
-  printf("BWT length  : %zu (primary index %d)\n", bwt_len, primary_index);
-  printf("MTF length  : %zu\n", mtf_len);
-  printf("RLE length  : %zu\n", rle_len);
-  printf("Final Huffman output : %s\n", output_bin);
-  printf("Metadata written to %s (primary index + original length)\n",
-         meta_file);
-
-  // cleanup
-  free(inbuf);
-  free(bwt_out);
-  free(mtf_out);
-  free(rle_out);
+  size_t cap = 4096, len = 0;
+  unsigned char* line = malloc(cap);
+  uint64_t count = 0;
+  int failed = !line, c;
+  while (!failed && (c = fgetc(in)) != EOF) {
+    if (c != '\n') {
+      if (len == cap) {
+        unsigned char* grown = realloc(line, cap * 2);
+        if (!grown) {
+          failed = 1;
+          break;
+        }
+        line = grown;
+        cap *= 2;
+      }
+      line[len++] = (unsigned char)c;
+      continue;
+    }
+    failed = batch_add(w, line, len, NULL) != 0;
+    len = 0;
+    count++;
+  }
+  if (!failed && len > 0) {
+    failed = batch_add(w, line, len, NULL) != 0;
+    count++;
+  }
+  fclose(in);
+  free(line);
+  if (batch_finish(w) != 0 || failed) {
+    fprintf(stderr, "Error: batch compression failed\n");
+    return 1;
+  }
+  printf("Batch complete: %llu records -> %s\n", (unsigned long long)count,
+         argv[a]);
+  return 0;
+}
 
+/* dedup <store-dir> <input> <recipe>: chunk input into the dedup store;
+   only chunks the store has not seen yet are compressed. */
+static int dedup_command(int argc, char** argv) {
+  if (argc != 5) {
+    fprintf(stderr, "usage: %s dedup <store-dir> <input> <recipe>\n",
+            argv[0]);
+    return 1;
+  }
+  struct dedup_stats st;
+  if (dedup_store_file(argv[2], argv[3], argv[4], &st) != 0) {
+    fprintf(stderr, "Error: deduplication failed\n");
+    return 1;
+  }
+  printf("Input bytes : %llu in %llu chunks\n", (unsigned long long)st.bytes,
+         (unsigned long long)st.chunks);
+  printf("New chunks  : %llu (%llu bytes -> %llu stored)\n",
+         (unsigned long long)st.new_chunks, (unsigned long long)st.new_bytes,
+         (unsigned long long)st.stored);
+  printf("Recipe written to %s\n", argv[4]);
   return 0;
 }
+
+/* index: build output.bin.fmi for an existing output.bin (see
+   main_fmindex.h); the decompressor's count, locate and grep use it. */
+static int index_command(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s index\n", argv[0]);
+    return 1;
+  }
+  struct meta_info meta;
+  if (meta_read("output.bin.meta", &meta) != 0) {
+    fprintf(stderr, "Error: cannot read output.bin.meta\n");
+    return 1;
+  }
+  int rc = fmi_create("output.bin", &meta, "output.bin.fmi");
+  meta_free(&meta);
+  if (rc != 0) {
+    fprintf(stderr, "Error: can't build the FM-index output.bin.fmi\n");
+    return 1;
+  }
+  printf("FM-index written to output.bin.fmi\n");
+  return 0;
+}
+
+/* archive [-b block-size] [-t threads] [-T list-file] <output.tca>
+           [file-or-dir]...
+   Packs many files into one archive, compressing blocks in parallel. */
+static int archive_command(int argc, char** argv) {
+  uint32_t block_size = DEFAULT_ARCHIVE_BLOCK_SIZE;
+  int threads = 0;
+  const char* list_path = NULL;
+  int a = 2;
+  for (; a + 1 < argc && argv[a][0] == '-'; a += 2) {
+    if (strcmp(argv[a], "-b") == 0)
+      block_size = (uint32_t)strtoul(argv[a + 1], NULL, 10);
+    else if (strcmp(argv[a], "-t") == 0)
+      threads = atoi(argv[a + 1]);
+    else if (strcmp(argv[a], "-T") == 0)
+      list_path = argv[a + 1];
+    else
+      break;
+  }
+  if (a >= argc || (a + 1 == argc && !list_path) || block_size == 0 ||
+      block_size > MAX_BLOCK_SIZE) {
+    fprintf(stderr,
+            "usage: %s archive [-b block-size] [-t threads] [-T list-file] "
+            "<output.tca> [file-or-dir]...\n",
+            argv[0]);
+    return 1;
+  }
+  struct archive_stats st;
+  if (archive_create(argv[a], (const char* const*)argv + a + 1, argc - a - 1,
+                     list_path, block_size, threads, &st) != 0) {
+    fprintf(stderr, "Error: archiving failed\n");
+    return 1;
+  }
+  printf("Archived %llu files, %llu bytes -> %s (%llu bytes)\n",
+         (unsigned long long)st.files, (unsigned long long)st.bytes, argv[a],
+         (unsigned long long)st.comp);
+  printf("Blocks      : %llu (%llu shared by several files)\n",
+         (unsigned long long)st.blocks, (unsigned long long)st.shared);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  uint64_t budget;
+  if (mem_take_option(&argc, argv, &budget) != 0) {
+    fprintf(stderr, "Error: --max-memory takes a size such as 512M or 2G\n");
+    return 1;
+  }
+  mem_set_limit(budget);
+
+  if (argc > 1 && strcmp(argv[1], "train") == 0)
+    return train_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "message") == 0)
+    return message_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "batch") == 0)
+    return batch_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "dedup") == 0)
+    return dedup_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "archive") == 0)
+    return archive_command(argc, argv);
+  if (argc > 1 && strcmp(argv[1], "index") == 0)
+    return index_command(argc, argv);
+
+  // [-a] [-b block-size] [-S min-size] [-t threads] [-L] [-P] [-F] [-f]
+  // [-x scratch-dir [-M bytes]] [--max-memory size] [input]
+  uint32_t block_size = DEFAULT_BLOCK_SIZE;
+  uint32_t min_block = 0;
+  struct block_options opts = {0};
+  int append = 0;
+  int fixed_block = 0;
+  int fm_index = 0;
+  int a = 1;
+  for (; a < argc && argv[a][0] == '-'; a++) {
+    if (strcmp(argv[a], "-L") == 0) {
+      opts.low_memory = 1;
+      continue;
+    }
+    if (strcmp(argv[a], "-a") == 0) {
+      append = 1;
+      continue;
+    }
+    if (strcmp(argv[a], "-P") == 0) {
+      opts.lzp = 1;
+      continue;
+    }
+    if (strcmp(argv[a], "-F") == 0) {
+      fm_index = 1;
+      continue;
+    }
+    if (strcmp(argv[a], "-f") == 0) {
+      opts.fast = 1;
+      continue;
+    }
+    if (a + 1 >= argc)
+      break;
+    if (strcmp(argv[a], "-b") == 0) {
+      block_size = (uint32_t)strtoul(argv[a + 1], NULL, 10);
+      fixed_block = 1;
+    } else if (strcmp(argv[a], "-S") == 0) {
+      min_block = (uint32_t)strtoul(argv[a + 1], NULL, 10);
+      if (min_block == 0)
+        break;
+    } else if (strcmp(argv[a], "-t") == 0) {
+      opts.threads = atoi(argv[a + 1]);
+    } else if (strcmp(argv[a], "-x") == 0) {
+      opts.scratch_dir = argv[a + 1];
+    } else if (strcmp(argv[a], "-M") == 0) {
+      opts.memory_budget = strtoull(argv[a + 1], NULL, 10);
+    } else {
+      break;
+    }
+    a++;  // the value
+  }
+  uint32_t max_block =
+      opts.scratch_dir ? MAX_EXTERNAL_BLOCK_SIZE : MAX_BLOCK_SIZE;
+  if (argc - a > 1 || block_size == 0 || block_size > max_block ||
+      (fm_index && opts.lzp) || min_block > block_size ||
+      (min_block && opts.scratch_dir) ||
+      (opts.fast && (opts.lzp || fm_index || opts.scratch_dir))) {
+    fprintf(stderr,
+            "usage: %s [-a] [-b block-size] [-S min-size] [-t threads] [-L] "
+            "[-P | -F] [--max-memory size] [input]\n"
+            "       %s [-a] [-b block-size] [-t threads] [-L] [-P | -F] "
+            "-x scratch-dir [-M bytes] [--max-memory size] [input]\n"
+            "       %s -f [-a] [-b block-size] [-S min-size] "
+            "[--max-memory size] [input]\n",
+            argv[0], argv[0], argv[0]);
+    fprintf(stderr, "       %s train|message|batch|dedup|archive|index ...\n",
+            argv[0]);
+    return 1;
+  }
+
+  char input_path[512];
+  if (a < argc) {
+    snprintf(input_path, sizeof(input_path), "%s", argv[a]);
+  } else {
+    // --- Ask user for input file path ---
+    printf("Enter input file path: ");
+    if (!fgets(input_path, sizeof(input_path), stdin)) {
+      fprintf(stderr, "Error: failed to read input path\n");
+      return 1;
+    }
+    // remove trailing newline (if any)
+    size_t ip_len = strlen(input_path);
+    if (ip_len > 0 && (input_path[ip_len - 1] == '\n' || input_path[ip_len - 1] == '\r')) {
+      input_path[ip_len - 1] = '\0';
+    }
+  }
+
+  return compress_file(input_path, block_size, min_block, &opts, append,
+                       fixed_block, fm_index);
+}
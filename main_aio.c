@@ -0,0 +1,480 @@
+// main_aio.c
+// Asynchronous positional I/O (see main_aio.h): an io_uring where the
+// kernel offers one, else a helper thread doing pread/pwrite.
+// Requests live in a fixed table of depth slots; the io_uring user_data and
+// the helper thread's queues carry slot numbers.  A transfer that completes
+// short (signals, huge lengths, network file systems) is resubmitted for
+// the rest, so callers see one completion per request.
+
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <stdio.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+    defined(IORING_FEAT_RW_CUR_POS)
+#define AIO_HAVE_URING 1
+#endif
+#endif
+#endif
+
+#include "main_aio.h"
+
+/* Largest piece handed to the kernel at once (the sqe length is 32-bit). */
+#define AIO_MAX_PIECE (1u << 30)
+
+enum { REQ_FREE, REQ_BUSY, REQ_DONE };  // DONE: finished, not collected
+
+struct aio_req {
+  int state;
+  int fd;
+  int write;
+  unsigned char* buf;
+  size_t len;
+  size_t done;  // bytes transferred so far
+  uint64_t offset;
+  uint64_t tag;
+  int64_t result;
+};
+
+#ifdef AIO_HAVE_URING
+struct uring {
+  int fd;
+  void* sq_map;
+  size_t sq_len;
+  void* cq_map;
+  size_t cq_len;
+  struct io_uring_sqe* sqes;
+  size_t sqes_len;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe* cqes;
+};
+#endif
+
+struct aio_queue {
+  unsigned depth;
+  unsigned inflight;
+  struct aio_req* req;
+  int uring;  // io_uring backend in use
+#ifdef AIO_HAVE_URING
+  struct uring ring;
+#endif
+  // helper thread: slots to run (todo) and slots finished (fin), FIFO
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int threaded;
+  int stop;
+  unsigned* todo;
+  unsigned todo_head, todo_n;
+  unsigned* fin;
+  unsigned fin_head, fin_n;
+};
+
+// --- io_uring ---
+
+#ifdef AIO_HAVE_URING
+static void uring_free(struct uring* r) {
+  if (r->sqes)
+    munmap(r->sqes, r->sqes_len);
+  if (r->cq_map && r->cq_map != r->sq_map)
+    munmap(r->cq_map, r->cq_len);
+  if (r->sq_map)
+    munmap(r->sq_map, r->sq_len);
+  close(r->fd);
+}
+
+static int uring_setup(struct uring* r, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(r, 0, sizeof(*r));
+  r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0)
+    return -1;
+  // IORING_OP_READ/WRITE arrived together with this feature bit (5.6)
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    close(r->fd);
+    return -1;
+  }
+  r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    if (r->cq_len > r->sq_len)
+      r->sq_len = r->cq_len;
+    r->cq_len = r->sq_len;
+  }
+  r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_map == MAP_FAILED) {
+    r->sq_map = NULL;
+    uring_free(r);
+    return -1;
+  }
+  r->cq_map = single ? r->sq_map
+                     : mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, r->fd,
+                            IORING_OFF_CQ_RING);
+  if (r->cq_map == MAP_FAILED) {
+    r->cq_map = NULL;
+    uring_free(r);
+    return -1;
+  }
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    r->sqes = NULL;
+    uring_free(r);
+    return -1;
+  }
+  unsigned char* sq = r->sq_map;
+  unsigned char* cq = r->cq_map;
+  r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned*)(sq + p.sq_off.array);
+  r->cq_head = (unsigned*)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+/* Submit the rest of request slot. */
+static int uring_submit(struct uring* r, unsigned slot, struct aio_req* q) {
+  unsigned tail = *r->sq_tail;
+  unsigned idx = tail & *r->sq_mask;
+  struct io_uring_sqe* sqe = &r->sqes[idx];
+  size_t piece = q->len - q->done;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = q->write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = q->fd;
+  sqe->off = q->offset + q->done;
+  sqe->addr = (uint64_t)(uintptr_t)(q->buf + q->done);
+  sqe->len = (uint32_t)(piece < AIO_MAX_PIECE ? piece : AIO_MAX_PIECE);
+  sqe->user_data = slot;
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  for (;;) {
+    long ret = syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0);
+    if (ret >= 0)
+      return 0;
+    if (errno != EINTR)
+      return -1;
+  }
+}
+
+/* Take the next completion, waiting for one if need be. */
+static int uring_reap(struct uring* r, unsigned* slot, int32_t* res) {
+  for (;;) {
+    unsigned head = *r->cq_head;
+    if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+      *slot = (unsigned)cqe->user_data;
+      *res = cqe->res;
+      __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+      return 0;
+    }
+    long ret = syscall(__NR_io_uring_enter, r->fd, 0, 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno != EINTR)
+      return -1;
+  }
+}
+#endif
+
+// --- helper thread ---
+
+static int64_t transfer_piece(struct aio_req* q) {
+  size_t piece = q->len - q->done;
+  if (piece > AIO_MAX_PIECE)
+    piece = AIO_MAX_PIECE;
+#ifdef _WIN32
+  // the helper thread is the only user of the descriptor's position
+  if (_lseeki64(q->fd, (__int64)(q->offset + q->done), SEEK_SET) < 0)
+    return -1;
+  return q->write ? _write(q->fd, q->buf + q->done, (unsigned)piece)
+                  : _read(q->fd, q->buf + q->done, (unsigned)piece);
+#else
+  off_t at = (off_t)(q->offset + q->done);
+  return q->write ? pwrite(q->fd, q->buf + q->done, piece, at)
+                  : pread(q->fd, q->buf + q->done, piece, at);
+#endif
+}
+
+/* Run a request to the end: bytes transferred, or -errno. */
+static int64_t transfer(struct aio_req* q) {
+  while (q->done < q->len) {
+    int64_t n = transfer_piece(q);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return errno ? -(int64_t)errno : -EIO;
+    if (n == 0)
+      return q->write ? -EIO : (int64_t)q->done;  // end of file
+    q->done += (size_t)n;
+  }
+  return (int64_t)q->done;
+}
+
+static void push_fin(struct aio_queue* q, unsigned slot) {
+  q->fin[(q->fin_head + q->fin_n++) % q->depth] = slot;
+  pthread_cond_broadcast(&q->cond);
+}
+
+static void* helper(void* arg) {
+  struct aio_queue* q = arg;
+  pthread_mutex_lock(&q->lock);
+  for (;;) {
+    while (!q->stop && q->todo_n == 0)
+      pthread_cond_wait(&q->cond, &q->lock);
+    if (q->todo_n == 0)
+      break;
+    unsigned slot = q->todo[q->todo_head];
+    q->todo_head = (q->todo_head + 1) % q->depth;
+    q->todo_n--;
+    pthread_mutex_unlock(&q->lock);
+    int64_t result = transfer(&q->req[slot]);
+    pthread_mutex_lock(&q->lock);
+    q->req[slot].result = result;
+    push_fin(q, slot);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+// --- queue ---
+
+struct aio_queue* aio_create(unsigned depth) {
+  if (depth == 0)
+    depth = 1;
+  struct aio_queue* q = calloc(1, sizeof(*q));
+  if (!q)
+    return NULL;
+  q->depth = depth;
+  q->req = calloc(depth, sizeof(*q->req));
+  q->todo = calloc(depth, sizeof(*q->todo));
+  q->fin = calloc(depth, sizeof(*q->fin));
+  if (!q->req || !q->todo || !q->fin) {
+    free(q->req);
+    free(q->todo);
+    free(q->fin);
+    free(q);
+    return NULL;
+  }
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->cond, NULL);
+#ifdef AIO_HAVE_URING
+  q->uring = uring_setup(&q->ring, depth) == 0;
+#endif
+  // without a helper thread, requests run inside aio_read/aio_write
+  if (!q->uring)
+    q->threaded = pthread_create(&q->thread, NULL, helper, q) == 0;
+  return q;
+}
+
+const char* aio_backend(const struct aio_queue* q) {
+  return q->uring ? "io_uring" : "pread/pwrite";
+}
+
+static int submit(struct aio_queue* q,
+                  int fd,
+                  int write,
+                  void* buf,
+                  size_t len,
+                  uint64_t offset,
+                  uint64_t tag) {
+  unsigned slot = 0;
+  while (slot < q->depth && q->req[slot].state != REQ_FREE)
+    slot++;
+  if (slot == q->depth)
+    return -1;
+  struct aio_req* r = &q->req[slot];
+  r->fd = fd;
+  r->write = write;
+  r->buf = buf;
+  r->len = len;
+  r->done = 0;
+  r->offset = offset;
+  r->tag = tag;
+  r->result = 0;
+#ifdef AIO_HAVE_URING
+  if (q->uring) {
+    if (len > 0 && uring_submit(&q->ring, slot, r) != 0)
+      return -1;
+    r->state = REQ_BUSY;
+    q->inflight++;
+    if (len == 0) {
+      // nothing for the kernel to do; complete it on the next wait
+      pthread_mutex_lock(&q->lock);
+      push_fin(q, slot);
+      pthread_mutex_unlock(&q->lock);
+    }
+    return 0;
+  }
+#endif
+  r->state = REQ_BUSY;
+  q->inflight++;
+  pthread_mutex_lock(&q->lock);
+  if (q->threaded) {
+    q->todo[(q->todo_head + q->todo_n++) % q->depth] = slot;
+    pthread_cond_broadcast(&q->cond);
+  } else {
+    r->result = transfer(r);
+    push_fin(q, slot);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return 0;
+}
+
+int aio_read(struct aio_queue* q,
+             int fd,
+             void* buf,
+             size_t len,
+             uint64_t offset,
+             uint64_t tag) {
+  return submit(q, fd, 0, buf, len, offset, tag);
+}
+
+int aio_write(struct aio_queue* q,
+              int fd,
+              const void* buf,
+              size_t len,
+              uint64_t offset,
+              uint64_t tag) {
+  return submit(q, fd, 1, (void*)buf, len, offset, tag);
+}
+
+/* Next finished slot from the fin queue, if any. */
+static int pop_fin(struct aio_queue* q, int block, unsigned* slot) {
+  pthread_mutex_lock(&q->lock);
+  while (block && q->fin_n == 0)
+    pthread_cond_wait(&q->cond, &q->lock);
+  int got = q->fin_n > 0;
+  if (got) {
+    *slot = q->fin[q->fin_head];
+    q->fin_head = (q->fin_head + 1) % q->depth;
+    q->fin_n--;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return got;
+}
+
+/* Wait for the next request to finish; some must be busy. */
+static int next_completion(struct aio_queue* q, unsigned* slot) {
+#ifdef AIO_HAVE_URING
+  while (q->uring && !pop_fin(q, 0, slot)) {
+    int32_t res;
+    if (uring_reap(&q->ring, slot, &res) != 0)
+      return -1;
+    struct aio_req* r = &q->req[*slot];
+    int again = 0;
+    if (res == -EINTR || res == -EAGAIN) {
+      again = 1;
+    } else if (res < 0) {
+      r->result = res;
+    } else if (res == 0) {
+      r->result = r->write ? -EIO : (int64_t)r->done;  // end of file
+    } else {
+      r->done += (size_t)res;
+      r->result = (int64_t)r->done;
+      again = r->done < r->len;
+    }
+    if (again && uring_submit(&q->ring, *slot, r) == 0)
+      continue;
+    if (again)
+      r->result = -EIO;
+    pthread_mutex_lock(&q->lock);
+    push_fin(q, *slot);
+    pthread_mutex_unlock(&q->lock);
+  }
+  if (!q->uring)
+#endif
+    pop_fin(q, 1, slot);
+  return 0;
+}
+
+static void collect(struct aio_queue* q,
+                    unsigned slot,
+                    uint64_t* tag,
+                    int64_t* result) {
+  struct aio_req* r = &q->req[slot];
+  *tag = r->tag;
+  *result = r->result;
+  r->state = REQ_FREE;
+  q->inflight--;
+}
+
+int aio_wait(struct aio_queue* q, uint64_t* tag, int64_t* result) {
+  if (q->inflight == 0)
+    return -1;
+  unsigned slot;
+  for (slot = 0; slot < q->depth; slot++)
+    if (q->req[slot].state == REQ_DONE)
+      break;
+  if (slot == q->depth && next_completion(q, &slot) != 0)
+    return -1;
+  collect(q, slot, tag, result);
+  return 0;
+}
+
+int aio_wait_tag(struct aio_queue* q, uint64_t tag, int64_t* result) {
+  for (;;) {
+    int busy = 0;
+    for (unsigned slot = 0; slot < q->depth; slot++) {
+      struct aio_req* r = &q->req[slot];
+      if (r->state == REQ_DONE && r->tag == tag) {
+        uint64_t t;
+        collect(q, slot, &t, result);
+        return 0;
+      }
+      busy |= r->state == REQ_BUSY && r->tag == tag;
+    }
+    unsigned done;
+    if (!busy || next_completion(q, &done) != 0)
+      return -1;
+    q->req[done].state = REQ_DONE;
+  }
+}
+
+void aio_destroy(struct aio_queue* q) {
+  if (!q)
+    return;
+  uint64_t tag;
+  int64_t result;
+  while (aio_wait(q, &tag, &result) == 0) {
+  }
+  if (q->threaded) {
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+  }
+#ifdef AIO_HAVE_URING
+  if (q->uring)
+    uring_free(&q->ring);
+#endif
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->cond);
+  free(q->req);
+  free(q->todo);
+  free(q->fin);
+  free(q);
+}
@@ -0,0 +1,49 @@
+// main_aio.h
+// Asynchronous positional file I/O (main_aio.c).
+// Reads and writes are queued with a tag and may complete in any order;
+// aio_wait collects the completions.  On Linux the queue is an io_uring,
+// set up with raw system calls (no liburing).  Where io_uring is missing or
+// refused (old kernels, seccomp filters in containers) and on other systems,
+// a helper thread runs the requests in order with pread/pwrite.  Either way
+// the calling thread is free to compress while the transfer runs.
+// A queue is used from one thread at a time.
+
+#ifndef MAIN_AIO_H
+#define MAIN_AIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct aio_queue;
+
+/* Queue with room for depth requests in flight.  NULL if out of memory. */
+struct aio_queue* aio_create(unsigned depth);
+/* Waits for the requests still in flight, then frees the queue. */
+void aio_destroy(struct aio_queue* q);
+/* "io_uring" or "pread/pwrite". */
+const char* aio_backend(const struct aio_queue* q);
+
+/* Queue a transfer of len bytes at offset of fd; buf must stay valid until
+   the request completes.  Short transfers are continued internally, so a
+   read completes short only at the end of the file.  Returns -1 if depth
+   requests are already in flight. */
+int aio_read(struct aio_queue* q,
+             int fd,
+             void* buf,
+             size_t len,
+             uint64_t offset,
+             uint64_t tag);
+int aio_write(struct aio_queue* q,
+              int fd,
+              const void* buf,
+              size_t len,
+              uint64_t offset,
+              uint64_t tag);
+/* Wait for a request to complete and return its tag and result: the bytes
+   transferred, or -errno.  Returns -1 if nothing is in flight. */
+int aio_wait(struct aio_queue* q, uint64_t* tag, int64_t* result);
+/* Same for the request with the given tag (others finishing meanwhile are
+   kept for later waits).  Returns -1 if no such request is in flight. */
+int aio_wait_tag(struct aio_queue* q, uint64_t tag, int64_t* result);
+
+#endif
@@ -0,0 +1,789 @@
+// main_archive.c
+// Multi-file archives (see main_archive.h for the layout).
+// archive_create collects the files (walking directories), sorts them by
+// name so neighbours in a directory share blocks, and plans the blocks in
+// one pass over the sizes.  A pool of threads then claims blocks by index,
+// reads the file pieces of its block and compresses it; the calling thread
+// writes the payloads in block order.  Workers stay at most `window` blocks
+// ahead of the writer, so memory does not grow with the archive.  Under a
+// memory limit (main_memory.h) the thread count, the window and, last, the
+// block size are cut to fit, and each block reserves its cost before it
+// starts.
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#include "main_archive.h"
+#include "main_container.h"
+#include "main_memory.h"
+
+unsigned char* compress_block(const unsigned char* block,
+                              uint32_t len,
+                              const struct block_options* opts,
+                              struct block_entry* entry);  // main_block.c
+unsigned char* decompress_block(const unsigned char* payload,
+                                const struct block_entry* entry);  // main_block.c
+
+struct archive_file {
+  char* name;
+  uint64_t size;
+  uint64_t pos;  // start in the concatenated stream
+};
+
+struct file_list {
+  struct archive_file* v;
+  size_t n;
+  size_t cap;
+};
+
+struct block_plan {
+  uint64_t start;  // in the concatenated stream
+  uint32_t len;
+};
+
+static int put_u32(FILE* f, uint32_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static int put_u64(FILE* f, uint64_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static int get_u32(FILE* f, uint32_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+}
+
+static int get_u64(FILE* f, uint64_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+}
+
+// --- collecting the files ---
+
+static int push_file(struct file_list* l, const char* name, uint64_t size) {
+  if (l->n == l->cap) {
+    size_t cap = l->cap ? l->cap * 2 : 256;
+    struct archive_file* grown = realloc(l->v, cap * sizeof(*grown));
+    if (!grown)
+      return -1;
+    l->v = grown;
+    l->cap = cap;
+  }
+  char* copy = malloc(strlen(name) + 1);
+  if (!copy)
+    return -1;
+  strcpy(copy, name);
+  l->v[l->n].name = copy;
+  l->v[l->n].size = size;
+  l->v[l->n].pos = 0;
+  l->n++;
+  return 0;
+}
+
+/* Add every regular file under dir.  Symbolic links are skipped, so a link
+   cycle cannot make the walk loop. */
+static int walk_dir(struct file_list* l, const char* dir) {
+#ifdef _WIN32
+  (void)l;
+  fprintf(stderr, "Error: %s: directories are not supported here, list the "
+          "files with -T\n", dir);
+  return -1;
+#else
+  DIR* d = opendir(dir);
+  if (!d) {
+    fprintf(stderr, "Error: cannot open directory %s\n", dir);
+    return -1;
+  }
+  size_t dir_len = strlen(dir);
+  int sep = dir_len > 0 && dir[dir_len - 1] != '/';
+  int err = 0;
+  struct dirent* e;
+  while (!err && (e = readdir(d)) != NULL) {
+    if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+      continue;
+    size_t len = dir_len + (size_t)sep + strlen(e->d_name) + 1;
+    char* path = malloc(len);
+    if (!path) {
+      err = 1;
+      break;
+    }
+    snprintf(path, len, "%s%s%s", dir, sep ? "/" : "", e->d_name);
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+      fprintf(stderr, "Error: cannot stat %s\n", path);
+      err = 1;
+    } else if (S_ISDIR(st.st_mode)) {
+      err = walk_dir(l, path) != 0;
+    } else if (S_ISREG(st.st_mode)) {
+      err = push_file(l, path, (uint64_t)st.st_size) != 0;
+    }
+    free(path);
+  }
+  closedir(d);
+  return err ? -1 : 0;
+#endif
+}
+
+/* A path given by the user: a regular file or a directory to walk. */
+static int add_input(struct file_list* l, const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    fprintf(stderr, "Error: cannot stat %s\n", path);
+    return -1;
+  }
+  if (S_ISDIR(st.st_mode))
+    return walk_dir(l, path);
+  if (!S_ISREG(st.st_mode)) {
+    fprintf(stderr, "Error: %s is not a regular file\n", path);
+    return -1;
+  }
+  return push_file(l, path, (uint64_t)st.st_size);
+}
+
+/* One path per line; empty lines are ignored. */
+static int add_list(struct file_list* l, const char* list_path) {
+  FILE* f = fopen(list_path, "r");
+  if (!f) {
+    fprintf(stderr, "Error: cannot open %s\n", list_path);
+    return -1;
+  }
+  char line[4096];
+  int err = 0;
+  while (!err && fgets(line, sizeof(line), f)) {
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      fprintf(stderr, "Error: path too long in %s\n", list_path);
+      err = 1;
+      break;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    if (len > 0)
+      err = add_input(l, line) != 0;
+  }
+  fclose(f);
+  return err ? -1 : 0;
+}
+
+static int by_name(const void* a, const void* b) {
+  return strcmp(((const struct archive_file*)a)->name,
+                ((const struct archive_file*)b)->name);
+}
+
+// --- planning ---
+
+struct block_plan_list {
+  struct block_plan* v;
+  uint64_t n;
+  uint64_t cap;
+  uint64_t shared;
+};
+
+static int push_block(struct block_plan_list* p,
+                      uint64_t start,
+                      uint32_t len,
+                      uint64_t files) {
+  if (p->n == p->cap) {
+    uint64_t cap = p->cap ? p->cap * 2 : 64;
+    struct block_plan* grown = realloc(p->v, (size_t)cap * sizeof(*grown));
+    if (!grown)
+      return -1;
+    p->v = grown;
+    p->cap = cap;
+  }
+  p->v[p->n].start = start;
+  p->v[p->n].len = len;
+  p->n++;
+  if (files > 1)
+    p->shared++;
+  return 0;
+}
+
+/* Give every file its stream position and cut the stream into blocks.  A
+   file that fits in a block is never split: if the open block has no room
+   for all of it, that block is closed first.  A larger file fills as many
+   blocks as it needs, and its tail stays open for the next files. */
+static int plan_blocks(struct file_list* l,
+                       uint32_t block_size,
+                       struct block_plan_list* p) {
+  uint64_t start = 0, len = 0;  // the open block
+  uint64_t files = 0;           // files with bytes in it
+  for (size_t i = 0; i < l->n; i++) {
+    uint64_t size = l->v[i].size;
+    if (len > 0 && size > block_size - len) {
+      if (push_block(p, start, (uint32_t)len, files) != 0)
+        return -1;
+      start += len;
+      len = 0;
+      files = 0;
+    }
+    l->v[i].pos = start + len;
+    len += size;
+    files += size > 0;
+    for (; len >= block_size; len -= block_size, start += block_size) {
+      if (push_block(p, start, block_size, files) != 0)
+        return -1;
+      files = len > block_size;  // the rest of this file, if any
+    }
+  }
+  if (len > 0 && push_block(p, start, (uint32_t)len, files) != 0)
+    return -1;
+  return 0;
+}
+
+// --- compressing ---
+
+struct archive_slot {
+  unsigned char* payload;
+  struct block_entry entry;
+  int done;
+};
+
+/* Shared state of archive_create's workers. */
+struct archive_job {
+  const struct file_list* files;
+  const struct block_plan_list* plan;
+  struct archive_slot* slots;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint64_t next;     // next block to claim
+  uint64_t written;  // blocks the writer has taken
+  uint64_t window;   // how far workers may run ahead of the writer
+  int failed;
+};
+
+/* Read the bytes of block k from the files that overlap it into buf. */
+static int read_block(const struct file_list* l,
+                      const struct block_plan* b,
+                      unsigned char* buf) {
+  // first file ending after the block start (positions are sorted)
+  size_t lo = 0, hi = l->n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (l->v[mid].pos + l->v[mid].size <= b->start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  uint64_t end = b->start + b->len;
+  for (size_t i = lo; i < l->n && l->v[i].pos < end; i++) {
+    const struct archive_file* f = &l->v[i];
+    if (f->size == 0)
+      continue;
+    uint64_t from = f->pos > b->start ? f->pos : b->start;
+    uint64_t to = f->pos + f->size < end ? f->pos + f->size : end;
+    FILE* in = fopen(f->name, "rb");
+    size_t want = (size_t)(to - from);
+    int ok = in && file_seek(in, from - f->pos) == 0 &&
+             fread(buf + (from - b->start), 1, want, in) == want;
+    if (in)
+      fclose(in);
+    if (!ok) {
+      fprintf(stderr, "Error: cannot read %s (changed while archiving?)\n",
+              f->name);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void compress_one(struct archive_job* job,
+                         uint64_t k,
+                         unsigned char* buf) {
+  const struct block_plan* b = &job->plan->v[k];
+  struct archive_slot* s = &job->slots[k];
+  uint64_t cost = mem_block_cost(MEM_COMPRESS, b->len, NULL);
+  int reserved = mem_acquire(cost) == 0;
+  s->payload = reserved && read_block(job->files, b, buf) == 0
+                   ? compress_block(buf, b->len, NULL, &s->entry)
+                   : NULL;
+  if (reserved)
+    mem_release(cost);
+  pthread_mutex_lock(&job->lock);
+  s->done = 1;
+  if (!s->payload)
+    job->failed = 1;
+  pthread_cond_broadcast(&job->cond);
+  pthread_mutex_unlock(&job->lock);
+}
+
+static void* archive_worker(void* arg) {
+  struct archive_job* job = arg;
+  unsigned char* buf = NULL;
+  uint32_t buf_cap = 0;
+  for (;;) {
+    pthread_mutex_lock(&job->lock);
+    while (!job->failed && job->next < job->plan->n &&
+           job->next >= job->written + job->window)
+      pthread_cond_wait(&job->cond, &job->lock);
+    uint64_t k = job->failed ? job->plan->n : job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if (k >= job->plan->n)
+      break;
+    uint32_t len = job->plan->v[k].len;
+    if (len > buf_cap) {
+      unsigned char* grown = mem_realloc(buf, len);
+      if (!grown) {
+        pthread_mutex_lock(&job->lock);
+        job->slots[k].done = 1;
+        job->failed = 1;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+        break;
+      }
+      buf = grown;
+      buf_cap = len;
+    }
+    compress_one(job, k, buf);
+  }
+  mem_free(buf);
+  return NULL;
+}
+
+static void free_files(struct file_list* l) {
+  for (size_t i = 0; i < l->n; i++)
+    free(l->v[i].name);
+  free(l->v);
+}
+
+/* Payloads in block order, then the index and the trailer. */
+static int write_archive(FILE* out,
+                         struct archive_job* job,
+                         uint32_t block_size,
+                         int inline_work,
+                         struct archive_stats* stats) {
+  const struct file_list* l = job->files;
+  const struct block_plan_list* p = job->plan;
+  int err = fwrite(ARCHIVE_MAGIC, 1, 4, out) != 4 ||
+            put_u32(out, ARCHIVE_VERSION) || put_u32(out, block_size) ||
+            put_u32(out, 0);
+  uint64_t offset = 16;
+  unsigned char* buf = inline_work ? mem_alloc(block_size) : NULL;
+  if (inline_work && !buf)
+    err = 1;
+  for (uint64_t k = 0; k < p->n && !err; k++) {
+    if (inline_work)
+      compress_one(job, k, buf);
+    pthread_mutex_lock(&job->lock);
+    while (!job->slots[k].done && !job->failed)
+      pthread_cond_wait(&job->cond, &job->lock);
+    struct archive_slot* s = &job->slots[k];
+    unsigned char* payload = s->done ? s->payload : NULL;
+    s->payload = NULL;
+    job->written = k + 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    if (!payload) {
+      err = 1;
+      break;
+    }
+    s->entry.offset = offset;
+    err = fwrite(payload, 1, (size_t)s->entry.comp_len, out) !=
+          s->entry.comp_len;
+    mem_free(payload);
+    offset += s->entry.comp_len;
+  }
+  mem_free(buf);
+  if (err) {
+    pthread_mutex_lock(&job->lock);
+    job->failed = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    return -1;
+  }
+
+  uint64_t names_bytes = 0;
+  for (size_t i = 0; i < l->n; i++)
+    names_bytes += strlen(l->v[i].name);
+  uint64_t index_offset = offset;
+  err |= put_u64(out, l->n) || put_u64(out, p->n) ||
+         put_u64(out, names_bytes);
+  for (uint64_t k = 0; k < p->n && !err; k++) {
+    const struct block_entry* e = &job->slots[k].entry;
+    err |= put_u64(out, e->offset) || put_u64(out, e->comp_len) ||
+           put_u64(out, e->raw_len) || put_u64(out, e->primary) ||
+           put_u64(out, e->sym_len) || put_u64(out, e->flags) ||
+           put_u64(out, e->checksum);
+  }
+  uint64_t name_off = 0;
+  for (size_t i = 0; i < l->n && !err; i++) {
+    uint64_t name_len = strlen(l->v[i].name);
+    err |= put_u64(out, l->v[i].pos) || put_u64(out, l->v[i].size) ||
+           put_u64(out, name_off) || put_u64(out, name_len);
+    name_off += name_len;
+  }
+  for (size_t i = 0; i < l->n && !err; i++) {
+    size_t name_len = strlen(l->v[i].name);
+    err |= fwrite(l->v[i].name, 1, name_len, out) != name_len;
+  }
+  err |= put_u64(out, index_offset);
+  err |= fwrite(ARCHIVE_MAGIC, 1, 4, out) != 4;
+
+  stats->files = l->n;
+  stats->blocks = p->n;
+  stats->shared = p->shared;
+  int64_t size = file_tell(out);
+  stats->comp = size > 0 ? (uint64_t)size : 0;
+  return err ? -1 : 0;
+}
+
+int archive_create(const char* path,
+                   const char* const* inputs,
+                   int ninputs,
+                   const char* list_path,
+                   uint32_t block_size,
+                   int threads,
+                   struct archive_stats* stats) {
+  struct file_list files = {0};
+  int err = 0;
+  for (int i = 0; i < ninputs && !err; i++)
+    err = add_input(&files, inputs[i]) != 0;
+  if (!err && list_path)
+    err = add_list(&files, list_path) != 0;
+  if (!err && files.n > 0)
+    qsort(files.v, files.n, sizeof(*files.v), by_name);
+  for (size_t i = 1; i < files.n && !err; i++)
+    if (strcmp(files.v[i - 1].name, files.v[i].name) == 0) {
+      fprintf(stderr, "Error: %s is listed twice\n", files.v[i].name);
+      err = 1;
+    }
+  memset(stats, 0, sizeof(*stats));
+  for (size_t i = 0; i < files.n; i++)
+    stats->bytes += files.v[i].size;
+
+#ifndef _WIN32
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (threads <= 0)
+    threads = 1;
+  struct mem_plan mp = {block_size, threads, 1, threads, 0};
+  if (!err && mem_limit() &&
+      mem_plan_compress(mem_limit(), MEM_COMPRESS, 1, &mp) != 0) {
+    fprintf(stderr, "Error: the memory limit is too small to compress a "
+                    "block\n");
+    err = 1;
+  }
+  block_size = mp.block_size;
+  threads = mp.workers;
+
+  struct block_plan_list plan = {0};
+  if (!err && plan_blocks(&files, block_size, &plan) != 0) {
+    fprintf(stderr, "Out of memory\n");
+    err = 1;
+  }
+  struct archive_slot* slots =
+      err ? NULL : calloc((size_t)plan.n + 1, sizeof(*slots));
+  FILE* out = slots ? fopen(path, "wb") : NULL;
+  if (!err && !out) {
+    fprintf(stderr, "Error: cannot write %s\n", path);
+    err = 1;
+  }
+  if (err) {
+    free(slots);
+    free(plan.v);
+    free_files(&files);
+    return -1;
+  }
+
+  struct archive_job job = {&files, &plan, slots, PTHREAD_MUTEX_INITIALIZER,
+                            PTHREAD_COND_INITIALIZER, 0, 0,
+                            (uint64_t)(mp.workers + mp.queue), 0};
+  pthread_t* tids = malloc((size_t)threads * sizeof(*tids));
+  int started = 0;
+  for (; tids && started < threads; started++)
+    if (pthread_create(&tids[started], NULL, archive_worker, &job) != 0)
+      break;
+  if (started == 0)
+    job.next = plan.n;  // nothing runs in the background: write_archive
+                        // compresses each block itself
+  err = write_archive(out, &job, block_size, started == 0, stats) != 0;
+  for (int t = 0; t < started; t++)
+    pthread_join(tids[t], NULL);
+  free(tids);
+  if (fclose(out) != 0)
+    err = 1;
+
+  for (uint64_t k = 0; k < plan.n; k++)
+    mem_free(slots[k].payload);
+  free(slots);
+  free(plan.v);
+  free_files(&files);
+  if (err)
+    remove(path);
+  return err ? -1 : 0;
+}
+
+// --- reading ---
+
+struct archive_entry {
+  uint64_t pos;
+  uint64_t size;
+  uint64_t name_off;
+  uint64_t name_len;
+};
+
+struct archive_reader {
+  FILE* f;
+  uint32_t block_size;
+  uint64_t nfiles;
+  uint64_t nblocks;
+  uint64_t names_bytes;
+  struct block_entry* blocks;
+  uint64_t* starts;  // stream position of each block, plus the total
+  struct archive_entry* files;
+  char* names;
+  uint64_t cached;  // block held in cache_data, or nblocks if none
+  unsigned char* cache_data;
+};
+
+void archive_close(struct archive_reader* r) {
+  if (!r)
+    return;
+  if (r->f)
+    fclose(r->f);
+  free(r->blocks);
+  free(r->starts);
+  free(r->files);
+  free(r->names);
+  mem_free(r->cache_data);
+  free(r);
+}
+
+/* Open an archive and load its index (not the payloads). */
+struct archive_reader* archive_open(const char* path) {
+  struct archive_reader* r = calloc(1, sizeof(*r));
+  if (!r)
+    return NULL;
+  r->f = fopen(path, "rb");
+  char magic[4];
+  uint32_t version = 0, reserved;
+  uint64_t index_offset = 0;
+  int64_t end;
+  if (!r->f || fread(magic, 1, 4, r->f) != 4 ||
+      memcmp(magic, ARCHIVE_MAGIC, 4) != 0 || get_u32(r->f, &version) ||
+      version < 1 || version > ARCHIVE_VERSION ||
+      get_u32(r->f, &r->block_size) ||
+      get_u32(r->f, &reserved) || r->block_size == 0 ||
+      r->block_size > MAX_BLOCK_SIZE || file_seek_end(r->f) ||
+      (end = file_tell(r->f)) < 28 || file_seek(r->f, (uint64_t)end - 12) ||
+      get_u64(r->f, &index_offset) || fread(magic, 1, 4, r->f) != 4 ||
+      memcmp(magic, ARCHIVE_MAGIC, 4) != 0 || file_seek(r->f, index_offset) ||
+      get_u64(r->f, &r->nfiles) || get_u64(r->f, &r->nblocks) ||
+      get_u64(r->f, &r->names_bytes) ||
+      r->nblocks > (uint64_t)end / (7 * sizeof(uint64_t)) ||
+      r->nfiles > (uint64_t)end / (4 * sizeof(uint64_t)) ||
+      r->names_bytes > (uint64_t)end) {
+    archive_close(r);
+    return NULL;
+  }
+
+  r->blocks = calloc((size_t)r->nblocks + 1, sizeof(*r->blocks));
+  r->starts = calloc((size_t)r->nblocks + 1, sizeof(*r->starts));
+  r->files = calloc((size_t)r->nfiles + 1, sizeof(*r->files));
+  r->names = malloc((size_t)r->names_bytes + 1);
+  if (!r->blocks || !r->starts || !r->files || !r->names) {
+    archive_close(r);
+    return NULL;
+  }
+  uint64_t total = 0;
+  for (uint64_t k = 0; k < r->nblocks; k++) {
+    struct block_entry* b = &r->blocks[k];
+    if (get_u64(r->f, &b->offset) || get_u64(r->f, &b->comp_len) ||
+        get_u64(r->f, &b->raw_len) || get_u64(r->f, &b->primary) ||
+        get_u64(r->f, &b->sym_len) || get_u64(r->f, &b->flags) ||
+        get_u64(r->f, &b->checksum) || b->raw_len == 0 ||
+        b->raw_len > r->block_size) {
+      archive_close(r);
+      return NULL;
+    }
+    r->starts[k] = total;
+    total += b->raw_len;
+  }
+  r->starts[r->nblocks] = total;
+  for (uint64_t i = 0; i < r->nfiles; i++) {
+    struct archive_entry* e = &r->files[i];
+    if (get_u64(r->f, &e->pos) || get_u64(r->f, &e->size) ||
+        get_u64(r->f, &e->name_off) || get_u64(r->f, &e->name_len) ||
+        e->pos > total || e->size > total - e->pos ||
+        e->name_off > r->names_bytes ||
+        e->name_len > r->names_bytes - e->name_off) {
+      archive_close(r);
+      return NULL;
+    }
+  }
+  if (fread(r->names, 1, (size_t)r->names_bytes, r->f) != r->names_bytes) {
+    archive_close(r);
+    return NULL;
+  }
+  r->cached = r->nblocks;
+  return r;
+}
+
+uint64_t archive_count(const struct archive_reader* r) {
+  return r->nfiles;
+}
+
+const char* archive_name(const struct archive_reader* r,
+                         uint64_t i,
+                         size_t* len) {
+  *len = (size_t)r->files[i].name_len;
+  return r->names + r->files[i].name_off;
+}
+
+uint64_t archive_size(const struct archive_reader* r, uint64_t i) {
+  return r->files[i].size;
+}
+
+/* Binary search of the name-sorted table. */
+int64_t archive_find(const struct archive_reader* r, const char* name) {
+  size_t len = strlen(name);
+  uint64_t lo = 0, hi = r->nfiles;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    const struct archive_entry* e = &r->files[mid];
+    size_t n = len < e->name_len ? len : (size_t)e->name_len;
+    int c = memcmp(r->names + e->name_off, name, n);
+    if (c == 0)
+      c = e->name_len < len ? -1 : e->name_len > len;
+    if (c == 0)
+      return (int64_t)mid;
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+/* Decode block k into the cache unless it is there already. */
+static int load_block(struct archive_reader* r, uint64_t k) {
+  if (r->cached == k)
+    return 0;
+  const struct block_entry* b = &r->blocks[k];
+  mem_free(r->cache_data);
+  r->cache_data = NULL;
+  r->cached = r->nblocks;
+  unsigned char* payload = malloc(b->comp_len ? (size_t)b->comp_len : 1);
+  if (!payload || file_seek(r->f, b->offset) ||
+      fread(payload, 1, (size_t)b->comp_len, r->f) != b->comp_len) {
+    free(payload);
+    return -1;
+  }
+  r->cache_data = decompress_block(payload, b);
+  free(payload);
+  if (!r->cache_data)
+    return -1;
+  r->cached = k;
+  return 0;
+}
+
+int archive_extract(struct archive_reader* r, uint64_t i, FILE* out) {
+  if (i >= r->nfiles)
+    return -1;
+  uint64_t pos = r->files[i].pos;
+  uint64_t left = r->files[i].size;
+  // last block starting at or before pos
+  uint64_t k = 0, hi = r->nblocks;
+  while (hi - k > 1) {
+    uint64_t mid = k + (hi - k) / 2;
+    if (r->starts[mid] <= pos)
+      k = mid;
+    else
+      hi = mid;
+  }
+  for (; left > 0; k++) {
+    if (k >= r->nblocks || load_block(r, k) != 0)
+      return -1;
+    uint64_t off = pos - r->starts[k];
+    uint64_t n = r->blocks[k].raw_len - off;
+    if (n > left)
+      n = left;
+    if (fwrite(r->cache_data + off, 1, (size_t)n, out) != n)
+      return -1;
+    pos += n;
+    left -= n;
+  }
+  return 0;
+}
+
+static int make_dir(const char* path) {
+#ifdef _WIN32
+  int rc = _mkdir(path);
+#else
+  int rc = mkdir(path, 0777);
+#endif
+  return rc == 0 || errno == EEXIST ? 0 : -1;
+}
+
+/* Names are written under the destination as they are: refuse absolute
+   ones and ".." components, which would land outside it. */
+static int safe_name(const char* name, size_t len) {
+  if (len == 0 || name[0] == '/' || name[0] == '\\' ||
+      (len > 1 && name[1] == ':'))
+    return 0;
+  for (size_t i = 0; i < len;) {
+    size_t j = i;
+    while (j < len && name[j] != '/' && name[j] != '\\')
+      j++;
+    if (j - i == 2 && name[i] == '.' && name[i + 1] == '.')
+      return 0;
+    i = j + 1;
+  }
+  return 1;
+}
+
+/* Extract every file under dest_dir, creating directories as needed.
+   Files come out in stream order, so each block is decoded once. */
+int archive_unpack(struct archive_reader* r, const char* dest_dir) {
+  if (make_dir(dest_dir) != 0) {
+    fprintf(stderr, "Error: cannot create %s\n", dest_dir);
+    return -1;
+  }
+  size_t dest_len = strlen(dest_dir);
+  for (uint64_t i = 0; i < r->nfiles; i++) {
+    size_t len;
+    const char* name = archive_name(r, i, &len);
+    if (!safe_name(name, len)) {
+      fprintf(stderr, "Error: refusing to extract %.*s\n", (int)len, name);
+      return -1;
+    }
+    char* path = malloc(dest_len + 1 + len + 1);
+    if (!path)
+      return -1;
+    memcpy(path, dest_dir, dest_len);
+    path[dest_len] = '/';
+    memcpy(path + dest_len + 1, name, len);
+    path[dest_len + 1 + len] = '\0';
+    int err = 0;
+    for (char* p = path + dest_len + 1; *p && !err; p++)
+      if (*p == '/') {
+        *p = '\0';
+        err = make_dir(path) != 0;
+        *p = '/';
+      }
+    FILE* out = err ? NULL : fopen(path, "wb");
+    err = !out || archive_extract(r, i, out) != 0;
+    if (out && fclose(out) != 0)
+      err = 1;
+    if (err)
+      fprintf(stderr, "Error: cannot extract %s\n", path);
+    free(path);
+    if (err)
+      return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,76 @@
+// main_archive.h
+// Multi-file archives (main_archive.c).
+// Files are laid end to end in one logical stream that is cut into blocks
+// and compressed on a pool of threads.  A file up to the block size never
+// spans blocks, so many small files share a block and compress together;
+// a larger one starts a block of its own and runs over as many as it needs.
+// A name-sorted table maps each file to its range of the stream, so one file
+// can be extracted by decoding only the blocks that hold it.
+//
+// Layout (.tca, native endian):
+//   char     magic[4]         "TCAR"
+//   uint32_t version
+//   uint32_t block_size
+//   uint32_t reserved
+//   block payloads            (compress_block output, back to back)
+//   index:
+//     uint64_t nfiles, nblocks, names_bytes
+//     nblocks x { offset, comp_len, raw_len, primary, sym_len, flags,
+//                 checksum }                             (all uint64_t)
+//     nfiles x { pos, size, name_off, name_len }        (all uint64_t)
+//                             sorted by name (bytewise); pos is the file's
+//                             start in the concatenated raw blocks
+//     names blob              the names, not NUL-terminated
+//   trailer:
+//     uint64_t index_offset
+//     char     magic[4]       "TCAR"
+// Version 2 has the same layout; its blocks may carry BLOCK_FLAG_HUF4, which
+// version 1 readers do not know.
+
+#ifndef MAIN_ARCHIVE_H
+#define MAIN_ARCHIVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ARCHIVE_MAGIC "TCAR"
+#define ARCHIVE_VERSION 2
+
+struct archive_stats {
+  uint64_t files;
+  uint64_t bytes;   // raw bytes of all files
+  uint64_t blocks;
+  uint64_t shared;  // blocks holding more than one file
+  uint64_t comp;    // archive bytes
+};
+
+/* Archive the given inputs (regular files, or directories walked
+   recursively) plus the paths listed one per line in list_path (may be
+   NULL).  threads <= 0 uses one per CPU.  Under a memory limit
+   (mem_set_limit) fewer threads and, if need be, smaller blocks are used. */
+int archive_create(const char* path,
+                   const char* const* inputs,
+                   int ninputs,
+                   const char* list_path,
+                   uint32_t block_size,
+                   int threads,
+                   struct archive_stats* stats);
+
+struct archive_reader;
+struct archive_reader* archive_open(const char* path);
+void archive_close(struct archive_reader* r);
+uint64_t archive_count(const struct archive_reader* r);
+/* Name (not NUL-terminated, *len bytes) and size of file i. */
+const char* archive_name(const struct archive_reader* r,
+                         uint64_t i,
+                         size_t* len);
+uint64_t archive_size(const struct archive_reader* r, uint64_t i);
+/* Index of the file called name, or -1. */
+int64_t archive_find(const struct archive_reader* r, const char* name);
+/* Write file i to out, decoding only the blocks that hold it. */
+int archive_extract(struct archive_reader* r, uint64_t i, FILE* out);
+/* Extract every file under dest_dir (names with ".." or an absolute path
+   are refused). */
+int archive_unpack(struct archive_reader* r, const char* dest_dir);
+
+#endif
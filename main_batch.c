@@ -0,0 +1,360 @@
+// main_batch.c
+// Record batches: many small records packed into shared blocks, so they
+// compress about as well as one big file, plus a per-record index so that
+// batch_get() only has to decode the one block holding the record.
+//
+// File layout (.tcb, native endian):
+//   char     magic[4]         "TCBT"
+//   uint32_t version
+//   uint32_t block_size
+//   uint32_t reserved
+//   block payloads            (compress_block output, back to back)
+//   index:
+//     uint64_t nrecords, nblocks, lens_bytes
+//     nblocks x { offset, comp_len, raw_len, primary, sym_len, flags,
+//                 checksum, first_record, nrecs, lens_off } (all uint64_t)
+//     lens blob               record lengths as LEB128 varints, per block
+//   trailer:
+//     uint64_t index_offset
+//     char     magic[4]       "TCBT"
+// Version 1 files have no flags and checksum; they are still read.
+// Version 3 has the same layout; its blocks may carry BLOCK_FLAG_HUF4.
+// A record never spans blocks; one larger than block_size gets a block of
+// its own.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main_container.h"
+#include "main_memory.h"
+
+#define BATCH_MAGIC "TCBT"
+#define BATCH_VERSION 3
+#define BATCH_MAX_RECORD (1u << 30)
+
+unsigned char* compress_block(const unsigned char* block,
+                              uint32_t len,
+                              const struct block_options* opts,
+                              struct block_entry* entry);  // main_block.c
+unsigned char* decompress_block(const unsigned char* payload,
+                                const struct block_entry* entry);  // main_block.c
+
+struct batch_block {
+  struct block_entry e;
+  uint64_t first_record;
+  uint64_t nrecs;
+  uint64_t lens_off;
+};
+
+struct batch_writer {
+  FILE* f;
+  uint32_t block_size;
+  unsigned char* buf;  // records of the block being filled
+  size_t buf_len;
+  size_t buf_cap;
+  uint64_t buf_recs;
+  unsigned char* lens;  // varint lengths of all records so far
+  size_t lens_len;
+  size_t lens_cap;
+  uint64_t block_lens_off;  // where the current block's lengths start
+  struct batch_block* blocks;
+  uint64_t nblocks;
+  uint64_t blocks_cap;
+  uint64_t nrecords;
+  uint64_t offset;  // file offset of the next payload
+};
+
+struct batch_reader {
+  FILE* f;
+  uint64_t nrecords;
+  uint64_t nblocks;
+  struct batch_block* blocks;
+  unsigned char* lens;
+  uint64_t lens_bytes;
+  uint64_t cached;  // block held in cache_data, or nblocks if none
+  unsigned char* cache_data;
+};
+
+static int put_u32(FILE* f, uint32_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static int put_u64(FILE* f, uint64_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static int get_u32(FILE* f, uint32_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+}
+
+static int get_u64(FILE* f, uint64_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+}
+
+static int grow(void** p, size_t* cap, size_t need, size_t elem) {
+  if (need <= *cap)
+    return 0;
+  size_t n = *cap ? *cap : 64;
+  while (n < need)
+    n *= 2;
+  void* q = realloc(*p, n * elem);
+  if (!q)
+    return -1;
+  *p = q;
+  *cap = n;
+  return 0;
+}
+
+struct batch_writer* batch_create(const char* path, uint32_t block_size) {
+  struct batch_writer* w = calloc(1, sizeof(*w));
+  if (!w)
+    return NULL;
+  w->block_size = block_size;
+  w->f = fopen(path, "wb");
+  if (!w->f || fwrite(BATCH_MAGIC, 1, 4, w->f) != 4 ||
+      put_u32(w->f, BATCH_VERSION) || put_u32(w->f, block_size) ||
+      put_u32(w->f, 0)) {
+    if (w->f)
+      fclose(w->f);
+    free(w);
+    return NULL;
+  }
+  w->offset = 16;
+  return w;
+}
+
+/* Compress the pending records as one block and append it. */
+static int batch_flush(struct batch_writer* w) {
+  if (w->buf_recs == 0)
+    return 0;
+  size_t cap = (size_t)w->blocks_cap;
+  if (grow((void**)&w->blocks, &cap, (size_t)w->nblocks + 1,
+           sizeof(*w->blocks)))
+    return -1;
+  w->blocks_cap = cap;
+
+  struct batch_block* b = &w->blocks[w->nblocks];
+  memset(b, 0, sizeof(*b));
+  b->e.offset = w->offset;
+  b->first_record = w->nrecords - w->buf_recs;
+  b->nrecs = w->buf_recs;
+  b->lens_off = w->block_lens_off;
+  if (w->buf_len > 0) {
+    // a block of only empty records has no payload at all
+    unsigned char* payload = compress_block(w->buf, (uint32_t)w->buf_len, NULL, &b->e);
+    if (!payload)
+      return -1;
+    size_t n = fwrite(payload, 1, (size_t)b->e.comp_len, w->f);
+    mem_free(payload);
+    if (n != b->e.comp_len)
+      return -1;
+  }
+  w->offset += b->e.comp_len;
+  w->nblocks++;
+  w->buf_len = 0;
+  w->buf_recs = 0;
+  w->block_lens_off = w->lens_len;
+  return 0;
+}
+
+/* Append one record; its ID (0-based, in insertion order) goes to
+   *record_id.  Returns 0 on success. */
+int batch_add(struct batch_writer* w,
+              const void* record,
+              size_t len,
+              uint64_t* record_id) {
+  if (len > BATCH_MAX_RECORD)
+    return -1;
+  if (w->buf_len > 0 && w->buf_len + len > w->block_size &&
+      batch_flush(w) != 0)
+    return -1;
+  if (grow((void**)&w->buf, &w->buf_cap, w->buf_len + len, 1) ||
+      grow((void**)&w->lens, &w->lens_cap, w->lens_len + 10, 1))
+    return -1;
+  memcpy(w->buf + w->buf_len, record, len);
+  w->buf_len += len;
+  uint64_t v = len;
+  while (v >= 0x80) {
+    w->lens[w->lens_len++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  w->lens[w->lens_len++] = (unsigned char)v;
+  w->buf_recs++;
+  if (record_id)
+    *record_id = w->nrecords;
+  w->nrecords++;
+  return 0;
+}
+
+/* Flush the last block, write the index and close.  Returns 0 on success;
+   the writer is freed either way. */
+int batch_finish(struct batch_writer* w) {
+  int err = batch_flush(w) != 0;
+  uint64_t index_offset = w->offset;
+  err |= put_u64(w->f, w->nrecords);
+  err |= put_u64(w->f, w->nblocks);
+  err |= put_u64(w->f, w->lens_len);
+  for (uint64_t i = 0; i < w->nblocks && !err; i++) {
+    const struct batch_block* b = &w->blocks[i];
+    err |= put_u64(w->f, b->e.offset);
+    err |= put_u64(w->f, b->e.comp_len);
+    err |= put_u64(w->f, b->e.raw_len);
+    err |= put_u64(w->f, b->e.primary);
+    err |= put_u64(w->f, b->e.sym_len);
+    err |= put_u64(w->f, b->e.flags);
+    err |= put_u64(w->f, b->e.checksum);
+    err |= put_u64(w->f, b->first_record);
+    err |= put_u64(w->f, b->nrecs);
+    err |= put_u64(w->f, b->lens_off);
+  }
+  if (!err && w->lens_len)
+    err |= fwrite(w->lens, 1, w->lens_len, w->f) != w->lens_len;
+  err |= put_u64(w->f, index_offset);
+  err |= fwrite(BATCH_MAGIC, 1, 4, w->f) != 4;
+  if (fclose(w->f) != 0)
+    err = 1;
+  free(w->buf);
+  free(w->lens);
+  free(w->blocks);
+  free(w);
+  return err ? -1 : 0;
+}
+
+void batch_close(struct batch_reader* r) {
+  if (!r)
+    return;
+  if (r->f)
+    fclose(r->f);
+  free(r->blocks);
+  free(r->lens);
+  mem_free(r->cache_data);
+  free(r);
+}
+
+/* Open a batch file and load its index (not the payloads). */
+struct batch_reader* batch_open(const char* path) {
+  struct batch_reader* r = calloc(1, sizeof(*r));
+  if (!r)
+    return NULL;
+  r->f = fopen(path, "rb");
+  char magic[4];
+  uint32_t version = 0;
+  uint64_t index_offset = 0;
+  int64_t end;
+  if (!r->f || fread(magic, 1, 4, r->f) != 4 ||
+      memcmp(magic, BATCH_MAGIC, 4) != 0 || get_u32(r->f, &version) ||
+      version < 1 || version > BATCH_VERSION || file_seek_end(r->f) ||
+      (end = file_tell(r->f)) < 28 || file_seek(r->f, (uint64_t)end - 12) ||
+      get_u64(r->f, &index_offset) || fread(magic, 1, 4, r->f) != 4 ||
+      memcmp(magic, BATCH_MAGIC, 4) != 0 || file_seek(r->f, index_offset) ||
+      get_u64(r->f, &r->nrecords) || get_u64(r->f, &r->nblocks) ||
+      get_u64(r->f, &r->lens_bytes) ||
+      r->nblocks > (uint64_t)end / (8 * sizeof(uint64_t)) ||
+      r->lens_bytes > (uint64_t)end) {
+    batch_close(r);
+    return NULL;
+  }
+
+  r->blocks = calloc((size_t)r->nblocks + 1, sizeof(*r->blocks));
+  r->lens = malloc((size_t)r->lens_bytes + 1);
+  if (!r->blocks || !r->lens) {
+    batch_close(r);
+    return NULL;
+  }
+  for (uint64_t i = 0; i < r->nblocks; i++) {
+    struct batch_block* b = &r->blocks[i];
+    if (get_u64(r->f, &b->e.offset) || get_u64(r->f, &b->e.comp_len) ||
+        get_u64(r->f, &b->e.raw_len) || get_u64(r->f, &b->e.primary) ||
+        get_u64(r->f, &b->e.sym_len) ||
+        (version >= 2 && (get_u64(r->f, &b->e.flags) ||
+                          get_u64(r->f, &b->e.checksum))) ||
+        get_u64(r->f, &b->first_record) ||
+        get_u64(r->f, &b->nrecs) || get_u64(r->f, &b->lens_off) ||
+        b->lens_off > r->lens_bytes) {
+      batch_close(r);
+      return NULL;
+    }
+  }
+  if (fread(r->lens, 1, (size_t)r->lens_bytes, r->f) != r->lens_bytes) {
+    batch_close(r);
+    return NULL;
+  }
+  r->cached = r->nblocks;
+  return r;
+}
+
+uint64_t batch_count(const struct batch_reader* r) {
+  return r->nrecords;
+}
+
+/* Fetch one record.  Only the block that holds it is read and decoded; the
+   last decoded block is kept, so neighbouring lookups are cheap.  Returns
+   an allocated copy (caller frees) with its length in *len, or NULL. */
+unsigned char* batch_get(struct batch_reader* r,
+                         uint64_t record_id,
+                         size_t* len) {
+  if (record_id >= r->nrecords)
+    return NULL;
+
+  // binary search for the block whose record range holds record_id
+  uint64_t lo = 0, hi = r->nblocks;
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (r->blocks[mid].first_record <= record_id)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  const struct batch_block* b = &r->blocks[lo];
+  if (record_id - b->first_record >= b->nrecs)
+    return NULL;
+
+  if (r->cached != lo && b->e.raw_len > 0) {
+    mem_free(r->cache_data);
+    r->cache_data = NULL;
+    r->cached = r->nblocks;
+    unsigned char* payload = malloc((size_t)b->e.comp_len);
+    if (!payload || file_seek(r->f, b->e.offset) ||
+        fread(payload, 1, (size_t)b->e.comp_len, r->f) != b->e.comp_len) {
+      free(payload);
+      return NULL;
+    }
+    r->cache_data = decompress_block(payload, &b->e);
+    free(payload);
+    if (!r->cache_data)
+      return NULL;
+    r->cached = lo;
+  }
+
+  // walk the block's varint lengths up to the record
+  uint64_t pos = b->lens_off;
+  uint64_t start = 0, rec_len = 0;
+  for (uint64_t i = b->first_record; i <= record_id; i++) {
+    uint64_t v = 0;
+    int shift = 0;
+    unsigned char c;
+    do {
+      if (pos >= r->lens_bytes || shift > 63)
+        return NULL;
+      c = r->lens[pos++];
+      v |= (uint64_t)(c & 0x7F) << shift;
+      shift += 7;
+    } while (c & 0x80);
+    if (i < record_id)
+      start += v;
+    else
+      rec_len = v;
+  }
+  if (start + rec_len > b->e.raw_len)
+    return NULL;
+
+  unsigned char* out = malloc(rec_len ? (size_t)rec_len : 1);
+  if (!out)
+    return NULL;
+  if (rec_len)
+    memcpy(out, r->cache_data + start, (size_t)rec_len);
+  *len = (size_t)rec_len;
+  return out;
+}
@@ -0,0 +1,599 @@
+// main_block.c
+// One block through the full pipeline and back:
+//   compress_block:   BWT -> MTF + RLE (one fused pass) -> Huffman payload
+//   decompress_block: Huffman payload -> RLE -> MTF -> BWT
+//   (decompress_block_bwt stops before the inverse BWT, for the FM-index)
+// Shared by the file compressor, the decompressor and the record batch
+// store.  The per-block values needed for decoding travel in a
+// struct block_entry (see main_container.h).
+// With BLOCK_FLAG_LZP the block went through the LZP prefilter first
+// (main_lzp.c) and the payload starts with a 5-byte header:
+//   uint32_t filtered_len   bytes that went into the BWT
+//   uint8_t  marker         LZP match marker
+// followed by the usual Huffman payload of the filtered bytes.
+// With BLOCK_FLAG_ALPHA (every block written now) the Huffman payload is
+// preceded by
+//   uint8_t  in_use[32]     bit b of in_use[b / 8] set if byte b occurs
+// and uses the compact Huffman header.  MTF starts from the list of used
+// bytes (mtf_alphabet_list), which codes the block over the dense alphabet
+// 0..k-1: short MTF searches, small indices and a small code table.
+// With BLOCK_FLAG_HUF4 (blocks of HUF4_MIN_SYMBOLS RLE symbols or more) the
+// Huffman payload is split into four interleaved streams behind a jump
+// table (compress_huffman_x4), which decode in parallel.
+// With BLOCK_FLAG_LZ77 (the fast level, opts->fast) the payload is the
+// block's LZ77 token stream (main_lz77.c) and none of the above applies.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main_container.h"
+#include "main_memory.h"
+
+struct bwt_workspace;
+struct bwt_workspace* bwt_workspace_create(void);  // from main_bwt.c
+void bwt_workspace_set_threads(struct bwt_workspace* ws,
+                               int threads);        // from main_bwt.c
+void bwt_workspace_free(struct bwt_workspace* ws);  // from main_bwt.c
+int bwt_encode_ws(struct bwt_workspace* ws,
+                  const unsigned char* input,
+                  uint32_t n,
+                  unsigned char* out,
+                  uint32_t* primary_index);  // from main_bwt.c
+int bwt_encode_inplace(unsigned char* buf,
+                       uint32_t n,
+                       uint32_t* primary_index);  // from main_bwt_sais.c
+unsigned char* bwt_decode(const unsigned char* bwt,
+                          uint32_t n,
+                          uint32_t primary_index);  // from main_bwt.c
+int mtf_alphabet_list(const unsigned char in_use[32],
+                      unsigned char list[256]);  // from main_mtf.c
+void mtf_decode_list(unsigned char list[256],
+                     const unsigned char* input,
+                     size_t input_len,
+                     unsigned char* out);  // from main_mtf.c
+size_t decompress_rle_buffer(const unsigned char* input,
+                             size_t input_len,
+                             unsigned char* output,
+                             size_t output_capacity);  // from main_rle.c
+size_t compress_huffman_compact(const unsigned char* input,
+                                size_t input_len,
+                                const unsigned freq[256],
+                                unsigned char* output,
+                                size_t output_capacity);  // main_huffman.c
+size_t decompress_huffman_buffer(const unsigned char* input,
+                                 size_t input_len,
+                                 unsigned char* output,
+                                 size_t output_len);  // from main_huffman.c
+size_t decompress_huffman_compact(const unsigned char* input,
+                                  size_t input_len,
+                                  unsigned char* output,
+                                  size_t output_len);  // main_huffman.c
+size_t compress_huffman_x4(const unsigned char* input,
+                           size_t input_len,
+                           const unsigned freq[256],
+                           unsigned char* output,
+                           size_t output_capacity);  // from main_huffman.c
+size_t decompress_huffman_x4(const unsigned char* input,
+                             size_t input_len,
+                             unsigned char* output,
+                             size_t output_len);  // from main_huffman.c
+int compress_huffman_file(FILE* in,
+                          const unsigned long long counts[256],
+                          int compact,
+                          FILE* out,
+                          uint64_t* out_len);  // from main_huffman.c
+size_t mtf_rle_encode(unsigned char list[256],
+                      const unsigned char* input,
+                      size_t input_len,
+                      unsigned char* output,
+                      size_t output_capacity,
+                      unsigned freq[256]);  // from main_mtf.c
+int bwt_encode_external(const char* input_path,
+                        uint64_t offset,
+                        uint64_t n,
+                        FILE* out,
+                        uint64_t* primary,
+                        uint64_t memory_budget,
+                        const char* scratch_dir);  // main_bwt_external.c
+FILE* open_scratch_file(const char* dir,
+                        const char* tag,
+                        unsigned idx,
+                        char* path,
+                        size_t cap);  // from main_bwt_external.c
+
+size_t lzp_encode(const unsigned char* in,
+                  size_t n,
+                  unsigned char* out,
+                  size_t cap,
+                  unsigned char* marker);  // from main_lzp.c
+size_t lzp_decode(const unsigned char* in,
+                  size_t len,
+                  unsigned char marker,
+                  unsigned char* out,
+                  size_t out_len);  // from main_lzp.c
+
+size_t lz77_bound(size_t n);  // from main_lz77.c
+size_t lz77_encode(const unsigned char* in,
+                   size_t n,
+                   unsigned char* out,
+                   size_t cap);  // from main_lz77.c
+size_t lz77_decode(const unsigned char* in,
+                   size_t len,
+                   unsigned char* out,
+                   size_t out_len);  // from main_lz77.c
+
+uint32_t crc32c_update(uint32_t crc,
+                       const void* data,
+                       size_t len);  // from main_crc32c.c
+
+#define LZP_HEADER 5
+#define ALPHA_MAP 32
+
+/* Smallest RLE output coded as four Huffman streams; below it the jump
+   table and the extra padding outweigh the faster decode. */
+#define HUF4_MIN_SYMBOLS (16u << 10)
+
+/* Default heap budget of the disk-backed builder. */
+#define DEFAULT_EXTERNAL_BUDGET (256u << 20)
+#define STREAM_CHUNK (1u << 20)
+
+/* Pack a seen[256] byte table into the 256-bit in-use map. */
+static void pack_in_use(const unsigned char seen[256],
+                        unsigned char in_use[ALPHA_MAP]) {
+  memset(in_use, 0, ALPHA_MAP);
+  for (int b = 0; b < 256; b++)
+    if (seen[b])
+      in_use[b >> 3] |= (unsigned char)(1u << (b & 7));
+}
+
+/* BWT output -> in-use map -> fused MTF + RLE -> Huffman payload, placed
+   after head bytes that the caller fills in.  Fills in *entry except the
+   offset (comp_len includes head) and returns the payload (from
+   mem_alloc), or NULL on failure. */
+static unsigned char* encode_bwt_output(const unsigned char* bwt_out,
+                                        size_t len,
+                                        uint32_t primary_index,
+                                        size_t head,
+                                        struct block_entry* entry) {
+  // --- alphabet ---
+  unsigned char seen[256] = {0};
+  for (size_t i = 0; i < len; i++)
+    seen[bwt_out[i]] = 1;
+  unsigned char in_use[ALPHA_MAP];
+  pack_in_use(seen, in_use);
+
+  // --- MTF + RLE, counting the Huffman symbols on the way ---
+  unsigned char list[256];
+  mtf_alphabet_list(in_use, list);
+  unsigned freq[256] = {0};
+  size_t rle_capacity = len * 2 + 16;  // safe upper bound
+  unsigned char* rle_out = mem_alloc(rle_capacity);
+  if (!rle_out) {
+    fprintf(stderr, "Out of memory (RLE)\n");
+    return NULL;
+  }
+  size_t rle_len =
+      mtf_rle_encode(list, bwt_out, len, rle_out, rle_capacity, freq);
+  if (rle_len == 0) {
+    fprintf(stderr, "RLE failed (insufficient buffer?)\n");
+    mem_free(rle_out);
+    return NULL;
+  }
+
+  // --- Huffman ---
+  // an optimal prefix code never averages more than 8 bits per symbol;
+  // the four-stream form adds a jump table and up to 3 padding bytes
+  size_t huff_capacity = rle_len + 32 + 256 * sizeof(unsigned) + 32;
+  unsigned char* huff_out = mem_alloc(head + ALPHA_MAP + huff_capacity);
+  if (!huff_out) {
+    fprintf(stderr, "Out of memory (Huffman)\n");
+    mem_free(rle_out);
+    return NULL;
+  }
+  memcpy(huff_out + head, in_use, ALPHA_MAP);
+  int x4 = rle_len >= HUF4_MIN_SYMBOLS;
+  size_t huff_len =
+      x4 ? compress_huffman_x4(rle_out, rle_len, freq,
+                               huff_out + head + ALPHA_MAP, huff_capacity)
+         : compress_huffman_compact(rle_out, rle_len, freq,
+                                    huff_out + head + ALPHA_MAP,
+                                    huff_capacity);
+  mem_free(rle_out);
+  if (huff_len == 0) {
+    fprintf(stderr, "Huffman stage failed\n");
+    mem_free(huff_out);
+    return NULL;
+  }
+
+  entry->comp_len = head + ALPHA_MAP + huff_len;
+  entry->raw_len = len;
+  entry->primary = primary_index;
+  entry->sym_len = rle_len;
+  entry->flags = BLOCK_FLAG_ALPHA | (x4 ? BLOCK_FLAG_HUF4 : 0);
+  return huff_out;
+}
+
+static void set_checksum(struct block_entry* entry, uint32_t crc) {
+  entry->checksum = crc;
+  entry->flags |= BLOCK_FLAG_CRC;
+}
+
+/* Mark a payload built from LZP-filtered bytes: record the header and the
+   original length. */
+static void set_lzp_header(unsigned char* payload,
+                           uint32_t filtered_len,
+                           unsigned char marker,
+                           uint32_t raw_len,
+                           struct block_entry* entry) {
+  memcpy(payload, &filtered_len, sizeof(filtered_len));
+  payload[4] = marker;
+  entry->raw_len = raw_len;
+  entry->flags |= BLOCK_FLAG_LZP;
+}
+
+/* The fast level: one LZ77 pass, no BWT. */
+static unsigned char* compress_block_fast(const unsigned char* block,
+                                          uint32_t len,
+                                          struct block_entry* entry) {
+  size_t cap = lz77_bound(len);
+  unsigned char* payload = mem_alloc(cap);
+  size_t comp_len = payload ? lz77_encode(block, len, payload, cap) : 0;
+  if (comp_len == 0) {
+    fprintf(stderr, "LZ77 failed\n");
+    mem_free(payload);
+    return NULL;
+  }
+  entry->comp_len = comp_len;
+  entry->raw_len = len;
+  entry->primary = 0;
+  entry->sym_len = 0;
+  entry->flags = BLOCK_FLAG_LZ77;
+  set_checksum(entry, crc32c_update(0, block, len));
+  return payload;
+}
+
+/* Compress one block.  opts may be NULL for the defaults.  Returns the
+   payload (free with mem_free) and fills in everything in *entry except
+   the offset; NULL on failure. */
+unsigned char* compress_block(const unsigned char* block,
+                              uint32_t len,
+                              const struct block_options* opts,
+                              struct block_entry* entry) {
+  if (opts && opts->fast)
+    return compress_block_fast(block, len, entry);
+  uint32_t crc = crc32c_update(0, block, len);
+
+  // --- optional LZP prefilter; kept only if it shrinks the block ---
+  const unsigned char* src = block;
+  uint32_t n = len;
+  unsigned char* lzp_out = NULL;
+  unsigned char marker = 0;
+  if (opts && opts->lzp && len > 0) {
+    lzp_out = mem_alloc(len);
+    size_t filtered = lzp_out ? lzp_encode(block, len, lzp_out, len, &marker)
+                              : 0;
+    if (filtered > 0) {
+      src = lzp_out;
+      n = (uint32_t)filtered;
+    } else {
+      mem_free(lzp_out);
+      lzp_out = NULL;
+    }
+  }
+
+  // --- BWT ---
+  uint32_t primary_index = 0;
+  struct bwt_workspace* ws = bwt_workspace_create();
+  unsigned char* bwt_out = mem_alloc(n ? n : 1);
+  if (ws && opts)
+    bwt_workspace_set_threads(ws, opts->threads);
+  if (!ws || !bwt_out ||
+      bwt_encode_ws(ws, src, n, bwt_out, &primary_index) != 0) {
+    fprintf(stderr, "BWT failed\n");
+    bwt_workspace_free(ws);
+    mem_free(bwt_out);
+    mem_free(lzp_out);
+    return NULL;
+  }
+  bwt_workspace_free(ws);
+  mem_free(lzp_out);
+
+  int filtered = src != block;
+  unsigned char* payload = encode_bwt_output(
+      bwt_out, n, primary_index, filtered ? LZP_HEADER : 0, entry);
+  mem_free(bwt_out);
+  if (payload && filtered)
+    set_lzp_header(payload, n, marker, len, entry);
+  if (payload)
+    set_checksum(entry, crc);
+  return payload;
+}
+
+/* Like compress_block, but the block is used as scratch and its contents
+   are destroyed: the BWT is built by induced sorting (bwt_encode_inplace)
+   and written over the block, and MTF + RLE read it from there.  Peak memory
+   is about 5 * len instead of about 17 * len (the LZP prefilter briefly
+   needs a second len-byte buffer, before the suffix array exists). */
+unsigned char* compress_block_inplace(unsigned char* block,
+                                      uint32_t len,
+                                      const struct block_options* opts,
+                                      struct block_entry* entry) {
+  if (opts && opts->fast)
+    return compress_block_fast(block, len, entry);  // needs no sort space
+  uint32_t crc = crc32c_update(0, block, len);  // before the block is reused
+  uint32_t n = len;
+  unsigned char marker = 0;
+  if (opts && opts->lzp && len > 0) {
+    unsigned char* lzp_out = mem_alloc(len);
+    size_t filtered = lzp_out ? lzp_encode(block, len, lzp_out, len, &marker)
+                              : 0;
+    if (filtered > 0) {
+      memcpy(block, lzp_out, filtered);
+      n = (uint32_t)filtered;
+    }
+    mem_free(lzp_out);
+  }
+
+  uint32_t primary_index = 0;
+  if (len == 0 || bwt_encode_inplace(block, n, &primary_index) != 0) {
+    fprintf(stderr, "BWT failed\n");
+    return NULL;
+  }
+  unsigned char* payload = encode_bwt_output(
+      block, n, primary_index, n != len ? LZP_HEADER : 0, entry);
+  if (payload && n != len)
+    set_lzp_header(payload, n, marker, len, entry);
+  if (payload)
+    set_checksum(entry, crc);
+  return payload;
+}
+
+/* Compress bytes [offset, offset + len) of input_path without holding the
+   block in memory: the BWT is built on disk (bwt_encode_external), then
+   MTF + RLE and Huffman stream through scratch files in opts->scratch_dir.
+   The payload is appended to out; it has the same layout as
+   compress_block's, so decompress_block inverts it.  Returns 0 on success
+   and fills in *entry except the offset. */
+int compress_block_external(const char* input_path,
+                            uint64_t offset,
+                            uint64_t len,
+                            const struct block_options* opts,
+                            FILE* out,
+                            struct block_entry* entry) {
+  const char* dir = opts->scratch_dir;
+  uint64_t budget =
+      opts->memory_budget ? opts->memory_budget : DEFAULT_EXTERNAL_BUDGET;
+  char bwt_path[512], rle_path[512];
+  FILE* bwt_f = open_scratch_file(dir, "bwt", 0, bwt_path, sizeof(bwt_path));
+  FILE* rle_f = open_scratch_file(dir, "rle", 0, rle_path, sizeof(rle_path));
+  unsigned char* chunk = malloc(STREAM_CHUNK);
+  unsigned char* rle = malloc(STREAM_CHUNK * 2 + 16);
+  int ok = bwt_f && rle_f && chunk && rle;
+  if (!ok)
+    fprintf(stderr, "Cannot set up scratch files in %s\n", dir);
+
+  // --- checksum and alphabet of the raw range (the BWT permutes it) ---
+  uint32_t crc = 0;
+  unsigned char seen[256] = {0};
+  FILE* in = ok ? fopen(input_path, "rb") : NULL;
+  if (ok && (!in || file_seek(in, offset) != 0))
+    ok = 0;
+  for (uint64_t left = len; ok && left > 0;) {
+    size_t want = left < STREAM_CHUNK ? (size_t)left : STREAM_CHUNK;
+    if (fread(chunk, 1, want, in) != want) {
+      ok = 0;
+      break;
+    }
+    crc = crc32c_update(crc, chunk, want);
+    for (size_t i = 0; i < want; i++)
+      seen[chunk[i]] = 1;
+    left -= want;
+  }
+  if (in)
+    fclose(in);
+
+  // --- BWT on disk ---
+  uint64_t primary = 0;
+  if (ok && (bwt_encode_external(input_path, offset, len, bwt_f, &primary,
+                                 budget, dir) != 0 ||
+             fflush(bwt_f) != 0 || fseek(bwt_f, 0, SEEK_SET) != 0)) {
+    fprintf(stderr, "External BWT failed\n");
+    ok = 0;
+  }
+
+  // --- MTF + RLE, chunk by chunk (the MTF list carries over) ---
+  unsigned char in_use[ALPHA_MAP], list[256];
+  pack_in_use(seen, in_use);
+  mtf_alphabet_list(in_use, list);
+  unsigned long long counts[256] = {0};
+  uint64_t sym_len = 0;
+  size_t got;
+  while (ok && (got = fread(chunk, 1, STREAM_CHUNK, bwt_f)) > 0) {
+    unsigned freq[256] = {0};
+    size_t n = mtf_rle_encode(list, chunk, got, rle, STREAM_CHUNK * 2 + 16,
+                              freq);
+    if (n == 0 || fwrite(rle, 1, n, rle_f) != n) {
+      ok = 0;
+      break;
+    }
+    for (int i = 0; i < 256; i++)
+      counts[i] += freq[i];
+    sym_len += n;
+  }
+
+  // --- Huffman, two passes over the RLE file ---
+  uint64_t comp_len = 0;
+  if (ok && (fflush(rle_f) != 0 || fseek(rle_f, 0, SEEK_SET) != 0 ||
+             fwrite(in_use, 1, ALPHA_MAP, out) != ALPHA_MAP ||
+             compress_huffman_file(rle_f, counts, 1, out, &comp_len) != 0)) {
+    fprintf(stderr, "Huffman stage failed\n");
+    ok = 0;
+  }
+
+  if (bwt_f) {
+    fclose(bwt_f);
+    remove(bwt_path);
+  }
+  if (rle_f) {
+    fclose(rle_f);
+    remove(rle_path);
+  }
+  free(chunk);
+  free(rle);
+  if (!ok)
+    return -1;
+
+  entry->comp_len = ALPHA_MAP + comp_len;
+  entry->raw_len = len;
+  entry->primary = primary;
+  entry->sym_len = sym_len;
+  entry->flags = BLOCK_FLAG_ALPHA;
+  set_checksum(entry, crc);
+  return 0;
+}
+
+/* Huffman payload -> RLE -> MTF: recover the BWT of raw_len bytes; flags
+   say whether the payload starts with the in-use map (BLOCK_FLAG_ALPHA) and
+   has four Huffman streams (BLOCK_FLAG_HUF4).  Returns a buffer of raw_len
+   bytes from mem_alloc, or NULL. */
+static unsigned char* decode_to_bwt(const unsigned char* payload,
+                                    size_t comp_len,
+                                    size_t raw_len,
+                                    size_t sym_len,
+                                    uint64_t flags) {
+  int alpha = (flags & BLOCK_FLAG_ALPHA) != 0;
+  int x4 = (flags & BLOCK_FLAG_HUF4) != 0;
+  if (raw_len == 0 || sym_len > raw_len * 2 || (x4 && !alpha))
+    return NULL;
+  unsigned char list[256];
+  if (alpha) {
+    if (comp_len < ALPHA_MAP)
+      return NULL;
+    mtf_alphabet_list(payload, list);
+    payload += ALPHA_MAP;
+    comp_len -= ALPHA_MAP;
+  } else {
+    for (int i = 0; i < 256; ++i)
+      list[i] = (unsigned char)i;
+  }
+
+  // 1) Huffman -> RLE pairs
+  unsigned char* rle_buf = mem_alloc(sym_len ? sym_len : 1);
+  if (!rle_buf)
+    return NULL;
+  size_t got =
+      x4      ? decompress_huffman_x4(payload, comp_len, rle_buf, sym_len)
+      : alpha ? decompress_huffman_compact(payload, comp_len, rle_buf, sym_len)
+              : decompress_huffman_buffer(payload, comp_len, rle_buf, sym_len);
+  if (got != sym_len) {
+    fprintf(stderr, "Huffman decode failed\n");
+    mem_free(rle_buf);
+    return NULL;
+  }
+
+  // 2) RLE -> MTF indices
+  unsigned char* mtf_buf = mem_alloc(raw_len);
+  if (!mtf_buf) {
+    mem_free(rle_buf);
+    return NULL;
+  }
+  size_t mtf_len = decompress_rle_buffer(rle_buf, sym_len, mtf_buf, raw_len);
+  mem_free(rle_buf);
+  if (mtf_len != raw_len) {
+    fprintf(stderr, "RLE decode produced %zu bytes, expected %zu\n", mtf_len,
+            raw_len);
+    mem_free(mtf_buf);
+    return NULL;
+  }
+
+  // 3) inverse MTF, in place
+  mtf_decode_list(list, mtf_buf, mtf_len, mtf_buf);
+  return mtf_buf;
+}
+
+/* decode_to_bwt, then the inverse BWT.  Returns a buffer of raw_len bytes
+   from mem_alloc, or NULL. */
+static unsigned char* decode_chain(const unsigned char* payload,
+                                   size_t comp_len,
+                                   size_t raw_len,
+                                   uint32_t primary,
+                                   size_t sym_len,
+                                   uint64_t flags) {
+  unsigned char* bwt = decode_to_bwt(payload, comp_len, raw_len, sym_len,
+                                     flags);
+  if (!bwt)
+    return NULL;
+
+  // 4) inverse BWT
+  unsigned char* orig = bwt_decode(bwt, (uint32_t)raw_len, primary);
+  mem_free(bwt);
+  if (!orig)
+    fprintf(stderr, "BWT decode failed\n");
+  return orig;
+}
+
+/* Recover only the BWT of one block (entry->raw_len bytes, free with
+   mem_free), for the FM-index builder.  LZP-filtered blocks are refused,
+   as their BWT is of the filtered bytes, and so are fast (LZ77) blocks,
+   which have none.  NULL on failure. */
+unsigned char* decompress_block_bwt(const unsigned char* payload,
+                                    const struct block_entry* entry) {
+  if (entry->flags & (BLOCK_FLAG_LZP | BLOCK_FLAG_LZ77))
+    return NULL;
+  return decode_to_bwt(payload, (size_t)entry->comp_len,
+                       (size_t)entry->raw_len, (size_t)entry->sym_len,
+                       entry->flags);
+}
+
+/* Invert one block.  payload holds entry->comp_len bytes; returns a
+   buffer of entry->raw_len bytes (free with mem_free), or NULL on failure
+   (including a checksum mismatch when the entry carries BLOCK_FLAG_CRC). */
+unsigned char* decompress_block(const unsigned char* payload,
+                                const struct block_entry* entry) {
+  size_t raw_len = (size_t)entry->raw_len;
+  unsigned char* orig = NULL;
+  if (entry->flags & BLOCK_FLAG_LZ77) {
+    orig = raw_len ? mem_alloc(raw_len) : NULL;
+    if (orig && lz77_decode(payload, (size_t)entry->comp_len, orig,
+                            raw_len) != raw_len) {
+      fprintf(stderr, "LZ77 decode failed\n");
+      mem_free(orig);
+      orig = NULL;
+    }
+  } else if (!(entry->flags & BLOCK_FLAG_LZP)) {
+    orig = decode_chain(payload, (size_t)entry->comp_len, raw_len,
+                        (uint32_t)entry->primary, (size_t)entry->sym_len,
+                        entry->flags);
+  } else {
+    // 5) LZP-filtered block: decode the filtered bytes, then expand them
+    uint32_t filtered_len;
+    if (entry->comp_len < LZP_HEADER)
+      return NULL;
+    memcpy(&filtered_len, payload, sizeof(filtered_len));
+    if (filtered_len == 0 || filtered_len >= raw_len)
+      return NULL;
+    unsigned char* filtered = decode_chain(
+        payload + LZP_HEADER, (size_t)entry->comp_len - LZP_HEADER,
+        filtered_len, (uint32_t)entry->primary, (size_t)entry->sym_len,
+        entry->flags);
+    orig = filtered ? mem_alloc(raw_len) : NULL;
+    if (orig && lzp_decode(filtered, filtered_len, payload[4], orig,
+                           raw_len) != raw_len) {
+      fprintf(stderr, "LZP decode failed\n");
+      mem_free(orig);
+      orig = NULL;
+    }
+    mem_free(filtered);
+  }
+
+  // 6) checksum
+  if (orig && (entry->flags & BLOCK_FLAG_CRC) &&
+      crc32c_update(0, orig, raw_len) != (uint32_t)entry->checksum) {
+    fprintf(stderr, "Block checksum mismatch\n");
+    mem_free(orig);
+    orig = NULL;
+  }
+  return orig;
+}
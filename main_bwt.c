@@ -6,6 +6,24 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "main_memory.h"
+
+/* Largest block the in-memory suffix sorter accepts (int indices). */
+#define BWT_MAX_BLOCK (1u << 30)
+
+/* Largest block the inverse transform accepts: rows 0..n must fit the
+   32-bit LF array.  Blocks above BWT_MAX_BLOCK come from the external
+   builder (main_bwt_external.c). */
+#define BWT_MAX_DECODE_BLOCK 0xFFFFFFFEu
+
+/* Below this size thread start-up costs more than it saves. */
+#define BWT_PARALLEL_MIN_BLOCK (1u << 16)
+
+int build_suffix_array_parallel(const unsigned char* s,
+                                int n,
+                                int* sa,
+                                int nthreads);  // main_bwt_parallel.c
+
 static int cmp_suffixes_by_rank(const int* rank, int a, int b, int k, int n) {
   if (rank[a] != rank[b])
     return rank[a] < rank[b] ? -1 : 1;
@@ -16,20 +34,81 @@ static int cmp_suffixes_by_rank(const int* rank, int a, int b, int k, int n) {
   return 0;
 }
 
+/* Scratch arrays for suffix sorting and inversion.  A workspace only grows,
+   so a long-lived caller (e.g. a daemon worker) allocates once and reuses
+   the memory for every block. */
+struct bwt_workspace {
+  int* sa;
+  int* rank;
+  int* tmp;
+  int* tmp_sa;
+  int* cnt;
+  uint32_t* lf;    // inverse transform only
+  size_t cap;      // elements in sa/rank/tmp/tmp_sa
+  size_t cnt_cap;  // elements in cnt
+  size_t lf_cap;   // elements in lf
+  int threads;     // >1: sort large blocks with the parallel engine
+};
+
+struct bwt_workspace* bwt_workspace_create(void) {
+  return calloc(1, sizeof(struct bwt_workspace));
+}
+
+void bwt_workspace_set_threads(struct bwt_workspace* ws, int threads) {
+  ws->threads = threads;
+}
+
+void bwt_workspace_free(struct bwt_workspace* ws) {
+  if (!ws)
+    return;
+  mem_free(ws->sa);
+  mem_free(ws->rank);
+  mem_free(ws->tmp);
+  mem_free(ws->tmp_sa);
+  mem_free(ws->cnt);
+  mem_free(ws->lf);
+  free(ws);
+}
+
+static int grow_ints(int** p, size_t n) {
+  int* q = mem_realloc(*p, n * sizeof(int));
+  if (!q)
+    return -1;
+  *p = q;
+  return 0;
+}
+
+static int bwt_workspace_reserve(struct bwt_workspace* ws, size_t n) {
+  if (n > ws->cap) {
+    if (grow_ints(&ws->sa, n) || grow_ints(&ws->rank, n) ||
+        grow_ints(&ws->tmp, n) || grow_ints(&ws->tmp_sa, n))
+      return -1;
+    ws->cap = n;
+  }
+  // ranks never exceed max(n, 256); keys are shifted by one for "past end"
+  size_t cnt_need = (n > 256 ? n : 256) + 2;
+  if (cnt_need > ws->cnt_cap) {
+    if (grow_ints(&ws->cnt, cnt_need))
+      return -1;
+    ws->cnt_cap = cnt_need;
+  }
+  return 0;
+}
+
 /* Build suffix array using doubling + counting/radix sort approach.
-   Returns pointer to int array of length n (caller must free).
+   The result is left in ws->sa (n entries).  Returns 0 on success.
 */
-static int* build_suffix_array(const unsigned char* s, int n) {
+static int build_suffix_array(const unsigned char* s,
+                              int n,
+                              struct bwt_workspace* ws) {
   int i, k;
-  int* sa = malloc(n * sizeof(int));
-  int* rank = malloc(n * sizeof(int));
-  int* tmp = malloc(n * sizeof(int));
-  if (!sa || !rank || !tmp) {
-    free(sa);
-    free(rank);
-    free(tmp);
-    return NULL;
-  }
+  if (bwt_workspace_reserve(ws, (size_t)n) != 0)
+    return -1;
+  int* sa = ws->sa;
+  int* rank = ws->rank;
+  int* tmp = ws->tmp;
+  int* tmp_sa = ws->tmp_sa;
+  int* cnt = ws->cnt;
 
   for (i = 0; i < n; ++i) {
     sa[i] = i;
@@ -44,14 +123,7 @@ static int* build_suffix_array(const unsigned char* s, int n) {
     for (i = 0; i < n; ++i)
       if (rank[i] + 1 > maxv)
         maxv = rank[i] + 1;
-
-    int* cnt = calloc(maxv + 2, sizeof(int));
-    if (!cnt) {
-      free(sa);
-      free(rank);
-      free(tmp);
-      return NULL;
-    }
+    memset(cnt, 0, (size_t)(maxv + 2) * sizeof(int));
 
     // sort by second key
     for (i = 0; i < n; ++i) {
@@ -62,20 +134,11 @@ static int* build_suffix_array(const unsigned char* s, int n) {
       cnt[i] += cnt[i - 1];
 
     // produce an ordering by second key into tmp_sa
-    int* tmp_sa = malloc(n * sizeof(int));
-    if (!tmp_sa) {
-      free(cnt);
-      free(sa);
-      free(rank);
-      free(tmp);
-      return NULL;
-    }
     for (i = n - 1; i >= 0; --i) {
       int idx = i;
       int key = (idx + k < n) ? rank[idx + k] + 1 : 0;
       tmp_sa[--cnt[key]] = idx;
     }
-    free(cnt);
 
     // Now sort tmp_sa by first key (rank[tmp_sa[i]]) using counting sort
     // find max first key
@@ -83,14 +146,7 @@ static int* build_suffix_array(const unsigned char* s, int n) {
     for (i = 0; i < n; ++i)
       if (rank[i] > maxr)
         maxr = rank[i];
-    cnt = calloc((maxr + 2), sizeof(int));
-    if (!cnt) {
-      free(tmp_sa);
-      free(sa);
-      free(rank);
-      free(tmp);
-      return NULL;
-    }
+    memset(cnt, 0, (size_t)(maxr + 2) * sizeof(int));
     for (i = 0; i < n; ++i)
       cnt[rank[i]]++;
     for (i = 1; i <= maxr + 1; ++i)
@@ -101,8 +157,6 @@ static int* build_suffix_array(const unsigned char* s, int n) {
       int key = rank[idx];
       sa[--cnt[key]] = idx;
     }
-    free(cnt);
-    free(tmp_sa);
 
     // now compute new ranks into tmp[]
     tmp[sa[0]] = 0;
@@ -118,113 +172,151 @@ static int* build_suffix_array(const unsigned char* s, int n) {
       break;  // all ranks distinct -> done
   }
 
-  free(rank);
-  free(tmp);
-  return sa;
+  return 0;
 }
 
-/* bwt_encode: build suffix array, compute BWT string and primary index.
-   input: null-terminated C string
-   returns allocated char* (caller frees), sets *original_index.
+/* bwt_encode_ws: build suffix array, compute BWT of one block and its
+   primary index, using ws for scratch and writing n bytes to out.
+   The block is treated as if it were terminated by a unique sentinel
+   that sorts below every byte, so arbitrary binary data (including NULs and
+   periodic inputs) round-trips.  The sentinel itself is not stored: out
+   receives n bytes and *primary_index is the row (1..n) where the sentinel
+   would have appeared.
+   Block-local indices are 32-bit; callers split larger inputs into blocks.
+   Returns 0 on success.
 */
-char* bwt_encode(const char* input, int* original_index) {
-  if (!input)
-    return NULL;
-  size_t n = strlen(input);
+int bwt_encode_ws(struct bwt_workspace* ws,
+                  const unsigned char* input,
+                  uint32_t n,
+                  unsigned char* out,
+                  uint32_t* primary_index) {
+  if (!input || !out || n > BWT_MAX_BLOCK)
+    return -1;
   if (n == 0) {
-    *original_index = 0;
-    char* out = malloc(1);
-    if (out)
-      out[0] = '\0';
-    return out;
+    *primary_index = 0;
+    return 0;
   }
-
-  // For safety, we will work with unsigned char buffer
-  unsigned char* s = malloc(n);
-  if (!s)
-    return NULL;
-  memcpy(s, input, n);
-
-  int* sa = build_suffix_array(s, (int)n);
-  if (!sa) {
-    free(s);
-    return NULL;
-  }
-
-  // Build BWT: last column characters
-  char* bwt = malloc(n + 1);
-  if (!bwt) {
-    free(s);
-    free(sa);
-    return NULL;
+  if (ws->threads > 1 && n >= BWT_PARALLEL_MIN_BLOCK) {
+    // the parallel engine keeps its own rank arrays; only sa lives here
+    if (n > ws->cap) {
+      int* sa = mem_realloc(ws->sa, (size_t)n * sizeof(int));
+      if (!sa)
+        return -1;
+      ws->sa = sa;
+      mem_free(ws->rank);
+      mem_free(ws->tmp);
+      mem_free(ws->tmp_sa);
+      ws->rank = ws->tmp = ws->tmp_sa = NULL;
+      ws->cap = 0;
+    }
+    if (build_suffix_array_parallel(input, (int)n, ws->sa, ws->threads) != 0)
+      return -1;
+  } else if (build_suffix_array(input, (int)n, ws) != 0) {
+    return -1;
   }
 
-  int primary = -1;
-  for (int i = 0; i < (int)n; ++i) {
+  // Row 0 is the sentinel suffix; its last column is the final byte.
+  const int* sa = ws->sa;
+  uint32_t primary = 0;
+  uint32_t o = 0;
+  out[o++] = input[n - 1];
+  for (uint32_t i = 0; i < n; ++i) {
     int pos = sa[i];
-    int lastpos = (pos == 0) ? (int)n - 1 : pos - 1;
-    bwt[i] = (char)s[lastpos];
-    // original string corresponds to suffix starting at 0
     if (pos == 0)
-      primary = i;
+      primary = i + 1;  // sentinel sits in this row; not stored
+    else
+      out[o++] = input[pos - 1];
   }
-  bwt[n] = '\0';
 
-  *original_index = primary;
-
-  free(s);
-  free(sa);
-  return bwt;
+  *primary_index = primary;
+  return 0;
 }
 
-int cmp_uc(const void *a, const void *b) {
-    unsigned char ca = *(const unsigned char*)a;
-    unsigned char cb = *(const unsigned char*)b;
-    return (int)ca - (int)cb;
+/* bwt_encode: allocating wrapper around bwt_encode_ws.
+   returns allocated buffer of n bytes (caller frees), or NULL on failure.
+*/
+unsigned char* bwt_encode(const unsigned char* input,
+                          uint32_t n,
+                          uint32_t* primary_index) {
+  struct bwt_workspace* ws = bwt_workspace_create();
+  unsigned char* bwt = malloc(n ? n : 1);
+  if (!ws || !bwt || bwt_encode_ws(ws, input, n, bwt, primary_index) != 0) {
+    free(bwt);
+    bwt = NULL;
+  }
+  bwt_workspace_free(ws);
+  return bwt;
 }
 
-char* bwt_decode(const char* bwt, int original_index) {
-  int len = strlen(bwt);
-  char* F = malloc(len + 1);
-  memcpy(F, bwt, len);
-  F[len] = '\0';
-  qsort(F, len, sizeof(char), cmp_uc);
-
-  int countF[256] = {0};
-  for (int i = 0; i < len; i++)
-    countF[(unsigned char)F[i]]++;
-
-  int* rankL = calloc(len, sizeof(int));
-  int occ[256] = {0};
-  for (int i = 0; i < len; i++) {
-    unsigned char uc = (unsigned char)bwt[i];
-    rankL[i] = occ[uc]++;
+/* bwt_decode_ws: invert bwt_encode.  bwt holds n bytes, primary_index is the
+   sentinel row reported by bwt_encode (or bwt_encode_external); n bytes
+   are written to out.
+   Returns 0 on success, -1 on failure / corrupt input.
+*/
+int bwt_decode_ws(struct bwt_workspace* ws,
+                  const unsigned char* bwt,
+                  uint32_t n,
+                  uint32_t primary_index,
+                  unsigned char* out) {
+  if (!bwt || !out || n > BWT_MAX_DECODE_BLOCK)
+    return -1;
+  if (n == 0)
+    return 0;
+  if (primary_index < 1 || primary_index > n)
+    return -1;
+  if ((size_t)n + 1 > ws->lf_cap) {
+    uint32_t* lf = mem_realloc(ws->lf, ((size_t)n + 1) * sizeof(uint32_t));
+    if (!lf)
+      return -1;
+    ws->lf = lf;
+    ws->lf_cap = (size_t)n + 1;
   }
 
-  int firstOcc[256];
-  int total = 0;
+  // first[c] = first row of F starting with c (row 0 is the sentinel)
+  uint32_t first[256] = {0};
+  for (uint32_t i = 0; i < n; i++)
+    first[bwt[i]]++;
+  uint32_t total = 1;
   for (int c = 0; c < 256; c++) {
-    if (countF[c] > 0) {
-      firstOcc[c] = total;
-      total += countF[c];
-    } else
-      firstOcc[c] = -1;
+    uint32_t k = first[c];
+    first[c] = total;
+    total += k;
   }
 
-  int* LF = malloc(len * sizeof(int));
-  for (int i = 0; i < len; i++)
-    LF[i] = firstOcc[(unsigned char)bwt[i]] + rankL[i];
+  // rows are 0..n; row primary_index holds the sentinel and is never mapped
+  uint32_t* LF = ws->lf;
+  for (uint32_t r = 0; r <= n; r++) {
+    if (r == primary_index)
+      continue;
+    unsigned char c = bwt[r - (r > primary_index)];
+    LF[r] = first[c]++;
+  }
 
-  char* decoded = malloc(len + 1);
-  int pos = original_index;
-  for (int i = len - 1; i >= 0; i--) {
-    decoded[i] = bwt[pos];
-    pos = LF[pos];
+  // a valid transform is one cycle that meets the sentinel row only at the
+  // end; corrupt input can reach it early
+  uint32_t row = 0;
+  for (uint32_t i = n; i-- > 0;) {
+    if (row == primary_index)
+      return -1;
+    out[i] = bwt[row - (row > primary_index)];
+    row = LF[row];
   }
-  decoded[len] = '\0';
+  return 0;
+}
 
-  free(F);
-  free(rankL);
-  free(LF);
+/* bwt_decode: allocating wrapper around bwt_decode_ws.  Returns a buffer
+   of n bytes from mem_alloc (free with mem_free), or NULL on failure.
+*/
+unsigned char* bwt_decode(const unsigned char* bwt,
+                          uint32_t n,
+                          uint32_t primary_index) {
+  struct bwt_workspace* ws = bwt_workspace_create();
+  unsigned char* decoded = mem_alloc(n ? n : 1);
+  if (!ws || !decoded ||
+      bwt_decode_ws(ws, bwt, n, primary_index, decoded) != 0) {
+    mem_free(decoded);
+    decoded = NULL;
+  }
+  bwt_workspace_free(ws);
   return decoded;
-}
\ No newline at end of file
+}
@@ -0,0 +1,484 @@
+// main_bwt_external.c
+// Disk-backed BWT construction for blocks larger than RAM.
+// The in-memory builder needs the block plus about 16 bytes per byte of
+// scratch; here the heap use is bounded by a caller-supplied budget and the
+// bulk data lives in scratch files.  The method is prefix doubling with
+// external sorts:
+//   round 0: every position i gets a key made of its first 7 bytes plus
+//            min(suffix length, 8), which orders suffixes by 7 bytes with
+//            "end of block" below every byte;
+//   round k: tuples (rank[i], rank[i + h], i) are formed by streaming the
+//            rank file with two cursors h apart, sorted externally, and the
+//            new rank of i is the position of its group's first tuple; the
+//            ranks are then sorted back into position order for the next
+//            round, with h doubling each time.
+// When every group is a single suffix, the sorted tuple stream is the
+// suffix array; each tuple carries the byte before its suffix, so that
+// stream is also the BWT.  The block itself is mapped read-only and only
+// ever scanned sequentially.  Positions are 64-bit, so a block is only
+// limited by what the decoder can invert (BWT_MAX_DECODE_BLOCK).  The
+// sentinel convention is the same as bwt_encode: n bytes are written and
+// *primary is the sentinel row.
+
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/* Smallest useful budget: a few pages of runs and merge buffers. */
+#define EXT_MIN_BUDGET (1u << 20)
+#define EXT_IO_RECORDS 4096
+/* Most runs merged at once; more are merged in several passes, so the open
+   files stay well under the descriptor limit. */
+#define EXT_MAX_FAN_IN 64
+
+/* Sort record for one suffix: keys first, then position and the byte in
+   front of the suffix packed as (pos << 8) | byte. */
+struct ext_tuple {
+  uint64_t k1;
+  uint64_t k2;
+  uint64_t pos_byte;
+};
+
+/* (position, new rank) pair used to bring ranks back to text order. */
+struct ext_pair {
+  uint64_t pos;
+  uint64_t rank;
+};
+
+struct ext_ctx {
+  const char* dir;
+  uint64_t budget;
+  unsigned next_file;
+};
+
+struct run_cursor {
+  FILE* f;
+  char path[512];
+  unsigned char* buf;
+  size_t cap;  // records
+  size_t len;
+  size_t at;
+};
+
+/* Create a read/write scratch file in dir, named after tag, idx and the
+   process ID; the name goes to path so the caller can remove it. */
+FILE* open_scratch_file(const char* dir,
+                        const char* tag,
+                        unsigned idx,
+                        char* path,
+                        size_t cap) {
+#ifdef _WIN32
+  snprintf(path, cap, "%s/tc%s-%u.tmp", dir, tag, idx);
+#else
+  snprintf(path, cap, "%s/tc%s-%ld-%u.tmp", dir, tag, (long)getpid(), idx);
+#endif
+  return fopen(path, "w+b");
+}
+
+static int cmp_tuple(const void* a, const void* b) {
+  const struct ext_tuple* x = a;
+  const struct ext_tuple* y = b;
+  if (x->k1 != y->k1)
+    return x->k1 < y->k1 ? -1 : 1;
+  if (x->k2 != y->k2)
+    return x->k2 < y->k2 ? -1 : 1;
+  return (x->pos_byte > y->pos_byte) - (x->pos_byte < y->pos_byte);
+}
+
+static int cmp_pair(const void* a, const void* b) {
+  uint64_t x = ((const struct ext_pair*)a)->pos;
+  uint64_t y = ((const struct ext_pair*)b)->pos;
+  return (x > y) - (x < y);
+}
+
+static int cursor_next(struct run_cursor* c, size_t rec) {
+  if (c->at < c->len)
+    return 0;
+  c->len = fread(c->buf, rec, c->cap, c->f);
+  c->at = 0;
+  return c->len ? 0 : 1;
+}
+
+static void heap_down(struct run_cursor** heap,
+                      size_t size,
+                      size_t i,
+                      size_t rec,
+                      int (*cmp)(const void*, const void*)) {
+  for (;;) {
+    size_t l = 2 * i + 1, r = l + 1, m = i;
+    if (l < size && cmp(heap[l]->buf + heap[l]->at * rec,
+                        heap[m]->buf + heap[m]->at * rec) < 0)
+      m = l;
+    if (r < size && cmp(heap[r]->buf + heap[r]->at * rec,
+                        heap[m]->buf + heap[m]->at * rec) < 0)
+      m = r;
+    if (m == i)
+      return;
+    struct run_cursor* t = heap[i];
+    heap[i] = heap[m];
+    heap[m] = t;
+    i = m;
+  }
+}
+
+/* k-way merge of the k sorted run files named in runs into out, giving
+   each run an equal share of half of ctx->budget as its read buffer.  The
+   run files are closed and removed (and their paths cleared) whether or not
+   the merge succeeds.  Returns 0 on success. */
+static int merge_runs(struct ext_ctx* ctx,
+                      struct run_cursor* runs,
+                      size_t k,
+                      size_t rec,
+                      int (*cmp)(const void*, const void*),
+                      FILE* out) {
+  struct run_cursor** heap = calloc(k, sizeof(*heap));
+  size_t cap = (size_t)(ctx->budget / 2 / k / rec);
+  if (cap < EXT_IO_RECORDS)
+    cap = EXT_IO_RECORDS;
+  int ok = heap != NULL;
+  size_t heap_size = 0;
+  for (size_t r = 0; ok && r < k; r++) {
+    runs[r].f = fopen(runs[r].path, "rb");
+    runs[r].cap = cap;
+    runs[r].len = runs[r].at = 0;
+    runs[r].buf = malloc(cap * rec);
+    if (!runs[r].f || !runs[r].buf) {
+      ok = 0;
+      break;
+    }
+    if (cursor_next(&runs[r], rec) == 0)
+      heap[heap_size++] = &runs[r];
+  }
+  for (size_t i = heap_size; ok && i-- > 0;)
+    heap_down(heap, heap_size, i, rec, cmp);
+  while (ok && heap_size > 0) {
+    struct run_cursor* c = heap[0];
+    if (fwrite(c->buf + c->at * rec, rec, 1, out) != 1) {
+      ok = 0;
+      break;
+    }
+    c->at++;
+    if (cursor_next(c, rec) != 0)
+      heap[0] = heap[--heap_size];
+    heap_down(heap, heap_size, 0, rec, cmp);
+  }
+
+  for (size_t r = 0; r < k; r++) {
+    if (runs[r].f)
+      fclose(runs[r].f);
+    runs[r].f = NULL;
+    free(runs[r].buf);
+    runs[r].buf = NULL;
+    remove(runs[r].path);
+    runs[r].path[0] = '\0';
+  }
+  free(heap);
+  return ok ? 0 : -1;
+}
+
+/* Sort the count records of size rec in `in` (positioned at the start)
+   into `out`, using at most about ctx->budget bytes of heap: sorted runs go
+   to scratch files and are then merged, at most fan-in at a time, where
+   fan-in runs of EXT_IO_RECORDS-record buffers fit in half the budget
+   (capped at EXT_MAX_FAN_IN).  While there are more runs than that, groups
+   of them are merged into longer intermediate runs.  Returns 0 on
+   success. */
+static int ext_sort(struct ext_ctx* ctx,
+                    FILE* in,
+                    uint64_t count,
+                    size_t rec,
+                    int (*cmp)(const void*, const void*),
+                    FILE* out) {
+  uint64_t run_records = ctx->budget / rec;
+  if (run_records > count)
+    run_records = count ? count : 1;
+  unsigned char* buf = malloc((size_t)run_records * rec);
+  if (!buf)
+    return -1;
+
+  // one run: sort in memory and write straight to out
+  if (run_records >= count) {
+    int ok = fread(buf, rec, (size_t)count, in) == count;
+    if (ok) {
+      qsort(buf, (size_t)count, rec, cmp);
+      ok = fwrite(buf, rec, (size_t)count, out) == count;
+    }
+    free(buf);
+    return ok ? 0 : -1;
+  }
+
+  // --- form sorted runs; each file is closed until its merge ---
+  uint64_t nruns = (count + run_records - 1) / run_records;
+  struct run_cursor* runs = calloc((size_t)nruns, sizeof(*runs));
+  int ok = runs != NULL;
+  for (uint64_t r = 0; ok && r < nruns; r++) {
+    size_t cnt = (size_t)(count - r * run_records < run_records
+                              ? count - r * run_records
+                              : run_records);
+    FILE* f = open_scratch_file(ctx->dir, "run", ctx->next_file++,
+                                runs[r].path, sizeof(runs[r].path));
+    if (!f || fread(buf, rec, cnt, in) != cnt)
+      ok = 0;
+    if (ok) {
+      qsort(buf, cnt, rec, cmp);
+      ok = fwrite(buf, rec, cnt, f) == cnt;
+    }
+    if (f && fclose(f) != 0)
+      ok = 0;
+  }
+  free(buf);
+
+  // --- merge passes: groups of fan_in runs into intermediate runs ---
+  uint64_t fan_in = ctx->budget / 2 / ((uint64_t)EXT_IO_RECORDS * rec);
+  if (fan_in > EXT_MAX_FAN_IN)
+    fan_in = EXT_MAX_FAN_IN;
+  if (fan_in < 2)
+    fan_in = 2;
+  uint64_t all_runs = nruns;
+  while (ok && nruns > fan_in) {
+    uint64_t next = 0;
+    for (uint64_t g = 0; ok && g < nruns; g += fan_in) {
+      size_t k = (size_t)(nruns - g < fan_in ? nruns - g : fan_in);
+      struct run_cursor merged;
+      memset(&merged, 0, sizeof(merged));
+      if (k == 1) {
+        merged = runs[g];
+        runs[g].path[0] = '\0';
+      } else {
+        FILE* f = open_scratch_file(ctx->dir, "run", ctx->next_file++,
+                                    merged.path, sizeof(merged.path));
+        ok = f && merge_runs(ctx, runs + g, k, rec, cmp, f) == 0;
+        if (f && fclose(f) != 0)
+          ok = 0;
+      }
+      runs[next++] = merged;  // next <= g: that slot is already merged
+    }
+    nruns = next;
+  }
+  if (ok)
+    ok = merge_runs(ctx, runs, (size_t)nruns, rec, cmp, out) == 0;
+
+  for (uint64_t r = 0; runs && r < all_runs; r++)
+    if (runs[r].path[0])
+      remove(runs[r].path);
+  free(runs);
+  return ok ? 0 : -1;
+}
+
+/* Round-0 key: 7 bytes big endian (zero padded) and min(length, 8). */
+static uint64_t initial_key(const unsigned char* text, uint64_t n, uint64_t i) {
+  uint64_t k = 0;
+  for (int j = 0; j < 7; j++) {
+    k <<= 8;
+    if (i + (uint64_t)j < n)
+      k |= text[i + (uint64_t)j];
+  }
+  uint64_t len = n - i;
+  return (k << 8) | (len < 8 ? len : 8);
+}
+
+/* Build the BWT of bytes [offset, offset + n) of input_path, writing n bytes
+   to out.  Heap use stays within about memory_budget bytes; scratch files
+   go to scratch_dir.  Returns 0 on success. */
+int bwt_encode_external(const char* input_path,
+                        uint64_t offset,
+                        uint64_t n,
+                        FILE* out,
+                        uint64_t* primary,
+                        uint64_t memory_budget,
+                        const char* scratch_dir) {
+#ifdef _WIN32
+  (void)input_path;
+  (void)offset;
+  (void)n;
+  (void)out;
+  (void)primary;
+  (void)memory_budget;
+  (void)scratch_dir;
+  fprintf(stderr, "External BWT needs mmap, which this build lacks\n");
+  return -1;
+#else
+  if (n == 0) {
+    *primary = 0;
+    return 0;
+  }
+  struct ext_ctx ctx;
+  ctx.dir = scratch_dir ? scratch_dir : ".";
+  ctx.budget = memory_budget < EXT_MIN_BUDGET ? EXT_MIN_BUDGET : memory_budget;
+  ctx.next_file = 0;
+
+  // --- map the block (mmap offsets must be page aligned) ---
+  FILE* in = fopen(input_path, "rb");
+  if (!in)
+    return -1;
+  long page = sysconf(_SC_PAGESIZE);
+  uint64_t map_off = offset - offset % (uint64_t)page;
+  size_t map_len = (size_t)(n + (offset - map_off));
+  void* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fileno(in),
+                   (off_t)map_off);
+  fclose(in);
+  if (map == MAP_FAILED)
+    return -1;
+  const unsigned char* text = (const unsigned char*)map + (offset - map_off);
+
+  char rank_path[512], tuple_path[512], sorted_path[512], pair_path[512],
+      bwt_path[512];
+  FILE* rank_f = open_scratch_file(ctx.dir, "rank", 0, rank_path, 512);
+  FILE* tuple_f = open_scratch_file(ctx.dir, "tuple", 0, tuple_path, 512);
+  FILE* sorted_f = open_scratch_file(ctx.dir, "sorted", 0, sorted_path, 512);
+  FILE* pair_f = open_scratch_file(ctx.dir, "pair", 0, pair_path, 512);
+  FILE* bwt_f = open_scratch_file(ctx.dir, "lastcol", 0, bwt_path, 512);
+  FILE* ahead_f = NULL;  // second cursor into the rank file
+  struct ext_tuple* tb = malloc(EXT_IO_RECORDS * sizeof(*tb));
+  struct ext_pair* pb = malloc(EXT_IO_RECORDS * sizeof(*pb));
+  uint64_t* rb = malloc(EXT_IO_RECORDS * sizeof(*rb));
+  uint64_t* ab = malloc(EXT_IO_RECORDS * sizeof(*ab));
+  int ok = rank_f && tuple_f && sorted_f && pair_f && bwt_f && tb && pb &&
+           rb && ab;
+  if (!ok)
+    fprintf(stderr, "Cannot set up scratch files in %s\n", ctx.dir);
+
+  uint64_t h = 0;  // 0: round 0, keys come from the text
+  int done = 0;
+  while (ok && !done) {
+    // --- form tuples (rank[i], rank[i + h], i, byte before i) ---
+    if (fseek(tuple_f, 0, SEEK_SET) != 0 ||
+        (h > 0 && (fseek(rank_f, 0, SEEK_SET) != 0 ||
+                   !(ahead_f = fopen(rank_path, "rb")) ||
+                   (h < n && fseeko(ahead_f, (off_t)(h * sizeof(uint64_t)),
+                                    SEEK_SET) != 0)))) {
+      ok = 0;
+      break;
+    }
+    for (uint64_t i = 0; ok && i < n; i += EXT_IO_RECORDS) {
+      size_t cnt = (size_t)(n - i < EXT_IO_RECORDS ? n - i : EXT_IO_RECORDS);
+      if (h > 0) {
+        size_t ahead = h < n - i ? (size_t)(n - i - h < cnt ? n - i - h : cnt)
+                                 : 0;
+        if (fread(rb, sizeof(*rb), cnt, rank_f) != cnt ||
+            fread(ab, sizeof(*ab), ahead, ahead_f) != ahead) {
+          ok = 0;
+          break;
+        }
+        for (size_t j = ahead; j < cnt; j++)
+          ab[j] = 0;  // past the end sorts first
+      }
+      for (size_t j = 0; j < cnt; j++) {
+        uint64_t p = i + j;
+        tb[j].k1 = h ? rb[j] : initial_key(text, n, p);
+        tb[j].k2 = h ? ab[j] : 0;
+        tb[j].pos_byte = (p << 8) | (p ? text[p - 1] : 0);
+      }
+      ok = fwrite(tb, sizeof(*tb), cnt, tuple_f) == cnt;
+    }
+    if (ahead_f) {
+      fclose(ahead_f);
+      ahead_f = NULL;
+    }
+
+    // --- sort tuples by (rank[i], rank[i + h]) ---
+    if (!ok || fflush(tuple_f) != 0 || fseek(tuple_f, 0, SEEK_SET) != 0 ||
+        fseek(sorted_f, 0, SEEK_SET) != 0 ||
+        ext_sort(&ctx, tuple_f, n, sizeof(struct ext_tuple), cmp_tuple,
+                 sorted_f) != 0 ||
+        fflush(sorted_f) != 0 || fseek(sorted_f, 0, SEEK_SET) != 0 ||
+        fseek(pair_f, 0, SEEK_SET) != 0 || fseek(bwt_f, 0, SEEK_SET) != 0) {
+      ok = 0;
+      break;
+    }
+
+    // --- new rank = 1-based index of the group's first tuple; the same
+    //     pass writes the last column in case this round is the final one
+    uint64_t groups = 0, group_rank = 0, row = 0;
+    uint64_t prev_k1 = 0, prev_k2 = 0;
+    if (fputc(text[n - 1], bwt_f) == EOF)  // sentinel row
+      ok = 0;
+    while (ok && row < n) {
+      size_t cnt = fread(tb, sizeof(*tb), EXT_IO_RECORDS, sorted_f);
+      if (cnt == 0) {
+        ok = 0;
+        break;
+      }
+      for (size_t j = 0; j < cnt; j++, row++) {
+        if (row == 0 || tb[j].k1 != prev_k1 || tb[j].k2 != prev_k2) {
+          groups++;
+          group_rank = row + 1;
+          prev_k1 = tb[j].k1;
+          prev_k2 = tb[j].k2;
+        }
+        uint64_t p = tb[j].pos_byte >> 8;
+        pb[j].pos = p;
+        pb[j].rank = group_rank;
+        if (p == 0)
+          *primary = row + 1;  // sentinel sits in this row; not stored
+        else if (putc((int)(tb[j].pos_byte & 0xFF), bwt_f) == EOF)
+          ok = 0;
+      }
+      if (ok && fwrite(pb, sizeof(*pb), cnt, pair_f) != cnt)
+        ok = 0;
+    }
+    if (!ok)
+      break;
+    if (groups == n) {
+      done = 1;
+      break;
+    }
+
+    // --- ranks back into position order for the next round ---
+    if (fflush(pair_f) != 0 || fseek(pair_f, 0, SEEK_SET) != 0 ||
+        fseek(tuple_f, 0, SEEK_SET) != 0 ||
+        ext_sort(&ctx, pair_f, n, sizeof(struct ext_pair), cmp_pair,
+                 tuple_f) != 0 ||
+        fflush(tuple_f) != 0 || fseek(tuple_f, 0, SEEK_SET) != 0 ||
+        fseek(rank_f, 0, SEEK_SET) != 0) {
+      ok = 0;
+      break;
+    }
+    for (uint64_t i = 0; ok && i < n; i += EXT_IO_RECORDS) {
+      size_t cnt = (size_t)(n - i < EXT_IO_RECORDS ? n - i : EXT_IO_RECORDS);
+      if (fread(pb, sizeof(*pb), cnt, tuple_f) != cnt) {
+        ok = 0;
+        break;
+      }
+      for (size_t j = 0; j < cnt; j++)
+        rb[j] = pb[j].rank;
+      ok = fwrite(rb, sizeof(*rb), cnt, rank_f) == cnt;
+    }
+    if (ok && fflush(rank_f) != 0)
+      ok = 0;
+    h = h ? h * 2 : 7;  // round 0 ordered suffixes by 7 bytes
+  }
+
+  // --- copy the finished last column to the caller ---
+  if (ok && (fflush(bwt_f) != 0 || fseek(bwt_f, 0, SEEK_SET) != 0))
+    ok = 0;
+  size_t got;
+  while (ok && (got = fread(tb, 1, EXT_IO_RECORDS * sizeof(*tb), bwt_f)) > 0)
+    ok = fwrite(tb, 1, got, out) == got;
+
+  FILE* files[5] = {rank_f, tuple_f, sorted_f, pair_f, bwt_f};
+  const char* paths[5] = {rank_path, tuple_path, sorted_path, pair_path,
+                          bwt_path};
+  for (int i = 0; i < 5; i++) {
+    if (files[i]) {
+      fclose(files[i]);
+      remove(paths[i]);
+    }
+  }
+  free(tb);
+  free(pb);
+  free(rb);
+  free(ab);
+  munmap(map, map_len);
+  return ok ? 0 : -1;
+#endif
+}
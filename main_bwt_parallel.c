@@ -0,0 +1,340 @@
+// main_bwt_parallel.c
+// Multithreaded suffix sorting for one large block, so a single huge BWT
+// block can use every core (block-level parallelism gives nothing there).
+//
+// 1) Parallel radix pass: every suffix is bucketed by its first two bytes
+//    (with "end of block" below every byte).  Threads build private
+//    histograms over slices of the text, then scatter stably into sa.
+// 2) Per-bucket sorting by prefix doubling: a group of suffixes sharing an
+//    h-byte prefix is sorted by the rank of the suffix h bytes further on,
+//    which orders it by 2h bytes and splits it into smaller groups.  Groups
+//    are independent, so each round hands them out to threads balanced by
+//    size.  Ranks are read from `rank` and written to `next`, so threads
+//    never race; only unsorted groups are touched again.
+// A rank is the sa index of the first member of the suffix's group, which
+// keeps ranks consistent with the final order.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main_memory.h"
+
+#define NBUCKETS (256 * 257)
+
+/* Groups at least this large are radix sorted instead of qsorted; a
+   degenerate block (all one byte) is otherwise one huge group per round. */
+#define RADIX_MIN_GROUP 1024
+
+struct group {
+  int start;
+  int len;
+};
+
+struct sort_key {
+  int key;
+  int idx;
+};
+
+struct par_state {
+  const unsigned char* s;
+  int n;
+  int nthreads;
+  int* sa;
+  int* rank;
+  int* next;
+  int* hist;  // nthreads x NBUCKETS
+  int* bstart;  // first sa index of every bucket
+  int h;
+  struct group* groups;  // unsorted groups of the current round
+  int ngroups;
+  int failed;
+};
+
+struct par_thread {
+  struct par_state* st;
+  int id;
+  int gbegin, gend;  // slice of st->groups for this round
+  struct group* out;  // groups this thread found still unsorted
+  int nout, out_cap;
+  struct sort_key* keys;
+  struct sort_key* keys_tmp;
+  int keys_cap;
+};
+
+static int bucket_of(const unsigned char* s, int n, int i) {
+  return s[i] * 257 + (i + 1 < n ? s[i + 1] + 1 : 0);
+}
+
+static void* radix_count(void* arg) {
+  struct par_thread* t = arg;
+  struct par_state* st = t->st;
+  int lo = (int)((int64_t)st->n * t->id / st->nthreads);
+  int hi = (int)((int64_t)st->n * (t->id + 1) / st->nthreads);
+  int* hist = st->hist + (size_t)t->id * NBUCKETS;
+  for (int i = lo; i < hi; i++)
+    hist[bucket_of(st->s, st->n, i)]++;
+  return NULL;
+}
+
+static void* radix_scatter(void* arg) {
+  struct par_thread* t = arg;
+  struct par_state* st = t->st;
+  int lo = (int)((int64_t)st->n * t->id / st->nthreads);
+  int hi = (int)((int64_t)st->n * (t->id + 1) / st->nthreads);
+  int* pos = st->hist + (size_t)t->id * NBUCKETS;  // now write offsets
+  for (int i = lo; i < hi; i++)
+    st->sa[pos[bucket_of(st->s, st->n, i)]++] = i;
+  return NULL;
+}
+
+static void* radix_rank(void* arg) {
+  struct par_thread* t = arg;
+  struct par_state* st = t->st;
+  int lo = (int)((int64_t)st->n * t->id / st->nthreads);
+  int hi = (int)((int64_t)st->n * (t->id + 1) / st->nthreads);
+  for (int i = lo; i < hi; i++)
+    st->rank[i] = st->bstart[bucket_of(st->s, st->n, i)];
+  return NULL;
+}
+
+static int cmp_key(const void* a, const void* b) {
+  int x = ((const struct sort_key*)a)->key;
+  int y = ((const struct sort_key*)b)->key;
+  return (x > y) - (x < y);
+}
+
+/* Two-pass LSD radix sort on (key + 1), which fits in 32 bits. */
+static void radix_sort_keys(struct sort_key* keys,
+                            struct sort_key* tmp,
+                            int len) {
+  static const int shifts[2] = {0, 16};
+  for (int p = 0; p < 2; p++) {
+    int cnt[65536 + 1];
+    memset(cnt, 0, sizeof(cnt));
+    for (int j = 0; j < len; j++)
+      cnt[(((uint32_t)keys[j].key + 1u) >> shifts[p] & 0xFFFF) + 1]++;
+    for (int d = 0; d < 65536; d++)
+      cnt[d + 1] += cnt[d];
+    for (int j = 0; j < len; j++)
+      tmp[cnt[((uint32_t)keys[j].key + 1u) >> shifts[p] & 0xFFFF]++] = keys[j];
+    memcpy(keys, tmp, (size_t)len * sizeof(*keys));
+  }
+}
+
+static int push_group(struct par_thread* t, int start, int len) {
+  if (t->nout == t->out_cap) {
+    int cap = t->out_cap ? t->out_cap * 2 : 256;
+    struct group* g = mem_realloc(t->out, (size_t)cap * sizeof(*g));
+    if (!g)
+      return -1;
+    t->out = g;
+    t->out_cap = cap;
+  }
+  t->out[t->nout].start = start;
+  t->out[t->nout].len = len;
+  t->nout++;
+  return 0;
+}
+
+/* Sort this thread's groups by rank[i + h]; new ranks go to next. */
+static void* refine_groups(void* arg) {
+  struct par_thread* t = arg;
+  struct par_state* st = t->st;
+  int n = st->n, h = st->h;
+  t->nout = 0;
+  for (int g = t->gbegin; g < t->gend; g++) {
+    int start = st->groups[g].start, len = st->groups[g].len;
+    if (len > t->keys_cap) {
+      struct sort_key* k = mem_realloc(t->keys, (size_t)len * sizeof(*k));
+      if (k)
+        t->keys = k;
+      struct sort_key* k2 =
+          k ? mem_realloc(t->keys_tmp, (size_t)len * sizeof(*k2)) : NULL;
+      if (!k2) {
+        st->failed = 1;
+        return NULL;
+      }
+      t->keys_tmp = k2;
+      t->keys_cap = len;
+    }
+    for (int j = 0; j < len; j++) {
+      int idx = st->sa[start + j];
+      t->keys[j].idx = idx;
+      t->keys[j].key = h < n - idx ? st->rank[idx + h] : -1;
+    }
+    if (len >= RADIX_MIN_GROUP)
+      radix_sort_keys(t->keys, t->keys_tmp, len);
+    else
+      qsort(t->keys, (size_t)len, sizeof(*t->keys), cmp_key);
+
+    int head = 0;
+    for (int j = 0; j < len; j++) {
+      if (j > 0 && t->keys[j].key != t->keys[j - 1].key) {
+        if (j - head > 1 && push_group(t, start + head, j - head)) {
+          st->failed = 1;
+          return NULL;
+        }
+        head = j;
+      }
+      st->sa[start + j] = t->keys[j].idx;
+      st->next[t->keys[j].idx] = start + head;
+    }
+    if (len - head > 1 && push_group(t, start + head, len - head)) {
+      st->failed = 1;
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+/* Publish the ranks computed by refine_groups for this thread's groups. */
+static void* publish_ranks(void* arg) {
+  struct par_thread* t = arg;
+  struct par_state* st = t->st;
+  for (int g = t->gbegin; g < t->gend; g++) {
+    int end = st->groups[g].start + st->groups[g].len;
+    for (int j = st->groups[g].start; j < end; j++)
+      st->rank[st->sa[j]] = st->next[st->sa[j]];
+  }
+  return NULL;
+}
+
+static void run_all(struct par_thread* th,
+                    pthread_t* tid,
+                    int nthreads,
+                    void* (*fn)(void*)) {
+  int started = 0;
+  for (int i = 1; i < nthreads; i++, started++)
+    if (pthread_create(&tid[i], NULL, fn, &th[i]) != 0)
+      break;
+  fn(&th[0]);
+  for (int i = 1; i <= started; i++)
+    pthread_join(tid[i], NULL);
+  // any thread that failed to start does its share here
+  for (int i = started + 1; i < nthreads; i++)
+    fn(&th[i]);
+}
+
+/* Give each thread a contiguous run of groups with about equal members. */
+static void split_groups(struct par_state* st, struct par_thread* th) {
+  int64_t total = 0;
+  for (int g = 0; g < st->ngroups; g++)
+    total += st->groups[g].len;
+  int g = 0;
+  int64_t acc = 0;
+  for (int t = 0; t < st->nthreads; t++) {
+    int64_t target = total * (t + 1) / st->nthreads;
+    th[t].gbegin = g;
+    while (g < st->ngroups && (acc < target || t == st->nthreads - 1))
+      acc += st->groups[g++].len;
+    th[t].gend = g;
+  }
+}
+
+/* Build the suffix array of s[0..n) into sa using nthreads threads.
+   Same order as the sequential builder (shorter suffix first on a tie).
+   Returns 0 on success. */
+int build_suffix_array_parallel(const unsigned char* s,
+                                int n,
+                                int* sa,
+                                int nthreads) {
+  if (n <= 0)
+    return 0;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  struct par_state st;
+  memset(&st, 0, sizeof(st));
+  st.s = s;
+  st.n = n;
+  st.nthreads = nthreads;
+  st.sa = sa;
+  st.rank = mem_alloc((size_t)n * sizeof(int));
+  st.next = mem_alloc((size_t)n * sizeof(int));
+  st.hist = calloc((size_t)nthreads * NBUCKETS, sizeof(int));
+  st.bstart = malloc(NBUCKETS * sizeof(int));
+  struct par_thread* th = calloc((size_t)nthreads, sizeof(*th));
+  pthread_t* tid = calloc((size_t)nthreads, sizeof(*tid));
+  int ok = st.rank && st.next && st.hist && st.bstart && th && tid;
+
+  if (ok) {
+    for (int i = 0; i < nthreads; i++) {
+      th[i].st = &st;
+      th[i].id = i;
+    }
+
+    // --- 1) two-byte buckets: histogram, exclusive scan, scatter ---
+    run_all(th, tid, nthreads, radix_count);
+    int sum = 0;
+    for (int b = 0; b < NBUCKETS && ok; b++) {
+      st.bstart[b] = sum;
+      for (int t = 0; t < nthreads; t++) {
+        int c = st.hist[(size_t)t * NBUCKETS + b];
+        st.hist[(size_t)t * NBUCKETS + b] = sum;
+        sum += c;
+      }
+      // a bucket with more than one suffix still needs sorting
+      if (sum - st.bstart[b] > 1 &&
+          push_group(&th[0], st.bstart[b], sum - st.bstart[b]))
+        ok = 0;
+    }
+  }
+  if (ok) {
+    run_all(th, tid, nthreads, radix_scatter);
+    run_all(th, tid, nthreads, radix_rank);
+  }
+
+  // --- 2) refine unsorted groups, doubling h each round ---
+  st.h = 2;
+  while (ok) {
+    // gather every thread's leftover groups into this round's work list
+    int total = 0;
+    for (int t = 0; t < nthreads; t++)
+      total += th[t].nout;
+    if (total == 0)
+      break;
+    struct group* groups = mem_alloc((size_t)total * sizeof(*groups));
+    if (!groups) {
+      ok = 0;
+      break;
+    }
+    int k = 0;
+    for (int t = 0; t < nthreads; t++) {
+      if (th[t].nout)  // out is NULL for a thread that kept no groups
+        memcpy(groups + k, th[t].out, (size_t)th[t].nout * sizeof(*groups));
+      k += th[t].nout;
+      th[t].nout = 0;
+    }
+    mem_free(st.groups);
+    st.groups = groups;
+    st.ngroups = total;
+
+    split_groups(&st, th);
+    run_all(th, tid, nthreads, refine_groups);
+    if (st.failed) {
+      ok = 0;
+      break;
+    }
+    run_all(th, tid, nthreads, publish_ranks);
+    // suffixes are distinct, so groups are gone before h reaches n
+    st.h <<= 1;
+  }
+
+  for (int i = 0; th && i < nthreads; i++) {
+    mem_free(th[i].out);
+    mem_free(th[i].keys);
+    mem_free(th[i].keys_tmp);
+  }
+  free(th);
+  free(tid);
+  mem_free(st.groups);
+  free(st.hist);
+  free(st.bstart);
+  mem_free(st.rank);
+  mem_free(st.next);
+  return ok ? 0 : -1;
+}
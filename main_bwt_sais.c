@@ -0,0 +1,206 @@
+// main_bwt_sais.c
+// Low-memory BWT construction by induced sorting (SA-IS, Nong/Zhang/Chan).
+// bwt_encode_ws needs the block plus about 16 bytes per byte of scratch for
+// prefix doubling.  This builder needs the block plus one 32-bit array
+// (about 5n bytes, plus n/8 bytes of type bits): the reduced problem of
+// each recursion level lives inside the suffix array, and its bucket
+// counters borrow the free middle of that array when they fit.  The BWT is
+// then written over the input block, so no second n-byte buffer exists.
+// Running time is linear whatever the data, so long repeats cost no more
+// than text.  The output (BWT bytes and sentinel row) is identical to
+// bwt_encode's.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main_memory.h"
+
+/* Keep in step with BWT_MAX_BLOCK in main_bwt.c. */
+#define SAIS_MAX_BLOCK (1u << 30)
+
+/* Type bits: 1 = S-type (suffix smaller than its right neighbour). */
+#define TGET(t, i) (((t)[(i) >> 3] >> ((i)&7)) & 1)
+#define TSET(t, i, v)                                               \
+  ((t)[(i) >> 3] = (unsigned char)((v) ? (t)[(i) >> 3] | (1 << ((i)&7)) \
+                                       : (t)[(i) >> 3] & ~(1 << ((i)&7))))
+#define IS_LMS(t, i) ((i) > 0 && TGET(t, i) && !TGET(t, (i)-1))
+
+/* Symbol i of a level's string: bytes at the top level, ints below. */
+static inline int sym(const void* s, int cs, int i) {
+  return cs == 1 ? ((const unsigned char*)s)[i] : ((const int*)s)[i];
+}
+
+/* Bucket starts (end = 0) or one-past-ends (end = 1) for k symbols. */
+static void get_buckets(const void* s, int cs, int n, int* bkt, int k,
+                        int end) {
+  memset(bkt, 0, (size_t)k * sizeof(int));
+  for (int i = 0; i < n; i++)
+    bkt[sym(s, cs, i)]++;
+  int sum = 0;
+  for (int i = 0; i < k; i++) {
+    sum += bkt[i];
+    bkt[i] = end ? sum : sum - bkt[i];
+  }
+}
+
+/* L-type pass.  The virtual sentinel is the smallest suffix, so its left
+   neighbour n - 1 (always L-type) is placed first. */
+static void induce_l(const unsigned char* t, int* sa, const void* s, int cs,
+                     int* bkt, int n, int k) {
+  get_buckets(s, cs, n, bkt, k, 0);
+  sa[bkt[sym(s, cs, n - 1)]++] = n - 1;
+  for (int i = 0; i < n; i++) {
+    int j = sa[i] - 1;
+    if (sa[i] > 0 && !TGET(t, j))
+      sa[bkt[sym(s, cs, j)]++] = j;
+  }
+}
+
+static void induce_s(const unsigned char* t, int* sa, const void* s, int cs,
+                     int* bkt, int n, int k) {
+  get_buckets(s, cs, n, bkt, k, 1);
+  for (int i = n - 1; i >= 0; i--) {
+    int j = sa[i] - 1;
+    if (sa[i] > 0 && TGET(t, j))
+      sa[--bkt[sym(s, cs, j)]] = j;
+  }
+}
+
+/* Suffix array of s[0..n) over symbols 0..k-1 (cs = bytes per symbol),
+   with a virtual end sentinel below every symbol.  bkt, if non-NULL, is
+   scratch for k counters.  Returns 0 on success. */
+static int sais(const void* s, int cs, int* sa, int n, int k, int* bkt) {
+  unsigned char* t = mem_calloc((size_t)n / 8 + 1, 1);
+  int* own_bkt = bkt ? NULL : mem_alloc((size_t)k * sizeof(int));
+  if (!t || (!bkt && !own_bkt)) {
+    mem_free(t);
+    mem_free(own_bkt);
+    return -1;
+  }
+  if (!bkt)
+    bkt = own_bkt;
+
+  // --- classify: the last symbol is followed by the sentinel, so L ---
+  TSET(t, n - 1, 0);
+  for (int i = n - 2; i >= 0; i--) {
+    int a = sym(s, cs, i), b = sym(s, cs, i + 1);
+    TSET(t, i, a < b || (a == b && TGET(t, i + 1)));
+  }
+
+  // --- stage 1: sort the LMS substrings ---
+  get_buckets(s, cs, n, bkt, k, 1);
+  for (int i = 0; i < n; i++)
+    sa[i] = -1;
+  for (int i = 1; i < n; i++)
+    if (IS_LMS(t, i))
+      sa[--bkt[sym(s, cs, i)]] = i;
+  induce_l(t, sa, s, cs, bkt, n, k);
+  induce_s(t, sa, s, cs, bkt, n, k);
+
+  // compact the sorted LMS positions into sa[0..n1)
+  int n1 = 0;
+  for (int i = 0; i < n; i++)
+    if (IS_LMS(t, sa[i]))
+      sa[n1++] = sa[i];
+
+  // name them; LMS positions are at least two apart, so pos / 2 is a
+  // collision-free slot in sa[n1..n)
+  for (int i = n1; i < n; i++)
+    sa[i] = -1;
+  int name = 0, prev = -1;
+  for (int i = 0; i < n1; i++) {
+    int pos = sa[i], diff = 0;
+    for (int d = 0;; d++) {
+      if (prev == -1 || pos + d == n || prev + d == n ||
+          sym(s, cs, pos + d) != sym(s, cs, prev + d) ||
+          TGET(t, pos + d) != TGET(t, prev + d)) {
+        diff = 1;
+        break;
+      }
+      if (d > 0 && (IS_LMS(t, pos + d) || IS_LMS(t, prev + d)))
+        break;
+    }
+    if (diff) {
+      name++;
+      prev = pos;
+    }
+    sa[n1 + pos / 2] = name - 1;
+  }
+  for (int i = n - 1, j = n - 1; i >= n1; i--)
+    if (sa[i] >= 0)
+      sa[j--] = sa[i];
+
+  // --- stage 2: order the reduced string, recursing if names repeat ---
+  int* s1 = sa + n - n1;
+  int ok = 1;
+  if (name < n1) {
+    // the child's counters fit in the gap between sa1 and s1 when small
+    int* child_bkt = n - 2 * n1 >= name ? sa + n1 : NULL;
+    ok = sais(s1, sizeof(int), sa, n1, name, child_bkt) == 0;
+  } else {
+    for (int i = 0; i < n1; i++)
+      sa[s1[i]] = i;
+  }
+
+  // --- stage 3: induce the full order from the sorted LMS suffixes ---
+  if (ok) {
+    for (int i = 1, j = 0; i < n; i++)
+      if (IS_LMS(t, i))
+        s1[j++] = i;
+    for (int i = 0; i < n1; i++)
+      sa[i] = s1[sa[i]];
+    for (int i = n1; i < n; i++)
+      sa[i] = -1;
+    get_buckets(s, cs, n, bkt, k, 1);
+    for (int i = n1 - 1; i >= 0; i--) {
+      int j = sa[i];
+      sa[i] = -1;
+      sa[--bkt[sym(s, cs, j)]] = j;
+    }
+    induce_l(t, sa, s, cs, bkt, n, k);
+    induce_s(t, sa, s, cs, bkt, n, k);
+  }
+
+  mem_free(t);
+  mem_free(own_bkt);
+  return ok ? 0 : -1;
+}
+
+/* bwt_encode_inplace: replace the n bytes of buf with their BWT.  Same
+   sentinel convention and output as bwt_encode: *primary_index is the row
+   (1..n) where the unstored sentinel sits.  Peak memory is buf plus 4n
+   bytes.  Returns 0 on success; buf is unchanged on failure. */
+int bwt_encode_inplace(unsigned char* buf, uint32_t n,
+                       uint32_t* primary_index) {
+  if (!buf || n > SAIS_MAX_BLOCK)
+    return -1;
+  if (n == 0) {
+    *primary_index = 0;
+    return 0;
+  }
+  int* sa = mem_alloc((size_t)n * sizeof(int));
+  int bkt[256];
+  if (!sa || sais(buf, 1, sa, (int)n, 256, bkt) != 0) {
+    mem_free(sa);
+    return -1;
+  }
+
+  // the suffix array slots double as the last column, so buf is only
+  // written once every byte of it has been read
+  unsigned char last = buf[n - 1];
+  for (uint32_t i = 0; i < n; i++)
+    sa[i] = sa[i] == 0 ? -1 : buf[sa[i] - 1];
+  uint32_t primary = 0, o = 0;
+  buf[o++] = last;  // row 0 is the sentinel suffix
+  for (uint32_t i = 0; i < n; i++) {
+    if (sa[i] < 0)
+      primary = i + 1;  // sentinel sits in this row; not stored
+    else
+      buf[o++] = (unsigned char)sa[i];
+  }
+  mem_free(sa);
+  *primary_index = primary;
+  return 0;
+}
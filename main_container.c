@@ -0,0 +1,207 @@
+// main_container.c
+// Reading and writing of the block index (output.bin.meta).
+// Layout (native endian, like the rest of the formats in this project):
+//   char     magic[4]        "TCMF"
+//   uint32_t version
+//   uint64_t original_len
+//   uint32_t block_size
+//   uint32_t stream_crc     CRC32C of the whole input (0 before version 4)
+//   uint64_t nblocks
+//   nblocks x { uint64_t offset, comp_len, raw_len, primary, sym_len,
+//               flags, checksum }
+// Older indexes are still read: version 2 has no flags, version 3 no
+// checksum (both read as 0).  Version 5 only adds BLOCK_FLAG_ALPHA,
+// version 6 BLOCK_FLAG_HUF4 and version 7 BLOCK_FLAG_LZ77, which older
+// readers cannot decode.
+
+// 64-bit file offsets for fseeko/ftello on 32-bit platforms
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main_container.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static int put_u32(FILE* f, uint32_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static int put_u64(FILE* f, uint64_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static int get_u32(FILE* f, uint32_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+}
+
+static int get_u64(FILE* f, uint64_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1 ? 0 : -1;
+}
+
+void meta_init(struct meta_info* meta, uint32_t block_size) {
+  memset(meta, 0, sizeof(*meta));
+  meta->block_size = block_size;
+}
+
+int meta_push(struct meta_info* meta, const struct block_entry* entry) {
+  if (meta->nblocks == meta->capacity) {
+    uint64_t cap = meta->capacity ? meta->capacity * 2 : 64;
+    struct block_entry* grown =
+        realloc(meta->blocks, (size_t)cap * sizeof(*grown));
+    if (!grown)
+      return -1;
+    meta->blocks = grown;
+    meta->capacity = cap;
+  }
+  meta->blocks[meta->nblocks++] = *entry;
+  return 0;
+}
+
+/* Written under a temporary name and renamed over path, so that an
+   interrupted write leaves the previous index in place. */
+int meta_write(const char* path, const struct meta_info* meta) {
+  char tmp[4096];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+    return -1;
+  FILE* f = fopen(tmp, "wb");
+  if (!f)
+    return -1;
+  int err = fwrite(META_MAGIC, 1, 4, f) != 4;
+  err |= put_u32(f, META_VERSION);
+  err |= put_u64(f, meta->original_len);
+  err |= put_u32(f, meta->block_size);
+  err |= put_u32(f, meta->stream_crc);
+  err |= put_u64(f, meta->nblocks);
+  for (uint64_t i = 0; i < meta->nblocks && !err; i++) {
+    const struct block_entry* b = &meta->blocks[i];
+    err |= put_u64(f, b->offset);
+    err |= put_u64(f, b->comp_len);
+    err |= put_u64(f, b->raw_len);
+    err |= put_u64(f, b->primary);
+    err |= put_u64(f, b->sym_len);
+    err |= put_u64(f, b->flags);
+    err |= put_u64(f, b->checksum);
+  }
+  if (fclose(f) != 0)
+    err = 1;
+#ifdef _WIN32
+  if (!err)
+    remove(path);  // rename does not replace an existing file there
+#endif
+  if (err || rename(tmp, path) != 0) {
+    remove(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+int meta_read(const char* path, struct meta_info* meta) {
+  meta_init(meta, 0);
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return -1;
+
+  char magic[4];
+  uint32_t version = 0, stream_crc = 0;
+  uint64_t nblocks = 0;
+  if (fread(magic, 1, 4, f) != 4 || memcmp(magic, META_MAGIC, 4) != 0 ||
+      get_u32(f, &version) || version < 2 || version > META_VERSION ||
+      get_u64(f, &meta->original_len) || get_u32(f, &meta->block_size) ||
+      get_u32(f, &stream_crc) || get_u64(f, &nblocks)) {
+    fclose(f);
+    return -1;
+  }
+
+  meta->stream_crc = version >= 4 ? stream_crc : 0;
+  for (uint64_t i = 0; i < nblocks; i++) {
+    struct block_entry b = {0};
+    if (get_u64(f, &b.offset) || get_u64(f, &b.comp_len) ||
+        get_u64(f, &b.raw_len) || get_u64(f, &b.primary) ||
+        get_u64(f, &b.sym_len) || (version >= 3 && get_u64(f, &b.flags)) ||
+        (version >= 4 && get_u64(f, &b.checksum)) || meta_push(meta, &b)) {
+      fclose(f);
+      meta_free(meta);
+      return -1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+void meta_free(struct meta_info* meta) {
+  free(meta->blocks);
+  meta->blocks = NULL;
+  meta->nblocks = meta->capacity = 0;
+}
+
+uint32_t crc32c_combine(uint32_t crc1,
+                        uint32_t crc2,
+                        uint64_t len2);  // from main_crc32c.c
+
+/* Stream CRC32C rebuilt from the per-block checksums.  Returns -1 if some
+   block has no checksum (written before version 4), else 0 with the CRC
+   in *crc. */
+int meta_combined_crc(const struct meta_info* meta, uint32_t* crc) {
+  uint32_t c = 0;
+  for (uint64_t i = 0; i < meta->nblocks; i++) {
+    const struct block_entry* b = &meta->blocks[i];
+    if (!(b->flags & BLOCK_FLAG_CRC))
+      return -1;
+    c = crc32c_combine(c, (uint32_t)b->checksum, b->raw_len);
+  }
+  *crc = c;
+  return 0;
+}
+
+/* 64-bit seek/tell, so containers past 2 GB work where long is 32-bit. */
+int file_seek(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(f, (__int64)offset, SEEK_SET) == 0 ? 0 : -1;
+#else
+  return fseeko(f, (off_t)offset, SEEK_SET) == 0 ? 0 : -1;
+#endif
+}
+
+int file_seek_end(FILE* f) {
+#ifdef _WIN32
+  return _fseeki64(f, 0, SEEK_END) == 0 ? 0 : -1;
+#else
+  return fseeko(f, 0, SEEK_END) == 0 ? 0 : -1;
+#endif
+}
+
+int64_t file_tell(FILE* f) {
+#ifdef _WIN32
+  return (int64_t)_ftelli64(f);
+#else
+  return (int64_t)ftello(f);
+#endif
+}
+
+/* Descriptor of f, for positional I/O next to it (main_aio.c). */
+int file_fd(FILE* f) {
+#ifdef _WIN32
+  return _fileno(f);
+#else
+  return fileno(f);
+#endif
+}
+
+/* Cut f (open for writing) to len bytes; buffered data is flushed first. */
+int file_truncate(FILE* f, uint64_t len) {
+  if (fflush(f) != 0)
+    return -1;
+#ifdef _WIN32
+  return _chsize_s(_fileno(f), (__int64)len) == 0 ? 0 : -1;
+#else
+  return ftruncate(fileno(f), (off_t)len) == 0 ? 0 : -1;
+#endif
+}
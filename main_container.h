@@ -0,0 +1,83 @@
+// main_container.h
+// Block index stored in output.bin.meta.  output.bin holds the per-block
+// Huffman payloads back to back; the .meta file says where each one starts
+// and what is needed to invert it.  All sizes and offsets are 64-bit so
+// inputs of any size can be described; each block itself stays small enough
+// for 32-bit in-memory indices.
+
+#ifndef MAIN_CONTAINER_H
+#define MAIN_CONTAINER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define META_MAGIC "TCMF"
+#define META_VERSION 7
+
+/* Largest block the in-memory pipeline accepts (32-bit indices). */
+#define MAX_BLOCK_SIZE (1u << 30)
+
+/* Largest block the external (disk-backed) builder accepts; bounded by the
+   32-bit inverse transform. */
+#define MAX_EXTERNAL_BLOCK_SIZE 0xFFFFFFFEu
+
+struct block_entry {
+  uint64_t offset;    // start of the payload in output.bin
+  uint64_t comp_len;  // payload bytes
+  uint64_t raw_len;   // original bytes in this block
+  uint64_t primary;   // BWT primary index (sentinel row)
+  uint64_t sym_len;   // RLE bytes = Huffman symbols to decode
+  uint64_t flags;     // BLOCK_FLAG_* (0 in version 2 indexes)
+  uint64_t checksum;  // CRC32C of the raw bytes, if BLOCK_FLAG_CRC
+};
+
+/* The block went through the LZP prefilter (see main_block.c). */
+#define BLOCK_FLAG_LZP 1u
+/* checksum is valid; decompress_block verifies it. */
+#define BLOCK_FLAG_CRC 2u
+/* Reduced alphabet: the payload carries the block's in-use byte bitmap and
+   a compact Huffman header (see main_block.c). */
+#define BLOCK_FLAG_ALPHA 4u
+/* The Huffman payload is split into four streams behind a jump table (see
+   main_block.c); only with BLOCK_FLAG_ALPHA. */
+#define BLOCK_FLAG_HUF4 8u
+/* Fast level: the payload is LZ77 tokens (main_lz77.c) instead of the BWT
+   chain; primary and sym_len are 0. */
+#define BLOCK_FLAG_LZ77 16u
+
+/* Knobs for compress_block (main_block.c).  Zero-initialised means the
+   defaults: sequential suffix sorting. */
+struct block_options {
+  int threads;              // threads for suffix sorting within one block
+  const char* scratch_dir;  // non-NULL: build the BWT on disk, see
+                            // compress_block_external
+  uint64_t memory_budget;   // heap budget for the disk-backed builder
+  int low_memory;           // in-memory blocks: induced sorting in place,
+                            // see compress_block_inplace
+  int lzp;                  // LZP prefilter ahead of the BWT (main_lzp.c)
+  int fast;                 // LZ77 instead of the BWT chain (main_lz77.c)
+};
+
+struct meta_info {
+  uint64_t original_len;
+  uint32_t block_size;
+  uint32_t stream_crc;  // CRC32C of all raw bytes (version 4+)
+  uint64_t nblocks;
+  uint64_t capacity;
+  struct block_entry* blocks;
+};
+
+void meta_init(struct meta_info* meta, uint32_t block_size);
+int meta_push(struct meta_info* meta, const struct block_entry* entry);
+int meta_write(const char* path, const struct meta_info* meta);
+int meta_read(const char* path, struct meta_info* meta);
+void meta_free(struct meta_info* meta);
+int meta_combined_crc(const struct meta_info* meta, uint32_t* crc);
+
+int file_seek(FILE* f, uint64_t offset);
+int file_seek_end(FILE* f);
+int64_t file_tell(FILE* f);
+int file_truncate(FILE* f, uint64_t len);
+int file_fd(FILE* f);
+
+#endif
@@ -0,0 +1,125 @@
+// main_crc32c.c
+// CRC32C (Castagnoli), the checksum of blocks and of the whole stream.
+// On x86-64 the SSE4.2 crc32 instruction is used when the CPU has it
+// (checked once at run time); elsewhere a slicing-by-8 table walk.  Both
+// give the standard CRC32C: crc32c_update(0, "123456789", 9) == 0xE3069283.
+// crc32c_combine joins the CRCs of two adjacent pieces without their data,
+// so a stream checksum can be rebuilt from per-block checksums.
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u  // reflected
+
+static uint32_t table[8][256];
+static int use_hw;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    table[0][i] = c;
+  }
+  for (uint32_t i = 0; i < 256; i++)
+    for (int t = 1; t < 8; t++)
+      table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+#ifdef CRC32C_HAVE_SSE42
+  use_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t c, const unsigned char* p, size_t len) {
+  for (; len >= 8; p += 8, len -= 8) {
+    uint32_t lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+    uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+                  (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+    c = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+        table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+        table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+        table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+  }
+  while (len--)
+    c = (c >> 8) ^ table[0][(c ^ *p++) & 0xFF];
+  return c;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t c, const unsigned char* p, size_t len) {
+  uint64_t c64 = c;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c64 = _mm_crc32_u64(c64, v);
+  }
+  c = (uint32_t)c64;
+  while (len--)
+    c = _mm_crc32_u8(c, *p++);
+  return c;
+}
+#endif
+
+/* Extend crc (0 for an empty prefix) by len bytes of data. */
+uint32_t crc32c_update(uint32_t crc, const void* data, size_t len) {
+  pthread_once(&init_once, crc32c_init);
+  uint32_t c = ~crc;
+#ifdef CRC32C_HAVE_SSE42
+  if (use_hw)
+    return ~crc32c_hw(c, data, len);
+#endif
+  return ~crc32c_sw(c, data, len);
+}
+
+// --- combine (GF(2) matrix method, as in zlib's crc32_combine) ---
+
+static uint32_t gf2_times(const uint32_t* mat, uint32_t vec) {
+  uint32_t sum = 0;
+  for (; vec; vec >>= 1, mat++)
+    if (vec & 1)
+      sum ^= *mat;
+  return sum;
+}
+
+static void gf2_square(uint32_t* square, const uint32_t* mat) {
+  for (int n = 0; n < 32; n++)
+    square[n] = gf2_times(mat, mat[n]);
+}
+
+/* CRC of A followed by B, from crc1 = CRC(A), crc2 = CRC(B) and len2 =
+   length of B. */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+  if (len2 == 0)
+    return crc1;
+  uint32_t even[32], odd[32];
+  odd[0] = CRC32C_POLY;  // operator for one zero bit
+  uint32_t row = 1;
+  for (int n = 1; n < 32; n++, row <<= 1)
+    odd[n] = row;
+  gf2_square(even, odd);  // two zero bits
+  gf2_square(odd, even);  // four zero bits
+
+  // apply len2 zero bytes to crc1
+  do {
+    gf2_square(even, odd);
+    if (len2 & 1)
+      crc1 = gf2_times(even, crc1);
+    len2 >>= 1;
+    if (!len2)
+      break;
+    gf2_square(odd, even);
+    if (len2 & 1)
+      crc1 = gf2_times(odd, crc1);
+    len2 >>= 1;
+  } while (len2);
+  return crc1 ^ crc2;
+}
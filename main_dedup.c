@@ -0,0 +1,348 @@
+// main_dedup.c
+// Content-defined chunking and the deduplicating chunk store (see
+// main_dedup.h for the on-disk layout).
+// Chunk boundaries come from a gear rolling hash (as in FastCDC): a cut is
+// made where the top bits of the hash are zero, so an insertion only moves
+// the boundaries near it and the rest of a file still matches the chunks
+// already stored.  A stricter mask before the average size and a looser one
+// after it keep chunk sizes close to CDC_AVG.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "main_dedup.h"
+
+#define CDC_MIN (16u << 10)
+#define CDC_AVG (64u << 10)
+#define CDC_MAX (256u << 10)
+#define CDC_MASK_S (~0ull << (64 - 18))  // before CDC_AVG: cut less often
+#define CDC_MASK_L (~0ull << (64 - 14))  // after it: cut more often
+
+struct message_ctx;
+struct huff_table;
+void sha256(const void* data, size_t len, unsigned char out[32]);  // main_sha256.c
+struct message_ctx* message_ctx_create(void);   // from main_message.c
+void message_ctx_free(struct message_ctx* ctx);  // from main_message.c
+size_t message_bound(size_t input_len);           // from main_message.c
+size_t compress_message(struct message_ctx* ctx,
+                        const struct huff_table* table,
+                        const unsigned char* input,
+                        size_t input_len,
+                        unsigned char* output,
+                        size_t output_capacity);  // from main_message.c
+const unsigned char* decompress_message(struct message_ctx* ctx,
+                                        struct huff_table* const* tables,
+                                        int ntables,
+                                        const unsigned char* input,
+                                        size_t input_len,
+                                        size_t max_len,
+                                        size_t* output_len);  // main_message.c
+
+struct recipe_entry {
+  unsigned char hash[32];
+  uint32_t len;
+};
+
+/* Fixed pseudo-random gear table (splitmix64); boundaries, and so dedup
+   across runs, depend on it never changing. */
+static void gear_init(uint64_t gear[256]) {
+  uint64_t x = 0x7465787463646321ull;
+  for (int i = 0; i < 256; i++) {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    gear[i] = z ^ (z >> 31);
+  }
+}
+
+/* Length of the next chunk of the n bytes at p (n <= CDC_MAX unless at the
+   end of input). */
+static size_t cdc_cut(const uint64_t gear[256],
+                      const unsigned char* p,
+                      size_t n) {
+  if (n <= CDC_MIN)
+    return n;
+  size_t normal = n < CDC_AVG ? n : CDC_AVG;
+  size_t max = n < CDC_MAX ? n : CDC_MAX;
+  uint64_t h = 0;
+  size_t i = CDC_MIN;
+  for (; i < normal; i++) {
+    h = (h << 1) + gear[p[i]];
+    if (!(h & CDC_MASK_S))
+      return i + 1;
+  }
+  for (; i < max; i++) {
+    h = (h << 1) + gear[p[i]];
+    if (!(h & CDC_MASK_L))
+      return i + 1;
+  }
+  return max;
+}
+
+static int make_dir(const char* path) {
+#ifdef _WIN32
+  int rc = _mkdir(path);
+#else
+  int rc = mkdir(path, 0777);
+#endif
+  return rc == 0 || errno == EEXIST ? 0 : -1;
+}
+
+/* <store>/<hh>/<hex>.tcc into path; with create set, the directories are
+   made as needed. */
+static int chunk_path(const char* store,
+                      const unsigned char hash[32],
+                      char* path,
+                      size_t cap,
+                      int create) {
+  char hex[65];
+  for (int i = 0; i < 32; i++)
+    snprintf(hex + 2 * i, 3, "%02x", hash[i]);
+  snprintf(path, cap, "%s/%.2s", store, hex);
+  if (create && (make_dir(store) != 0 || make_dir(path) != 0))
+    return -1;
+  int n = snprintf(path, cap, "%s/%.2s/%s.tcc", store, hex, hex);
+  return n > 0 && (size_t)n < cap ? 0 : -1;
+}
+
+/* Store one chunk unless a chunk with its hash is already there.  The
+   frame is written under a temporary name and renamed, so a reader never
+   sees a partial chunk.  Returns 1 if stored, 0 if already present, -1 on
+   error. */
+static int store_chunk(const char* store,
+                       struct message_ctx* ctx,
+                       const unsigned char hash[32],
+                       const unsigned char* data,
+                       size_t len,
+                       unsigned char** frame,
+                       size_t* frame_cap,
+                       uint64_t* stored) {
+  char path[1024], tmp[1100];
+  if (chunk_path(store, hash, path, sizeof(path), 1) != 0)
+    return -1;
+  FILE* f = fopen(path, "rb");
+  if (f) {
+    fclose(f);
+    return 0;
+  }
+
+  size_t need = message_bound(len);
+  if (need > *frame_cap) {
+    unsigned char* grown = realloc(*frame, need);
+    if (!grown)
+      return -1;
+    *frame = grown;
+    *frame_cap = need;
+  }
+  size_t frame_len = compress_message(ctx, NULL, data, len, *frame, *frame_cap);
+  if (frame_len == 0)
+    return -1;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  f = fopen(tmp, "wb");
+  int ok = f && fwrite(*frame, 1, frame_len, f) == frame_len;
+  if (f && fclose(f) != 0)
+    ok = 0;
+  if (ok && rename(tmp, path) != 0)
+    ok = 0;
+  if (!ok) {
+    remove(tmp);
+    return -1;
+  }
+  *stored += frame_len;
+  return 1;
+}
+
+static int write_recipe(const char* path,
+                        uint64_t file_len,
+                        const struct recipe_entry* chunks,
+                        uint64_t nchunks) {
+  FILE* f = fopen(path, "wb");
+  if (!f)
+    return -1;
+  uint32_t version = RECIPE_VERSION, reserved = 0;
+  int ok = fwrite(RECIPE_MAGIC, 1, 4, f) == 4 &&
+           fwrite(&version, sizeof(version), 1, f) == 1 &&
+           fwrite(&file_len, sizeof(file_len), 1, f) == 1 &&
+           fwrite(&nchunks, sizeof(nchunks), 1, f) == 1;
+  for (uint64_t i = 0; ok && i < nchunks; i++)
+    ok = fwrite(chunks[i].hash, 1, 32, f) == 32 &&
+         fwrite(&chunks[i].len, sizeof(chunks[i].len), 1, f) == 1 &&
+         fwrite(&reserved, sizeof(reserved), 1, f) == 1;
+  if (fclose(f) != 0)
+    ok = 0;
+  return ok ? 0 : -1;
+}
+
+/* Chunk input_path into the store and write its recipe.  Returns 0 on
+   success and fills in *stats. */
+int dedup_store_file(const char* store,
+                     const char* input_path,
+                     const char* recipe_path,
+                     struct dedup_stats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  FILE* in = fopen(input_path, "rb");
+  if (!in) {
+    fprintf(stderr, "Error: cannot open %s\n", input_path);
+    return -1;
+  }
+  uint64_t gear[256];
+  gear_init(gear);
+
+  // the window always holds at least CDC_MAX bytes until the input ends
+  size_t win_cap = 2 * CDC_MAX, win_len = 0, at = 0;
+  unsigned char* win = malloc(win_cap);
+  struct message_ctx* ctx = message_ctx_create();
+  unsigned char* frame = NULL;
+  size_t frame_cap = 0;
+  struct recipe_entry* chunks = NULL;
+  uint64_t nchunks = 0, chunk_cap = 0;
+  int ok = win && ctx, eof = 0;
+  while (ok) {
+    if (!eof && win_len - at < CDC_MAX) {
+      memmove(win, win + at, win_len - at);
+      win_len -= at;
+      at = 0;
+      win_len += fread(win + win_len, 1, win_cap - win_len, in);
+      eof = win_len < win_cap;
+    }
+    if (at == win_len)
+      break;
+    size_t len = cdc_cut(gear, win + at, win_len - at);
+
+    if (nchunks == chunk_cap) {
+      chunk_cap = chunk_cap ? chunk_cap * 2 : 64;
+      struct recipe_entry* grown =
+          realloc(chunks, (size_t)chunk_cap * sizeof(*chunks));
+      if (!grown) {
+        ok = 0;
+        break;
+      }
+      chunks = grown;
+    }
+    struct recipe_entry* c = &chunks[nchunks++];
+    sha256(win + at, len, c->hash);
+    c->len = (uint32_t)len;
+    int rc = store_chunk(store, ctx, c->hash, win + at, len, &frame,
+                         &frame_cap, &stats->stored);
+    if (rc < 0) {
+      fprintf(stderr, "Error: cannot store a chunk in %s\n", store);
+      ok = 0;
+      break;
+    }
+    if (rc > 0) {
+      stats->new_chunks++;
+      stats->new_bytes += len;
+    }
+    stats->bytes += len;
+    at += len;
+  }
+  if (ferror(in))
+    ok = 0;
+  fclose(in);
+  stats->chunks = nchunks;
+  if (ok && write_recipe(recipe_path, stats->bytes, chunks, nchunks) != 0) {
+    fprintf(stderr, "Error: cannot write %s\n", recipe_path);
+    ok = 0;
+  }
+  free(win);
+  free(frame);
+  free(chunks);
+  message_ctx_free(ctx);
+  return ok ? 0 : -1;
+}
+
+/* Rebuild a file from its recipe; every chunk is checked against its hash.
+   Returns 0 on success. */
+int dedup_restore_file(const char* store,
+                       const char* recipe_path,
+                       const char* output_path) {
+  FILE* r = fopen(recipe_path, "rb");
+  char magic[4];
+  uint32_t version = 0;
+  uint64_t file_len = 0, nchunks = 0;
+  if (!r || fread(magic, 1, 4, r) != 4 ||
+      memcmp(magic, RECIPE_MAGIC, 4) != 0 ||
+      fread(&version, sizeof(version), 1, r) != 1 ||
+      version != RECIPE_VERSION ||
+      fread(&file_len, sizeof(file_len), 1, r) != 1 ||
+      fread(&nchunks, sizeof(nchunks), 1, r) != 1) {
+    if (r)
+      fclose(r);
+    fprintf(stderr, "Error: %s is not a recipe\n", recipe_path);
+    return -1;
+  }
+  FILE* out = fopen(output_path, "wb");
+  struct message_ctx* ctx = message_ctx_create();
+  unsigned char* frame = NULL;
+  size_t frame_cap = 0;
+  uint64_t written = 0;
+  int ok = out && ctx;
+  for (uint64_t i = 0; ok && i < nchunks; i++) {
+    unsigned char hash[32], check[32];
+    uint32_t len, reserved;
+    char path[1024];
+    if (fread(hash, 1, 32, r) != 32 || fread(&len, sizeof(len), 1, r) != 1 ||
+        fread(&reserved, sizeof(reserved), 1, r) != 1 ||
+        chunk_path(store, hash, path, sizeof(path), 0) != 0) {
+      ok = 0;
+      break;
+    }
+    FILE* c = fopen(path, "rb");
+    if (!c) {
+      fprintf(stderr, "Error: chunk %s is missing\n", path);
+      ok = 0;
+      break;
+    }
+    size_t frame_len = 0, got;
+    do {
+      if (frame_len == frame_cap) {
+        size_t cap = frame_cap ? frame_cap * 2 : 65536;
+        unsigned char* grown = realloc(frame, cap);
+        if (!grown) {
+          ok = 0;
+          break;
+        }
+        frame = grown;
+        frame_cap = cap;
+      }
+      got = fread(frame + frame_len, 1, frame_cap - frame_len, c);
+      frame_len += got;
+    } while (got > 0);
+    fclose(c);
+
+    size_t raw_len = 0;
+    const unsigned char* raw =
+        ok ? decompress_message(ctx, NULL, 0, frame, frame_len, len, &raw_len)
+           : NULL;
+    if (raw)
+      sha256(raw, raw_len, check);
+    if (!raw || raw_len != len || memcmp(check, hash, 32) != 0) {
+      fprintf(stderr, "Error: chunk %s is corrupt\n", path);
+      ok = 0;
+      break;
+    }
+    if (fwrite(raw, 1, raw_len, out) != raw_len)
+      ok = 0;
+    written += raw_len;
+  }
+  if (ok && written != file_len) {
+    fprintf(stderr, "Error: recipe covers %llu bytes, expected %llu\n",
+            (unsigned long long)written, (unsigned long long)file_len);
+    ok = 0;
+  }
+  fclose(r);
+  if (out && fclose(out) != 0)
+    ok = 0;
+  free(frame);
+  message_ctx_free(ctx);
+  return ok ? 0 : -1;
+}
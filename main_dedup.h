@@ -0,0 +1,44 @@
+// main_dedup.h
+// Deduplicating chunk store (main_dedup.c).
+// Input files are cut into content-defined chunks; every distinct chunk is
+// compressed once and kept in a store directory under its SHA-256, and a
+// file is represented by a recipe listing its chunks.  Identical regions in
+// different files (rotated logs, config snapshots, repeated payloads) then
+// cost a hash pass and a lookup instead of a full compression.
+//
+// Store layout: <store>/<first two hex digits>/<64 hex digits>.tcc, each a
+// message frame (see main_message.c) with an inline compact table, or a
+// stored frame holding the raw bytes of a chunk that does not compress.
+//
+// Recipe layout (native endian):
+//   char     magic[4]     "TCRC"
+//   uint32_t version
+//   uint64_t file_len
+//   uint64_t nchunks
+//   nchunks x { uint8_t sha256[32], uint32_t len, uint32_t reserved }
+
+#ifndef MAIN_DEDUP_H
+#define MAIN_DEDUP_H
+
+#include <stdint.h>
+
+#define RECIPE_MAGIC "TCRC"
+#define RECIPE_VERSION 1
+
+struct dedup_stats {
+  uint64_t bytes;       // input bytes
+  uint64_t chunks;      // chunks in the recipe
+  uint64_t new_chunks;  // chunks that were not in the store yet
+  uint64_t new_bytes;   // their raw bytes
+  uint64_t stored;      // their compressed bytes
+};
+
+int dedup_store_file(const char* store,
+                     const char* input_path,
+                     const char* recipe_path,
+                     struct dedup_stats* stats);
+int dedup_restore_file(const char* store,
+                       const char* recipe_path,
+                       const char* output_path);
+
+#endif
@@ -0,0 +1,640 @@
+// main_fmindex.c
+// FM-index sidecar: build from a container, count, locate and extract (see
+// main_fmindex.h for the layout).
+// Rows of a block of n bytes are 0..n as in bwt_encode_ws: row 0 is the
+// sentinel suffix and row `primary` holds the sentinel in the L column, which
+// is not stored, so L[r] = bwt[r - (r > primary)] and the rows before r map
+// to bwt[0, r - (r > primary)).
+//
+// A query maps the sidecar (it is about twice the input) rather than
+// reading it: backward search touches two checkpoints and two stretches of
+// at most FMI_RANK_STEP BWT bytes per pattern byte and block, so only those
+// pages are read.  Nothing is validated up front beyond the block layout;
+// every value taken from the file is bounded where it is used, so a corrupt
+// file gives wrong answers at worst.  Without mmap (Windows builds) the file
+// is read whole.
+
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "main_container.h"
+#include "main_fmindex.h"
+#include "main_memory.h"
+
+unsigned char* decompress_block_bwt(
+    const unsigned char* payload,
+    const struct block_entry* entry);  // from main_block.c
+
+#define NO_SYMBOL 0xFFFF
+#define ALPHA_MAP 32
+
+/* The arrays point into the file image and may be unaligned: read them
+   with load32 and load64. */
+struct fmi_block {
+  uint64_t start;  // offset of the block in the input
+  uint32_t n;
+  uint32_t primary;
+  unsigned sigma;
+  uint16_t map[256];       // byte -> index among the in-use bytes
+  uint32_t first[256];     // first row starting with each byte
+  const unsigned char* occ;
+  const unsigned char* bwt;
+  const unsigned char* marks;
+  const unsigned char* mark_rank;
+  const unsigned char* sa;
+  const unsigned char* isa;
+  uint32_t nsamples;
+};
+
+struct fm_index {
+  uint64_t nblocks;
+  uint64_t original_len;
+  uint32_t stream_crc;
+  struct fmi_block* blocks;
+  const unsigned char* image;  // the whole file
+  size_t image_len;
+  int mapped;  // image from mmap, else from mem_alloc
+};
+
+static int put_u32(FILE* f, uint32_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static int put_u64(FILE* f, uint64_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
+}
+
+static uint32_t load32(const unsigned char* p, uint64_t i) {
+  uint32_t v;
+  memcpy(&v, p + i * sizeof(v), sizeof(v));
+  return v;
+}
+
+static uint64_t load64(const unsigned char* p, uint64_t i) {
+  uint64_t v;
+  memcpy(&v, p + i * sizeof(v), sizeof(v));
+  return v;
+}
+
+static unsigned popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ull);
+  x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+  return (unsigned)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+static uint32_t sample_count(uint32_t n) {
+  return (n - 1) / FMI_SA_STEP + 1;
+}
+
+static uint64_t mark_words(uint32_t n) {
+  return ((uint64_t)n + 64) / 64;
+}
+
+/* In-use map -> sigma and byte -> symbol map. */
+static unsigned alphabet_map(const unsigned char in_use[ALPHA_MAP],
+                             uint16_t map[256]) {
+  unsigned sigma = 0;
+  for (int c = 0; c < 256; c++)
+    map[c] = (in_use[c >> 3] >> (c & 7)) & 1 ? (uint16_t)sigma++
+                                             : NO_SYMBOL;
+  return sigma;
+}
+
+/* --- Building --- */
+
+/* Index one block's BWT and append it to out. */
+static int write_block(FILE* out,
+                       const unsigned char* bwt,
+                       uint32_t n,
+                       uint32_t primary) {
+  if (n == 0 || primary < 1 || primary > n)
+    return -1;
+
+  // --- alphabet, rank checkpoints and the first row of each byte ---
+  unsigned char in_use[ALPHA_MAP] = {0};
+  for (uint32_t i = 0; i < n; i++)
+    in_use[bwt[i] >> 3] |= (unsigned char)(1u << (bwt[i] & 7));
+  uint16_t map[256];
+  unsigned sigma = alphabet_map(in_use, map);
+  uint32_t ncp = n / FMI_RANK_STEP + 1;
+  uint32_t* occ = mem_alloc((size_t)ncp * sigma * sizeof(uint32_t));
+  uint32_t nsamples = sample_count(n);
+  uint64_t words = mark_words(n);
+  uint32_t* lf = mem_alloc(((size_t)n + 1) * sizeof(uint32_t));
+  uint64_t* marks = mem_calloc((size_t)words, sizeof(uint64_t));
+  uint32_t* mark_rank = mem_alloc((size_t)words * sizeof(uint32_t));
+  uint32_t* sa = mem_alloc((size_t)nsamples * sizeof(uint32_t));
+  uint32_t* isa = mem_alloc((size_t)nsamples * sizeof(uint32_t));
+  int ok = occ && lf && marks && mark_rank && sa && isa;
+  if (ok) {
+    uint32_t counts[256] = {0};
+    for (uint32_t i = 0; i <= n; i++) {
+      if (i % FMI_RANK_STEP == 0) {
+        uint32_t* cp = occ + (size_t)(i / FMI_RANK_STEP) * sigma;
+        for (int c = 0; c < 256; c++)
+          if (map[c] != NO_SYMBOL)
+            cp[map[c]] = counts[c];
+      }
+      if (i < n)
+        counts[bwt[i]]++;
+    }
+    uint32_t next[256];
+    uint32_t row = 1;
+    for (int c = 0; c < 256; c++) {
+      next[c] = row;
+      row += counts[c];
+    }
+
+    // --- LF mapping, then one walk from the sentinel suffix back to the
+    // start of the block, sampling every FMI_SA_STEP-th position ---
+    for (uint32_t r = 0; r <= n; r++)
+      if (r != primary)
+        lf[r] = next[bwt[r - (r > primary)]]++;
+    uint32_t r = 0;
+    for (uint32_t pos = n; ok && pos-- > 0;) {
+      if (r == primary) {
+        ok = 0;  // the cycle reached the sentinel early
+        break;
+      }
+      r = lf[r];  // row of the suffix at pos
+      if (pos % FMI_SA_STEP == 0) {
+        marks[r / 64] |= 1ull << (r % 64);
+        isa[pos / FMI_SA_STEP] = r;
+      }
+    }
+    ok = ok && r == primary;
+  }
+  if (ok) {
+    uint32_t total = 0;
+    for (uint64_t w = 0; w < words; w++) {
+      mark_rank[w] = total;
+      total += popcount64(marks[w]);
+    }
+    for (uint32_t k = 0; k < nsamples; k++) {
+      uint32_t r = isa[k];
+      sa[mark_rank[r / 64] +
+         popcount64(marks[r / 64] & ((1ull << (r % 64)) - 1))] =
+          k * FMI_SA_STEP;
+    }
+    ok = put_u64(out, n) == 0 && put_u64(out, primary) == 0 &&
+         fwrite(in_use, 1, ALPHA_MAP, out) == ALPHA_MAP &&
+         fwrite(occ, sizeof(uint32_t), (size_t)ncp * sigma, out) ==
+             (size_t)ncp * sigma &&
+         fwrite(bwt, 1, n, out) == n &&
+         fwrite(marks, sizeof(uint64_t), (size_t)words, out) == words &&
+         fwrite(mark_rank, sizeof(uint32_t), (size_t)words, out) == words &&
+         fwrite(sa, sizeof(uint32_t), nsamples, out) == nsamples &&
+         fwrite(isa, sizeof(uint32_t), nsamples, out) == nsamples;
+  }
+  mem_free(occ);
+  mem_free(lf);
+  mem_free(marks);
+  mem_free(mark_rank);
+  mem_free(sa);
+  mem_free(isa);
+  return ok ? 0 : -1;
+}
+
+int fmi_create(const char* bin_path,
+               const struct meta_info* meta,
+               const char* index_path) {
+  FILE* in = fopen(bin_path, "rb");
+  if (!in) {
+    fprintf(stderr, "Error opening %s\n", bin_path);
+    return -1;
+  }
+  FILE* out = fopen(index_path, "wb");
+  if (!out) {
+    fclose(in);
+    fprintf(stderr, "Cannot write %s\n", index_path);
+    return -1;
+  }
+  int ok = fwrite(FMI_MAGIC, 1, 4, out) == 4 &&
+           put_u32(out, FMI_VERSION) == 0 &&
+           put_u32(out, FMI_RANK_STEP) == 0 &&
+           put_u32(out, FMI_SA_STEP) == 0 &&
+           put_u64(out, meta->nblocks) == 0 &&
+           put_u64(out, meta->original_len) == 0 &&
+           put_u32(out, meta->stream_crc) == 0 && put_u32(out, 0) == 0;
+  for (uint64_t i = 0; ok && i < meta->nblocks; i++) {
+    const struct block_entry* b = &meta->blocks[i];
+    if (b->flags & BLOCK_FLAG_LZP) {
+      fprintf(stderr,
+              "Block %llu went through the LZP prefilter (-P) and cannot be "
+              "indexed\n",
+              (unsigned long long)i);
+      ok = 0;
+      break;
+    }
+    if (b->flags & BLOCK_FLAG_LZ77) {
+      fprintf(stderr,
+              "Block %llu was compressed at the fast level (-f) and has no "
+              "BWT to index\n",
+              (unsigned long long)i);
+      ok = 0;
+      break;
+    }
+    if (b->raw_len == 0 || b->raw_len > MAX_EXTERNAL_BLOCK_SIZE) {
+      fprintf(stderr, "Block %llu: inconsistent index entry\n",
+              (unsigned long long)i);
+      ok = 0;
+      break;
+    }
+    unsigned char* payload = mem_alloc(b->comp_len ? (size_t)b->comp_len : 1);
+    unsigned char* bwt = NULL;
+    if (payload && file_seek(in, b->offset) == 0 &&
+        fread(payload, 1, (size_t)b->comp_len, in) == b->comp_len)
+      bwt = decompress_block_bwt(payload, b);
+    mem_free(payload);
+    if (!bwt || write_block(out, bwt, (uint32_t)b->raw_len,
+                            (uint32_t)b->primary) != 0) {
+      fprintf(stderr, "Block %llu: cannot index\n", (unsigned long long)i);
+      ok = 0;
+    }
+    mem_free(bwt);
+  }
+  fclose(in);
+  if (fclose(out) != 0)
+    ok = 0;
+  if (!ok) {
+    remove(index_path);
+    return -1;
+  }
+  return 0;
+}
+
+/* --- Reading --- */
+
+void fmi_close(struct fm_index* x) {
+  if (!x)
+    return;
+#ifndef _WIN32
+  if (x->mapped)
+    munmap((void*)x->image, x->image_len);
+  else
+#endif
+    mem_free((void*)x->image);
+  free(x->blocks);
+  free(x);
+}
+
+/* Lay out the block at image[*pos, len): its arrays are only pointed at.
+   The byte counts that give first[] come from the last checkpoint and the
+   BWT bytes after it, and must add up to n. */
+static int open_block(const unsigned char* image,
+                      size_t len,
+                      size_t* pos,
+                      struct fmi_block* b) {
+  if (len - *pos < 16 + ALPHA_MAP)
+    return -1;
+  const unsigned char* in_use = image + *pos + 16;
+  uint64_t n = load64(image + *pos, 0), primary = load64(image + *pos, 1);
+  if (n == 0 || n > MAX_EXTERNAL_BLOCK_SIZE || primary < 1 || primary > n)
+    return -1;
+  b->n = (uint32_t)n;
+  b->primary = (uint32_t)primary;
+  b->sigma = alphabet_map(in_use, b->map);
+  uint64_t ncp = n / FMI_RANK_STEP + 1;
+  uint64_t words = mark_words(b->n);
+  b->nsamples = sample_count(b->n);
+  uint64_t size = 16 + ALPHA_MAP + ncp * b->sigma * 4 + n + words * 12 +
+                  (uint64_t)b->nsamples * 8;
+  if (size > len - *pos)
+    return -1;
+  const unsigned char* p = image + *pos + 16 + ALPHA_MAP;
+  b->occ = p;
+  b->bwt = p += ncp * b->sigma * 4;
+  b->marks = p += n;
+  b->mark_rank = p += words * 8;
+  b->sa = p += words * 4;
+  b->isa = p + (uint64_t)b->nsamples * 4;
+  *pos += (size_t)size;
+
+  uint64_t counts[256] = {0};
+  uint32_t last = (uint32_t)(ncp - 1) * FMI_RANK_STEP;
+  for (int c = 0; c < 256; c++)
+    if (b->map[c] != NO_SYMBOL)
+      counts[c] = load32(b->occ, (ncp - 1) * b->sigma + b->map[c]);
+  for (uint32_t i = last; i < b->n; i++)
+    counts[b->bwt[i]]++;
+  uint64_t row = 1;
+  for (int c = 0; c < 256; c++) {
+    b->first[c] = (uint32_t)row;
+    row += counts[c];
+    if (row > n + 1)
+      return -1;
+  }
+  return row == n + 1 ? 0 : -1;
+}
+
+struct fm_index* fmi_open(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+  struct fm_index* x = calloc(1, sizeof(*x));
+  int64_t end = 0;
+  if (!x || file_seek_end(f) != 0 || (end = file_tell(f)) < 40 ||
+      (uint64_t)end > SIZE_MAX) {
+    fclose(f);
+    free(x);
+    return NULL;
+  }
+  x->image_len = (size_t)end;
+#ifndef _WIN32
+  void* map = mmap(NULL, x->image_len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (map != MAP_FAILED) {
+    posix_madvise(map, x->image_len, POSIX_MADV_RANDOM);  // no read-around
+    x->image = map;
+    x->mapped = 1;
+  }
+#endif
+  if (!x->image) {
+    unsigned char* buf = mem_alloc(x->image_len);
+    if (buf && (file_seek(f, 0) != 0 ||
+                fread(buf, 1, x->image_len, f) != x->image_len)) {
+      mem_free(buf);
+      buf = NULL;
+    }
+    x->image = buf;
+  }
+  fclose(f);
+  const unsigned char* h = x->image;
+  if (!h || memcmp(h, FMI_MAGIC, 4) != 0 || load32(h, 1) != FMI_VERSION ||
+      load32(h, 2) != FMI_RANK_STEP || load32(h, 3) != FMI_SA_STEP) {
+    fmi_close(x);
+    return NULL;
+  }
+  x->nblocks = load64(h + 16, 0);
+  x->original_len = load64(h + 16, 1);
+  x->stream_crc = load32(h, 8);
+  if (x->nblocks > x->image_len / 48 ||
+      !(x->blocks = calloc((size_t)x->nblocks + 1, sizeof(*x->blocks)))) {
+    fmi_close(x);
+    return NULL;
+  }
+  size_t pos = 40;
+  uint64_t start = 0;
+  for (uint64_t i = 0; i < x->nblocks; i++) {
+    if (open_block(x->image, x->image_len, &pos, &x->blocks[i]) != 0) {
+      fmi_close(x);
+      return NULL;
+    }
+    x->blocks[i].start = start;
+    start += x->blocks[i].n;
+  }
+  if (start != x->original_len) {
+    fmi_close(x);
+    return NULL;
+  }
+  return x;
+}
+
+uint64_t fmi_length(const struct fm_index* x) {
+  return x->original_len;
+}
+
+int fmi_matches(const struct fm_index* x,
+                uint64_t original_len,
+                uint32_t stream_crc) {
+  return x->original_len == original_len && x->stream_crc == stream_crc;
+}
+
+/* --- Queries within one block --- */
+
+/* Occurrences of c in bwt[0, p). */
+static uint32_t occ(const struct fmi_block* b, unsigned char c, uint32_t p) {
+  unsigned s = b->map[c];
+  if (s == NO_SYMBOL)
+    return 0;
+  if (p > b->n)
+    p = b->n;  // a row from a corrupt file
+  uint32_t k = p / FMI_RANK_STEP;
+  uint32_t count = load32(b->occ, (uint64_t)k * b->sigma + s);
+  const unsigned char* q = b->bwt + (size_t)k * FMI_RANK_STEP;
+  for (uint32_t i = 0, len = p - k * FMI_RANK_STEP; i < len; i++)
+    count += q[i] == c;
+  return count;
+}
+
+/* Occurrences of c in the L column above row r. */
+static uint32_t occ_row(const struct fmi_block* b,
+                        unsigned char c,
+                        uint32_t r) {
+  return occ(b, c, r - (r > b->primary));
+}
+
+/* Row of the suffix one position earlier than row r's (r != primary). */
+static uint32_t lf(const struct fmi_block* b, uint32_t r) {
+  unsigned char c = b->bwt[r - (r > b->primary)];
+  return b->first[c] + occ(b, c, r - (r > b->primary));
+}
+
+/* Rows [*lo, *hi) whose suffixes start with the pattern. */
+static void block_range(const struct fmi_block* b,
+                        const unsigned char* pattern,
+                        size_t m,
+                        uint32_t* lo,
+                        uint32_t* hi) {
+  uint32_t l = 0, h = b->n + 1;
+  for (size_t i = m; i-- > 0 && l < h;) {
+    unsigned char c = pattern[i];
+    if (b->map[c] == NO_SYMBOL) {
+      h = l;
+      break;
+    }
+    l = b->first[c] + occ_row(b, c, l);
+    h = b->first[c] + occ_row(b, c, h);
+  }
+  if (h > b->n + 1)
+    h = b->n + 1;
+  *lo = l < h ? l : h;
+  *hi = h;
+}
+
+/* Text position of row r: walk LF to a sampled row. */
+static int row_position(const struct fmi_block* b, uint32_t r, uint32_t* pos) {
+  for (uint32_t steps = 0; steps <= FMI_SA_STEP && r <= b->n; steps++) {
+    uint64_t word = load64(b->marks, r / 64);
+    if ((word >> (r % 64)) & 1) {
+      uint32_t k = load32(b->mark_rank, r / 64) +
+                   popcount64(word & ((1ull << (r % 64)) - 1));
+      if (k >= b->nsamples || (uint64_t)load32(b->sa, k) + steps >= b->n)
+        return -1;
+      *pos = load32(b->sa, k) + steps;
+      return 0;
+    }
+    if (r == b->primary)
+      return -1;
+    r = lf(b, r);
+  }
+  return -1;
+}
+
+/* Bytes [from, to) of the block: walk back from the first sampled
+   position at or after to (or from the end of the block). */
+static int block_extract(const struct fmi_block* b,
+                         uint32_t from,
+                         uint32_t to,
+                         unsigned char* out) {
+  uint32_t k = to / FMI_SA_STEP + (to % FMI_SA_STEP != 0);
+  uint32_t s = b->n, r = 0;
+  if (k < b->nsamples) {
+    s = k * FMI_SA_STEP;
+    r = load32(b->isa, k);
+  }
+  while (s > from) {
+    if (r > b->n || r == b->primary)
+      return -1;
+    unsigned char c = b->bwt[r - (r > b->primary)];
+    if (--s < to)
+      out[s - from] = c;
+    if (s > from)
+      r = lf(b, r);
+  }
+  return 0;
+}
+
+/* --- Queries over the whole input --- */
+
+/* Block holding input offset pos (< original_len). */
+static uint64_t find_block(const struct fm_index* x, uint64_t pos) {
+  uint64_t lo = 0, hi = x->nblocks;
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (x->blocks[mid].start <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+int fmi_extract(const struct fm_index* x,
+                uint64_t pos,
+                size_t len,
+                unsigned char* out) {
+  if (pos > x->original_len || len > x->original_len - pos)
+    return -1;
+  while (len > 0) {
+    const struct fmi_block* b = &x->blocks[find_block(x, pos)];
+    uint32_t from = (uint32_t)(pos - b->start);
+    uint32_t to = len < b->n - from ? from + (uint32_t)len : b->n;
+    if (block_extract(b, from, to, out) != 0)
+      return -1;
+    out += to - from;
+    pos += to - from;
+    len -= to - from;
+  }
+  return 0;
+}
+
+/* Matches that start in block i - 1 and end in a later block: read the
+   m - 1 bytes either side of the boundary and compare.  Calls found for
+   each start offset; returns their number, or -1. */
+static int64_t boundary_matches(const struct fm_index* x,
+                                uint64_t i,
+                                const unsigned char* pattern,
+                                size_t m,
+                                uint64_t* found) {
+  uint64_t edge = x->blocks[i].start;
+  uint64_t lo = edge - x->blocks[i - 1].start < m - 1 ? x->blocks[i - 1].start
+                                                      : edge - (m - 1);
+  uint64_t hi = x->original_len - edge < m - 1 ? x->original_len
+                                               : edge + (m - 1);
+  unsigned char* window = malloc((size_t)(hi - lo));
+  if (!window || fmi_extract(x, lo, (size_t)(hi - lo), window) != 0) {
+    free(window);
+    return -1;
+  }
+  int64_t count = 0;
+  for (uint64_t s = lo; s < edge && s + m <= hi; s++) {
+    if (memcmp(window + (s - lo), pattern, m) == 0) {
+      if (found)
+        found[count] = s;
+      count++;
+    }
+  }
+  free(window);
+  return count;
+}
+
+uint64_t fmi_count(const struct fm_index* x,
+                   const unsigned char* pattern,
+                   size_t m) {
+  uint64_t count = 0;
+  for (uint64_t i = 0; i < x->nblocks; i++) {
+    uint32_t lo, hi;
+    block_range(&x->blocks[i], pattern, m, &lo, &hi);
+    count += hi - lo;
+    int64_t across = i > 0 && m > 1
+                         ? boundary_matches(x, i, pattern, m, NULL)
+                         : 0;
+    if (across > 0)
+      count += (uint64_t)across;
+  }
+  return count;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+uint64_t* fmi_locate(const struct fm_index* x,
+                     const unsigned char* pattern,
+                     size_t m,
+                     uint64_t* count) {
+  uint64_t total = fmi_count(x, pattern, m);
+  *count = 0;
+  if (total == 0)
+    return NULL;
+  uint64_t* pos = total <= SIZE_MAX / sizeof(uint64_t)
+                      ? malloc((size_t)total * sizeof(uint64_t))
+                      : NULL;
+  if (!pos) {
+    *count = UINT64_MAX;
+    return NULL;
+  }
+  uint64_t k = 0;
+  for (uint64_t i = 0; i < x->nblocks; i++) {
+    const struct fmi_block* b = &x->blocks[i];
+    uint32_t lo, hi;
+    block_range(b, pattern, m, &lo, &hi);
+    for (uint32_t r = lo; r < hi; r++) {
+      uint32_t p;
+      if (k == total || row_position(b, r, &p) != 0) {
+        free(pos);
+        *count = UINT64_MAX;
+        return NULL;
+      }
+      pos[k++] = b->start + p;
+    }
+    if (i > 0 && m > 1) {
+      // fmi_count found these too, so they fit
+      int64_t across = boundary_matches(x, i, pattern, m, pos + k);
+      if (across < 0) {
+        free(pos);
+        *count = UINT64_MAX;
+        return NULL;
+      }
+      k += (uint64_t)across;
+    }
+  }
+  qsort(pos, (size_t)k, sizeof(*pos), cmp_u64);
+  *count = k;
+  return pos;
+}
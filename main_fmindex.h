@@ -0,0 +1,95 @@
+// main_fmindex.h
+// FM-index sidecar for a block container (main_fmindex.c).
+// Each block's BWT is the L column of an FM-index over that block: with
+// rank checkpoints (occurrences of every in-use byte so far) a pattern is
+// found by backward search in two rank queries per pattern byte, and with a
+// sampled suffix array each match row walks back at most FMI_SA_STEP rows
+// to a known text position.  Inverse samples (the row of every
+// FMI_SA_STEP-th text position) let any range of the input be read back
+// without decoding its block.  Matches that cross a block boundary are
+// found by reading the few bytes on either side of it.
+//
+// The coded payload cannot be ranked in place, so the index keeps its own
+// copy of each BWT, plus 4 bytes per FMI_RANK_STEP rows and in-use byte and
+// about 14 bytes per FMI_SA_STEP rows: around twice the input for text.
+// Queries map it, so they cost the pages they touch rather than its size.
+// LZP-filtered blocks (-P) and fast-level blocks (-f) cannot be indexed.
+//
+// Layout (.fmi, native endian):
+//   char     magic[4]         "TCFM"
+//   uint32_t version
+//   uint32_t rank_step        FMI_RANK_STEP
+//   uint32_t sa_step          FMI_SA_STEP
+//   uint64_t nblocks
+//   uint64_t original_len
+//   uint32_t stream_crc       of the container the index was built from
+//   uint32_t reserved
+//   per block:
+//     uint64_t n              raw bytes
+//     uint64_t primary        sentinel row (see bwt_encode_ws)
+//     uint8_t  in_use[32]     bit b of in_use[b / 8] set if byte b occurs;
+//                             sigma bytes in all
+//     uint32_t occ[n / rank_step + 1][sigma]
+//                             occurrences of each in-use byte (ascending)
+//                             in bwt[0, k * rank_step)
+//     uint8_t  bwt[n]
+//     uint64_t marks[(n + 64) / 64]
+//                             bit r set if row r holds a sampled position
+//     uint32_t mark_rank[(n + 64) / 64]
+//                             marks in the words before
+//     uint32_t sa[(n - 1) / sa_step + 1]
+//                             text position of each marked row, by row
+//     uint32_t isa[(n - 1) / sa_step + 1]
+//                             row of text position k * sa_step
+
+#ifndef MAIN_FMINDEX_H
+#define MAIN_FMINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "main_container.h"
+
+#define FMI_MAGIC "TCFM"
+#define FMI_VERSION 1
+#define FMI_RANK_STEP 512
+#define FMI_SA_STEP 32
+
+/* Index the blocks of meta (payloads in bin_path) into index_path.  Only
+   the BWT of each block is decoded.  Returns 0, or -1 after printing why
+   (including an LZP-filtered block). */
+int fmi_create(const char* bin_path,
+               const struct meta_info* meta,
+               const char* index_path);
+
+struct fm_index;
+/* NULL if the file is missing or malformed. */
+struct fm_index* fmi_open(const char* path);
+void fmi_close(struct fm_index* x);
+uint64_t fmi_length(const struct fm_index* x);
+/* Whether the index was built from a container with this length and
+   stream CRC. */
+int fmi_matches(const struct fm_index* x,
+                uint64_t original_len,
+                uint32_t stream_crc);
+
+/* Occurrences of the m-byte pattern (m >= 1) in the input, overlapping
+   ones included. */
+uint64_t fmi_count(const struct fm_index* x,
+                   const unsigned char* pattern,
+                   size_t m);
+/* Their start offsets in the input, ascending, in an allocated array of
+   *count entries (free with free; NULL with *count 0 when there are none).
+   Returns NULL with *count set to UINT64_MAX on failure. */
+uint64_t* fmi_locate(const struct fm_index* x,
+                     const unsigned char* pattern,
+                     size_t m,
+                     uint64_t* count);
+/* Read input bytes [pos, pos + len) into out.  Returns 0, or -1 if the
+   range is out of bounds or the index is corrupt. */
+int fmi_extract(const struct fm_index* x,
+                uint64_t pos,
+                size_t len,
+                unsigned char* out);
+
+#endif
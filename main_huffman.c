@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -121,7 +122,10 @@ struct MinHeapNode* buildHuffmanTree(unsigned char data[],
     insertMinHeap(minHeap, top);
   }
 
-  return extractMin(minHeap);
+  struct MinHeapNode* root = extractMin(minHeap);
+  free(minHeap->array);
+  free(minHeap);
+  return root;
 }
 
 void storeCodes(struct MinHeapNode* root,
@@ -145,6 +149,8 @@ void storeCodes(struct MinHeapNode* root,
   }
 }
 
+void freeHuffmanTree(struct MinHeapNode* root);
+
 void buildHuffmanCodes(unsigned char data[],
                        unsigned freq[],
                        int size,
@@ -152,6 +158,7 @@ void buildHuffmanCodes(unsigned char data[],
   struct MinHeapNode* root = buildHuffmanTree(data, freq, size);
   int arr[MAX_TREE_HT], top = 0;
   storeCodes(root, arr, top, codes);
+  freeHuffmanTree(root);
 }
 
 // Compress
@@ -318,9 +325,693 @@ void decompress_huffman(const char* input_file, const char* output_file) {
 
   fclose(in);
   fclose(out);
+  freeHuffmanTree(root);
   printf("File decompressed successfully (Huffman)!\n");
 }
 
+void freeHuffmanTree(struct MinHeapNode* root) {
+  if (!root)
+    return;
+  freeHuffmanTree(root->left);
+  freeHuffmanTree(root->right);
+  free(root);
+}
+
+/* The decoder looks up the next HUF_LOOKUP_BITS bits of the stream to get
+   the symbol and its code length at once; only codes longer than that
+   (rare: their symbols are the least frequent) finish by walking the tree
+   from the node the lookup reached. */
+#define HUF_LOOKUP_BITS 11
+
+/* A ready-to-use code: the frequencies it was built from, the packed codes
+   for the encoder and the tree and lookup table for the decoder.  Built
+   once per block for the inline-header format, or once per process for a
+   pretrained table. */
+struct huff_table {
+  uint32_t id;
+  unsigned freq[256];
+  uint64_t bits[256];
+  int lens[256];
+  struct MinHeapNode* root;
+  // symbol | code length << 8, or 0 for a longer code, whose node after
+  // HUF_LOOKUP_BITS bits is in subtree
+  uint16_t lookup[1 << HUF_LOOKUP_BITS];
+  struct MinHeapNode* subtree[1 << HUF_LOOKUP_BITS];
+};
+
+#define HUFF_TABLE_MAGIC "TCHT"
+#define HUFF_TABLE_VERSION 1
+
+/* Fill the lookup entries under the code prefix of node (depth bits). */
+static void fill_lookup(struct huff_table* t,
+                        struct MinHeapNode* node,
+                        unsigned prefix,
+                        int depth) {
+  if (isLeaf(node)) {
+    int span = HUF_LOOKUP_BITS - depth;
+    uint16_t e = (uint16_t)(node->data | depth << 8);
+    for (unsigned k = 0; k < 1u << span; k++)
+      t->lookup[(prefix << span) | k] = e;
+    return;
+  }
+  if (depth == HUF_LOOKUP_BITS) {
+    t->lookup[prefix] = 0;
+    t->subtree[prefix] = node;
+    return;
+  }
+  fill_lookup(t, node->left, prefix << 1, depth + 1);
+  fill_lookup(t, node->right, prefix << 1 | 1, depth + 1);
+}
+
+/* Build the code for t->freq.  The full-table formats weight the j-th
+   present symbol with freq[j] rather than with its own count: still a
+   valid prefix code, just not an optimal one, and existing files depend on
+   it.  exact weights every symbol with its own count (compact header). */
+static int huff_table_build(struct huff_table* t, int exact) {
+  unsigned char data[256];
+  unsigned weight[256];
+  int size = 0;
+  for (int i = 0; i < 256; i++)
+    if (t->freq[i] > 0) {
+      weight[size] = exact ? t->freq[i] : t->freq[size];
+      data[size++] = (unsigned char)i;
+    }
+  memset(t->bits, 0, sizeof(t->bits));
+  memset(t->lens, 0, sizeof(t->lens));
+  t->root = NULL;
+  if (size == 0)
+    return 0;
+
+  char* codes[256] = {0};
+  t->root = buildHuffmanTree(data, weight, size);
+  if (isLeaf(t->root)) {
+    // single symbol: give it the 1-bit code "0"
+    t->lens[t->root->data] = 1;
+    return 0;
+  }
+  int arr[MAX_TREE_HT];
+  storeCodes(t->root, arr, 0, codes);
+  fill_lookup(t, t->root, 0, 0);
+
+  // pre-pack the textual codes into integers once
+  for (int i = 0; i < 256; i++) {
+    if (!codes[i])
+      continue;
+    for (int j = 0; codes[i][j] != '\0'; j++)
+      t->bits[i] = (t->bits[i] << 1) | (uint64_t)(codes[i][j] == '1');
+    t->lens[i] = (int)strlen(codes[i]);
+    free(codes[i]);
+  }
+  return 0;
+}
+
+struct huff_table* huff_table_create(uint32_t id, const unsigned freq[256]) {
+  struct huff_table* t = malloc(sizeof(*t));
+  if (!t)
+    return NULL;
+  t->id = id;
+  memcpy(t->freq, freq, sizeof(t->freq));
+  huff_table_build(t, 0);
+  return t;
+}
+
+void huff_table_free(struct huff_table* t) {
+  if (!t)
+    return;
+  freeHuffmanTree(t->root);
+  free(t);
+}
+
+uint32_t huff_table_id(const struct huff_table* t) {
+  return t->id;
+}
+
+/* Pretrained table file: magic "TCHT", uint32 version, uint32 table id,
+   unsigned freq[256].  Every symbol must have a non-zero count so that any
+   input can be coded with the table. */
+int huff_table_save(const char* path, uint32_t id, const unsigned freq[256]) {
+  FILE* out = fopen(path, "wb");
+  if (!out)
+    return -1;
+  uint32_t version = HUFF_TABLE_VERSION;
+  int err = fwrite(HUFF_TABLE_MAGIC, 1, 4, out) != 4;
+  err |= fwrite(&version, sizeof(version), 1, out) != 1;
+  err |= fwrite(&id, sizeof(id), 1, out) != 1;
+  err |= fwrite(freq, sizeof(unsigned), 256, out) != 256;
+  if (fclose(out) != 0)
+    err = 1;
+  return err ? -1 : 0;
+}
+
+struct huff_table* huff_table_load(const char* path) {
+  FILE* in = fopen(path, "rb");
+  if (!in)
+    return NULL;
+  char magic[4];
+  uint32_t version = 0, id = 0;
+  unsigned freq[256];
+  int ok = fread(magic, 1, 4, in) == 4 &&
+           memcmp(magic, HUFF_TABLE_MAGIC, 4) == 0 &&
+           fread(&version, sizeof(version), 1, in) == 1 &&
+           version == HUFF_TABLE_VERSION &&
+           fread(&id, sizeof(id), 1, in) == 1 &&
+           fread(freq, sizeof(unsigned), 256, in) == 256;
+  fclose(in);
+  if (!ok)
+    return NULL;
+  for (int i = 0; i < 256; i++)
+    if (freq[i] == 0)
+      return NULL;
+  return huff_table_create(id, freq);
+}
+
+/* Bit accumulator that survives across calls, so a long stream can be
+   coded chunk by chunk. */
+struct bit_writer {
+  uint64_t acc;
+  int bits;
+};
+
+/* Append the codes for input to output.  Returns bytes written, or
+   (size_t)-1 if output_capacity is too small or a symbol has no code. */
+static size_t encode_symbols(const struct huff_table* t,
+                             struct bit_writer* bw,
+                             const unsigned char* input,
+                             size_t input_len,
+                             unsigned char* output,
+                             size_t output_capacity) {
+  size_t out_pos = 0;
+  uint64_t acc = bw->acc;
+  int acc_bits = bw->bits;
+  for (size_t i = 0; i < input_len; i++) {
+    unsigned char ch = input[i];
+    int len = t->lens[ch];
+    uint64_t code = t->bits[ch];
+    if (len == 0)
+      return (size_t)-1;
+    // codes can exceed the room left in the accumulator; feed in halves
+    if (len > 32) {
+      acc = (acc << (len - 32)) | (code >> 32);
+      acc_bits += len - 32;
+      code &= 0xFFFFFFFFu;
+      len = 32;
+    }
+    while (acc_bits >= 8) {
+      if (out_pos >= output_capacity)
+        return (size_t)-1;
+      acc_bits -= 8;
+      output[out_pos++] = (unsigned char)(acc >> acc_bits);
+    }
+    acc = (acc << len) | code;
+    acc_bits += len;
+    while (acc_bits >= 8) {
+      if (out_pos >= output_capacity)
+        return (size_t)-1;
+      acc_bits -= 8;
+      output[out_pos++] = (unsigned char)(acc >> acc_bits);
+    }
+  }
+  bw->acc = acc;
+  bw->bits = acc_bits;
+  return out_pos;
+}
+
+/* Emit the bitstream for input with a prebuilt table (no header).  Returns
+   bytes written, or 0 if output_capacity is too small or a symbol has no
+   code in the table. */
+size_t huffman_encode_table(const struct huff_table* t,
+                            const unsigned char* input,
+                            size_t input_len,
+                            unsigned char* output,
+                            size_t output_capacity) {
+  struct bit_writer bw = {0, 0};
+  size_t out_pos =
+      encode_symbols(t, &bw, input, input_len, output, output_capacity);
+  if (out_pos == (size_t)-1)
+    return 0;
+  if (bw.bits > 0) {
+    if (out_pos >= output_capacity)
+      return 0;
+    output[out_pos++] = (unsigned char)(bw.acc << (8 - bw.bits));
+  }
+  return out_pos;
+}
+
+/* Compact header (blocks with a reduced alphabet use only a few dozen of
+   the 256 symbols):
+     uint8_t  present[32]   bit s (byte s / 8, bit s % 8) set if freq[s] > 0
+     unsigned freq[k]       the k non-zero counts, in symbol order
+   Returns the header size, or 0 if cap is too small. */
+static size_t put_compact_freq(const unsigned freq[256],
+                               unsigned char* out,
+                               size_t cap) {
+  if (cap < 32)
+    return 0;
+  memset(out, 0, 32);
+  size_t o = 32;
+  for (int s = 0; s < 256; s++) {
+    if (!freq[s])
+      continue;
+    if (o + sizeof(unsigned) > cap)
+      return 0;
+    out[s >> 3] |= (unsigned char)(1u << (s & 7));
+    memcpy(out + o, &freq[s], sizeof(unsigned));
+    o += sizeof(unsigned);
+  }
+  return o;
+}
+
+/* Inverse of put_compact_freq.  Returns the header size, or 0 if it is
+   truncated or lists a zero count. */
+static size_t get_compact_freq(const unsigned char* in,
+                               size_t len,
+                               unsigned freq[256]) {
+  if (len < 32)
+    return 0;
+  size_t o = 32;
+  for (int s = 0; s < 256; s++) {
+    freq[s] = 0;
+    if (!(in[s >> 3] >> (s & 7) & 1))
+      continue;
+    if (o + sizeof(unsigned) > len)
+      return 0;
+    memcpy(&freq[s], in + o, sizeof(unsigned));
+    o += sizeof(unsigned);
+    if (!freq[s])
+      return 0;
+  }
+  return o;
+}
+
+/* Streaming counterpart of compress_huffman_buffer for payloads too large
+   to hold in memory: counts are the 64-bit symbol counts of everything in
+   `in` (scaled down to fit the 32-bit header if needed), the payload is the
+   same header (full, or compact if compact is set) + bitstream layout.
+   Returns 0 on success and the payload size in *out_len. */
+int compress_huffman_file(FILE* in,
+                          const unsigned long long counts[256],
+                          int compact,
+                          FILE* out,
+                          uint64_t* out_len) {
+  struct huff_table t = {0};
+  unsigned long long total_count = 0;
+  for (int i = 0; i < 256; i++)
+    total_count += counts[i];
+  // the header only has to rebuild the same tree, not hold exact counts;
+  // keep the sum (the tree's root weight) within 32 bits
+  int shift = 0;
+  while ((total_count >> shift) + 256 > 0xFFFFFFFFull)
+    shift++;
+  for (int i = 0; i < 256; i++)
+    t.freq[i] = counts[i] ? (unsigned)((counts[i] >> shift) | 1u) : 0;
+  unsigned char head[32 + sizeof(t.freq)];
+  size_t head_len = sizeof(t.freq);
+  if (compact)
+    head_len = put_compact_freq(t.freq, head, sizeof(head));
+  else
+    memcpy(head, t.freq, sizeof(t.freq));
+  if (fwrite(head, 1, head_len, out) != head_len)
+    return -1;
+  huff_table_build(&t, compact);
+
+  enum { CHUNK = 1 << 16 };
+  unsigned char* inbuf = malloc(CHUNK);
+  unsigned char* outbuf = malloc(CHUNK * 8 + 16);
+  struct bit_writer bw = {0, 0};
+  uint64_t total = head_len;
+  int err = !inbuf || !outbuf;
+  size_t got;
+  while (!err && (got = fread(inbuf, 1, CHUNK, in)) > 0) {
+    size_t n = encode_symbols(&t, &bw, inbuf, got, outbuf, CHUNK * 8 + 16);
+    if (n == (size_t)-1 || fwrite(outbuf, 1, n, out) != n)
+      err = 1;
+    total += n;
+  }
+  if (!err && bw.bits > 0) {
+    unsigned char last = (unsigned char)(bw.acc << (8 - bw.bits));
+    err = fwrite(&last, 1, 1, out) != 1;
+    total++;
+  }
+  err |= ferror(in);
+  free(inbuf);
+  free(outbuf);
+  freeHuffmanTree(t.root);
+  *out_len = total;
+  return err ? -1 : 0;
+}
+
+/* MSB-first reader over one bitstream.  It keeps 56-63 bits ready in acc
+   after a refill and reads zeros past the end; br_overrun tells afterwards
+   whether any of those were consumed (a truncated or corrupt stream). */
+struct bit_reader {
+  const unsigned char* p;  // next byte to load
+  const unsigned char* end;
+  uint64_t acc;            // unread bits, at the top
+  int bits;
+  uint64_t pad;            // zero bits loaded past the end
+};
+
+static void br_init(struct bit_reader* br,
+                    const unsigned char* data,
+                    size_t len) {
+  br->p = data;
+  br->end = data + len;
+  br->acc = 0;
+  br->bits = 0;
+  br->pad = 0;
+}
+
+static inline void br_refill(struct bit_reader* br) {
+  if (br->end - br->p >= 8) {
+    const unsigned char* p = br->p;
+    uint64_t v = (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+                 (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+                 (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+                 (uint64_t)p[6] << 8 | (uint64_t)p[7];
+    // whole bytes advance p; the bits of a partly taken byte are loaded
+    // again next time, into the same place
+    br->acc |= v >> br->bits;
+    br->p += (63 - br->bits) >> 3;
+    br->bits |= 56;
+    return;
+  }
+  while (br->bits <= 56) {
+    uint64_t byte = 0;
+    if (br->p < br->end)
+      byte = *br->p++;
+    else
+      br->pad += 8;
+    br->acc |= byte << (56 - br->bits);
+    br->bits += 8;
+  }
+}
+
+static int br_overrun(const struct bit_reader* br) {
+  return br->pad > (uint64_t)br->bits;
+}
+
+/* The rest of a code longer than HUF_LOOKUP_BITS, bit by bit. */
+static unsigned char decode_long(const struct huff_table* t,
+                                 struct bit_reader* br,
+                                 unsigned idx) {
+  struct MinHeapNode* node = t->subtree[idx];
+  br->acc <<= HUF_LOOKUP_BITS;
+  br->bits -= HUF_LOOKUP_BITS;
+  while (!isLeaf(node)) {
+    if (br->bits == 0)
+      br_refill(br);
+    node = br->acc >> 63 ? node->right : node->left;
+    br->acc <<= 1;
+    br->bits--;
+  }
+  return node->data;
+}
+
+static inline unsigned char decode_symbol(const struct huff_table* t,
+                                          struct bit_reader* br) {
+  if (br->bits < HUF_LOOKUP_BITS)
+    br_refill(br);
+  unsigned idx = (unsigned)(br->acc >> (64 - HUF_LOOKUP_BITS));
+  unsigned e = t->lookup[idx];
+  if (e == 0)
+    return decode_long(t, br, idx);
+  br->acc <<= e >> 8;
+  br->bits -= (int)(e >> 8);
+  return (unsigned char)e;
+}
+
+/* decode_symbol for the unrolled loop, which refills only every
+   HUF_BATCH symbols: a long code refills after itself, so the codes left
+   in the batch still find their bits loaded. */
+#define HUF_BATCH 4
+static inline unsigned char decode_batched(const struct huff_table* t,
+                                           struct bit_reader* br) {
+  unsigned idx = (unsigned)(br->acc >> (64 - HUF_LOOKUP_BITS));
+  unsigned e = t->lookup[idx];
+  if (e == 0) {
+    unsigned char c = decode_long(t, br, idx);
+    br_refill(br);
+    return c;
+  }
+  br->acc <<= e >> 8;
+  br->bits -= (int)(e >> 8);
+  return (unsigned char)e;
+}
+
+/* Decode exactly output_len symbols with a prebuilt table.  Returns
+   output_len on success, 0 on a truncated payload. */
+size_t huffman_decode_table(const struct huff_table* t,
+                            const unsigned char* input,
+                            size_t input_len,
+                            unsigned char* output,
+                            size_t output_len) {
+  struct MinHeapNode* root = t->root;
+  if (!root || output_len == 0)
+    return 0;
+  if (isLeaf(root)) {
+    memset(output, root->data, output_len);
+    return output_len;
+  }
+
+  struct bit_reader br;
+  br_init(&br, input, input_len);
+  for (size_t i = 0; i < output_len; i++)
+    output[i] = decode_symbol(t, &br);
+  return br_overrun(&br) ? 0 : output_len;
+}
+
+/* Buffer variants used by the block pipeline.  Layout of one payload:
+     unsigned freq[256]   (native endian, same as the file format above)
+     bitstream            (MSB first, zero padded to a whole byte)
+   The decoder is told how many symbols to produce, so padding bits are never
+   mistaken for data.
+*/
+
+/* Header + bitstream for input, whose exact symbol counts are freq.  The
+   header is the full freq[256] table, or the compact form below. */
+static size_t encode_with_header(const unsigned char* input,
+                                 size_t input_len,
+                                 const unsigned freq[256],
+                                 int compact,
+                                 unsigned char* output,
+                                 size_t output_capacity) {
+  struct huff_table t = {0};
+  if (!input || !output)
+    return 0;
+
+  memcpy(t.freq, freq, sizeof(t.freq));
+  size_t head = 0;
+  if (compact) {
+    head = put_compact_freq(t.freq, output, output_capacity);
+  } else if (output_capacity >= sizeof(t.freq)) {
+    memcpy(output, t.freq, sizeof(t.freq));
+    head = sizeof(t.freq);
+  }
+  if (head == 0)
+    return 0;
+  if (input_len == 0)
+    return head;
+
+  huff_table_build(&t, compact);
+  size_t bits_len = huffman_encode_table(&t, input, input_len, output + head,
+                                         output_capacity - head);
+  freeHuffmanTree(t.root);
+  return bits_len ? head + bits_len : 0;
+}
+
+/* compress_huffman_buffer with the symbol histogram already known (e.g.
+   from mtf_rle_encode), saving a pass over the input.  freq must hold the
+   exact counts of the input_len bytes. */
+size_t compress_huffman_counts(const unsigned char* input,
+                               size_t input_len,
+                               const unsigned freq[256],
+                               unsigned char* output,
+                               size_t output_capacity) {
+  return encode_with_header(input, input_len, freq, 0, output,
+                            output_capacity);
+}
+
+/* compress_huffman_counts with the compact header. */
+size_t compress_huffman_compact(const unsigned char* input,
+                                size_t input_len,
+                                const unsigned freq[256],
+                                unsigned char* output,
+                                size_t output_capacity) {
+  return encode_with_header(input, input_len, freq, 1, output,
+                            output_capacity);
+}
+
+size_t compress_huffman_buffer(const unsigned char* input,
+                               size_t input_len,
+                               unsigned char* output,
+                               size_t output_capacity) {
+  if (!input)
+    return 0;
+  unsigned freq[256] = {0};
+  for (size_t i = 0; i < input_len; i++)
+    freq[input[i]]++;
+  return compress_huffman_counts(input, input_len, freq, output,
+                                 output_capacity);
+}
+
+size_t decompress_huffman_buffer(const unsigned char* input,
+                                 size_t input_len,
+                                 unsigned char* output,
+                                 size_t output_len) {
+  struct huff_table t = {0};
+  if (!input || !output || input_len < sizeof(t.freq))
+    return 0;
+  memcpy(t.freq, input, sizeof(t.freq));
+  huff_table_build(&t, 0);
+  size_t got = huffman_decode_table(&t, input + sizeof(t.freq),
+                                    input_len - sizeof(t.freq), output,
+                                    output_len);
+  freeHuffmanTree(t.root);
+  return got;
+}
+
+size_t decompress_huffman_compact(const unsigned char* input,
+                                  size_t input_len,
+                                  unsigned char* output,
+                                  size_t output_len) {
+  struct huff_table t = {0};
+  if (!input || !output)
+    return 0;
+  size_t head = get_compact_freq(input, input_len, t.freq);
+  if (head == 0)
+    return 0;
+  huff_table_build(&t, 1);
+  size_t got = huffman_decode_table(&t, input + head, input_len - head,
+                                    output, output_len);
+  freeHuffmanTree(t.root);
+  return got;
+}
+
+/* Four-stream layout (after the compact header): the symbols are split
+   into four consecutive runs, run s holding (n + 3 - s) / 4 of them, each
+   coded as its own bitstream:
+     uint32_t size[3]      bytes of streams 0..2 (stream 3 takes the rest)
+     streams 0..3          back to back, each zero padded to a whole byte
+   The runs share one code, but their bit positions do not depend on each
+   other, so the decoder advances four readers in the same loop and the
+   CPU overlaps their lookups, instead of waiting on one long chain of
+   "where does the next code start". */
+#define HUF_STREAMS 4
+#define HUF_JUMP_TABLE (3 * sizeof(uint32_t))
+
+static size_t run_length(size_t n, int s) {
+  return (n + HUF_STREAMS - 1 - (size_t)s) / HUF_STREAMS;
+}
+
+size_t compress_huffman_x4(const unsigned char* input,
+                           size_t input_len,
+                           const unsigned freq[256],
+                           unsigned char* output,
+                           size_t output_capacity) {
+  struct huff_table t = {0};
+  if (!input || !output)
+    return 0;
+  memcpy(t.freq, freq, sizeof(t.freq));
+  size_t head = put_compact_freq(t.freq, output, output_capacity);
+  if (head == 0 || output_capacity - head < HUF_JUMP_TABLE)
+    return 0;
+  huff_table_build(&t, 1);
+
+  size_t pos = head + HUF_JUMP_TABLE;
+  const unsigned char* run = input;
+  int err = 0;
+  for (int s = 0; s < HUF_STREAMS && !err; s++) {
+    size_t n = run_length(input_len, s);
+    size_t got = n ? huffman_encode_table(&t, run, n, output + pos,
+                                          output_capacity - pos)
+                   : 0;
+    if (n && got == 0)
+      err = 1;
+    if (s < HUF_STREAMS - 1) {
+      uint32_t size = (uint32_t)got;
+      memcpy(output + head + (size_t)s * sizeof(uint32_t), &size,
+             sizeof(size));
+    }
+    run += n;
+    pos += got;
+  }
+  freeHuffmanTree(t.root);
+  return err ? 0 : pos;
+}
+
+size_t decompress_huffman_x4(const unsigned char* input,
+                             size_t input_len,
+                             unsigned char* output,
+                             size_t output_len) {
+  struct huff_table t = {0};
+  if (!input || !output)
+    return 0;
+  size_t head = get_compact_freq(input, input_len, t.freq);
+  if (head == 0 || input_len - head < HUF_JUMP_TABLE)
+    return 0;
+  huff_table_build(&t, 1);
+  if (!t.root || output_len == 0) {
+    freeHuffmanTree(t.root);
+    return 0;
+  }
+  if (isLeaf(t.root)) {
+    memset(output, t.root->data, output_len);
+    freeHuffmanTree(t.root);
+    return output_len;
+  }
+
+  struct bit_reader br[HUF_STREAMS];
+  unsigned char* out[HUF_STREAMS];
+  size_t pos = head + HUF_JUMP_TABLE;
+  size_t left = input_len - pos;
+  unsigned char* o = output;
+  for (int s = 0; s < HUF_STREAMS; s++) {
+    uint32_t size = (uint32_t)left;
+    if (s < HUF_STREAMS - 1)
+      memcpy(&size, input + head + (size_t)s * sizeof(uint32_t),
+             sizeof(size));
+    if (size > left) {
+      freeHuffmanTree(t.root);
+      return 0;
+    }
+    br_init(&br[s], input + pos, size);
+    out[s] = o;
+    o += run_length(output_len, s);
+    pos += size;
+    left -= size;
+  }
+
+  // run 3 is the shortest; the first three may have one symbol more
+  size_t common = run_length(output_len, HUF_STREAMS - 1);
+  // a refill leaves at least 56 bits, enough for HUF_BATCH codes that fit
+  // the lookup, from every stream
+  size_t i = 0;
+  for (; i + HUF_BATCH <= common; i += HUF_BATCH) {
+    for (int s = 0; s < HUF_STREAMS; s++)
+      br_refill(&br[s]);
+    for (int k = 0; k < HUF_BATCH; k++) {
+      out[0][i + k] = decode_batched(&t, &br[0]);
+      out[1][i + k] = decode_batched(&t, &br[1]);
+      out[2][i + k] = decode_batched(&t, &br[2]);
+      out[3][i + k] = decode_batched(&t, &br[3]);
+    }
+  }
+  for (; i < common; i++) {
+    out[0][i] = decode_symbol(&t, &br[0]);
+    out[1][i] = decode_symbol(&t, &br[1]);
+    out[2][i] = decode_symbol(&t, &br[2]);
+    out[3][i] = decode_symbol(&t, &br[3]);
+  }
+  int bad = 0;
+  for (int s = 0; s < HUF_STREAMS; s++) {
+    if (run_length(output_len, s) > common)
+      out[s][common] = decode_symbol(&t, &br[s]);
+    bad |= br_overrun(&br[s]);
+  }
+  freeHuffmanTree(t.root);
+  return bad ? 0 : output_len;
+}
+
 // int main() {
 //     int choice;
 //     char input[100], output[100];
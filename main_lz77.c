@@ -0,0 +1,251 @@
+// main_lz77.c
+// Fast LZ77 level (-f): a hash-chain matcher over a 64 KiB window and a
+// byte-aligned token format, for data where compression latency matters
+// more than ratio.  It skips the BWT, MTF, RLE and Huffman stages entirely.
+//
+// A block is a sequence of
+//   token                  literal count in the high nibble, match length
+//                          - LZ77_MIN_MATCH in the low one; 15 means more
+//                          follows as a run of 255s and a final byte below
+//                          255 (added up)
+//   literal count extra bytes, then the literals
+//   uint16_t offset        little endian, 1..65535 bytes back
+//   match length extra bytes
+// except that the last sequence stops after its literals: the payload ends
+// there.  Matches may overlap their own output (offset < length).
+//
+// The encoder keeps, per hash of the next 4 bytes, the most recent position
+// and a chain to earlier ones with the same hash (one slot per window
+// position), and tries up to LZ77_CHAIN_DEPTH of them.  Speed comes from
+// doing little per byte: the search stops at the first LZ77_GOOD_MATCH-byte
+// match, only the last two positions inside a match are indexed, and after
+// a run of misses the encoder moves ahead faster, so incompressible data
+// passes quickly.  Deeper chains gained a few percent of ratio for half the
+// speed.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ77_MIN_MATCH 4
+#define LZ77_WINDOW (1u << 16)
+#define LZ77_HASH_BITS 15
+#define LZ77_CHAIN_DEPTH 2
+/* A match this long ends the search. */
+#define LZ77_GOOD_MATCH 16
+/* Misses in a row before the step grows by one byte. */
+#define LZ77_SKIP_SHIFT 6
+
+static uint32_t read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t lz77_hash(const unsigned char* p) {
+  return (read32(p) * 2654435761u) >> (32 - LZ77_HASH_BITS);
+}
+
+/* Length of the common prefix of a and b, at most limit. */
+static size_t match_length(const unsigned char* a,
+                           const unsigned char* b,
+                           size_t limit) {
+  size_t len = 0;
+  while (len + 8 <= limit) {
+    uint64_t x, y;
+    memcpy(&x, a + len, sizeof(x));
+    memcpy(&y, b + len, sizeof(y));
+    if (x != y) {
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      return len + (size_t)(__builtin_ctzll(x ^ y) >> 3);
+#else
+      break;
+#endif
+    }
+    len += 8;
+  }
+  while (len < limit && a[len] == b[len])
+    len++;
+  return len;
+}
+
+/* A length of v beyond the nibble: 255s, then the rest. */
+static unsigned char* put_length(unsigned char* op, size_t v) {
+  for (; v >= 255; v -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char)v;
+  return op;
+}
+
+/* Worst-case output for n input bytes: all literals. */
+size_t lz77_bound(size_t n) {
+  return n + n / 255 + 16;
+}
+
+/* Compress n bytes of in into out (capacity at least lz77_bound(n)).
+   Returns the payload length, or 0 on failure (out of memory or too small
+   a buffer). */
+size_t lz77_encode(const unsigned char* in,
+                   size_t n,
+                   unsigned char* out,
+                   size_t cap) {
+  if (cap < lz77_bound(n))
+    return 0;
+  uint32_t* head = malloc(sizeof(uint32_t) << LZ77_HASH_BITS);
+  uint32_t* chain = malloc(sizeof(uint32_t) * LZ77_WINDOW);
+  if (!head || !chain) {
+    free(head);
+    free(chain);
+    return 0;
+  }
+  // positions are stored + 1 so that 0 means none
+  memset(head, 0, sizeof(uint32_t) << LZ77_HASH_BITS);
+
+  unsigned char* op = out;
+  size_t anchor = 0;  // first literal not yet emitted
+  size_t i = 0;
+  size_t end = n > LZ77_MIN_MATCH ? n - LZ77_MIN_MATCH : 0;  // last hashable
+  while (i <= end && n >= LZ77_MIN_MATCH) {
+    uint32_t h = lz77_hash(in + i);
+    uint32_t cand = head[h];
+    chain[i & (LZ77_WINDOW - 1)] = cand;
+    head[h] = (uint32_t)i + 1;
+
+    // --- best of the last few positions with the same hash ---
+    size_t best_len = 0, best_off = 0;
+    uint32_t want = read32(in + i);
+    for (int depth = 0; depth < LZ77_CHAIN_DEPTH && cand; depth++) {
+      size_t c = cand - 1;
+      if (i - c >= LZ77_WINDOW)
+        break;
+      if (read32(in + c) == want) {
+        size_t len = LZ77_MIN_MATCH +
+                     match_length(in + c + LZ77_MIN_MATCH,
+                                  in + i + LZ77_MIN_MATCH,
+                                  n - i - LZ77_MIN_MATCH);
+        if (len > best_len) {
+          best_len = len;
+          best_off = i - c;
+          if (len >= LZ77_GOOD_MATCH)
+            break;
+        }
+      }
+      uint32_t next = chain[c & (LZ77_WINDOW - 1)];
+      if (next >= cand)
+        break;  // slot reused by a newer position
+      cand = next;
+    }
+    if (best_len == 0) {
+      i += 1 + ((i - anchor) >> LZ77_SKIP_SHIFT);
+      continue;
+    }
+
+    // --- sequence: literals [anchor, i), then the match ---
+    size_t lit = i - anchor;
+    size_t mlen = best_len - LZ77_MIN_MATCH;
+    *op++ = (unsigned char)((lit < 15 ? lit : 15) << 4 |
+                            (mlen < 15 ? mlen : 15));
+    if (lit >= 15)
+      op = put_length(op, lit - 15);
+    memcpy(op, in + anchor, lit);
+    op += lit;
+    *op++ = (unsigned char)best_off;
+    *op++ = (unsigned char)(best_off >> 8);
+    if (mlen >= 15)
+      op = put_length(op, mlen - 15);
+
+    // index the end of the match, where the next one is likely to start
+    size_t stop = i + best_len;
+    for (i = stop - 2; i < stop && i <= end; i++) {
+      uint32_t hi = lz77_hash(in + i);
+      chain[i & (LZ77_WINDOW - 1)] = head[hi];
+      head[hi] = (uint32_t)i + 1;
+    }
+    i = anchor = stop;
+  }
+
+  // --- last sequence: the remaining literals ---
+  size_t lit = n - anchor;
+  *op++ = (unsigned char)((lit < 15 ? lit : 15) << 4);
+  if (lit >= 15)
+    op = put_length(op, lit - 15);
+  memcpy(op, in + anchor, lit);
+  op += lit;
+  free(head);
+  free(chain);
+  return (size_t)(op - out);
+}
+
+/* A length extension at in[*ip]; -1 if it runs past len. */
+static int get_length(const unsigned char* in,
+                      size_t len,
+                      size_t* ip,
+                      size_t* v) {
+  unsigned char b;
+  do {
+    if (*ip >= len)
+      return -1;
+    b = in[(*ip)++];
+    *v += b;
+  } while (b == 255);
+  return 0;
+}
+
+/* Decode a payload of len bytes into exactly out_len bytes.  Returns
+   out_len, or 0 if the payload is malformed or decodes to another length. */
+size_t lz77_decode(const unsigned char* in,
+                   size_t len,
+                   unsigned char* out,
+                   size_t out_len) {
+  size_t ip = 0, op = 0;
+  while (ip < len) {
+    unsigned token = in[ip++];
+    size_t lit = token >> 4;
+    if (lit == 15 && get_length(in, len, &ip, &lit) != 0)
+      return 0;
+    if (lit > len - ip || lit > out_len - op)
+      return 0;
+    if (lit <= 16 && len - ip >= 16 && out_len - op >= 16)
+      memcpy(out + op, in + ip, 16);  // fixed size: no call
+    else
+      memcpy(out + op, in + ip, lit);
+    ip += lit;
+    op += lit;
+    if (ip == len)
+      break;  // last sequence
+
+    if (len - ip < 2)
+      return 0;
+    size_t off = in[ip] | (size_t)in[ip + 1] << 8;
+    ip += 2;
+    size_t mlen = token & 15;
+    if (mlen == 15 && get_length(in, len, &ip, &mlen) != 0)
+      return 0;
+    mlen += LZ77_MIN_MATCH;
+    if (off == 0 || off > op || mlen > out_len - op)
+      return 0;
+    unsigned char* dst = out + op;
+    const unsigned char* src = dst - off;
+    if (off >= 8 && out_len - op >= mlen + 8) {
+      // 8 bytes at a time; each chunk reads bytes already in place, even
+      // when the match overlaps itself, and may run 7 bytes past it
+      for (size_t k = 0; k < mlen; k += 8)
+        memcpy(dst + k, src + k, 8);
+    } else if (out_len - op >= mlen + 8) {
+      // short period: once a whole number of periods, at least 8 bytes,
+      // is in place, the rest repeats it from that far back
+      size_t step = off * ((8 + off - 1) / off);
+      size_t k = 0;
+      for (; k < step && k < mlen; k++)
+        dst[k] = src[k];
+      for (; k < mlen; k += 8)
+        memcpy(dst + k, dst + k - step, 8);
+    } else {
+      for (size_t k = 0; k < mlen; k++)
+        dst[k] = src[k];
+    }
+    op += mlen;
+  }
+  return op == out_len ? out_len : 0;
+}
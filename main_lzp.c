@@ -0,0 +1,149 @@
+// main_lzp.c
+// LZP prefilter ahead of the BWT (Bloom's LZP, as used by BWT coders).
+// Machine-generated logs repeat long stretches verbatim; those are the
+// worst case for suffix sorting, whose cost grows with the length of the
+// longest repeat.  LZP replaces every repeat of at least LZP_MIN_LEN bytes
+// by a short match token, so the BWT sees a shorter block without them.
+//
+// Both sides keep a hash table from the last LZP_ORDER bytes (the context)
+// to the most recent position that followed the same context.  At each
+// step the encoder looks at the bytes following that earlier position: if
+// at least LZP_MIN_LEN of them match, it emits
+//   marker, then (length - LZP_MIN_LEN + 1) as a run of 255s and a final
+//   byte below 255
+// and skips the match; otherwise it emits the literal byte, with a literal
+// marker byte escaped as marker, 0.  No offsets are stored: the decoder
+// finds the same earlier position from the same context.  The marker is the
+// block's least frequent byte, so escapes are rare.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZP_ORDER 8
+#define LZP_MIN_LEN 64
+#define LZP_HASH_BITS 18
+
+static uint32_t lzp_hash(const unsigned char* ctx) {
+  uint64_t v;
+  memcpy(&v, ctx, sizeof(v));
+  return (uint32_t)((v * 0x9E3779B97F4A7C15ull) >> (64 - LZP_HASH_BITS));
+}
+
+/* Filter n bytes of in into out (capacity cap).  Returns the filtered
+   length with the marker byte in *marker, or 0 if the output would not be
+   smaller than cap (the caller then keeps the block unfiltered). */
+size_t lzp_encode(const unsigned char* in,
+                  size_t n,
+                  unsigned char* out,
+                  size_t cap,
+                  unsigned char* marker) {
+  uint32_t* table = calloc((size_t)1 << LZP_HASH_BITS, sizeof(uint32_t));
+  if (!table || n > UINT32_MAX - 1) {
+    free(table);
+    return 0;
+  }
+  size_t freq[256] = {0};
+  for (size_t i = 0; i < n; i++)
+    freq[in[i]]++;
+  int m = 0;
+  for (int c = 1; c < 256; c++)
+    if (freq[c] < freq[m])
+      m = c;
+  *marker = (unsigned char)m;
+
+  size_t i = 0, o = 0;
+  while (i < n) {
+    if (i >= LZP_ORDER) {
+      uint32_t h = lzp_hash(in + i - LZP_ORDER);
+      size_t p = table[h];  // earlier position + 1
+      table[h] = (uint32_t)(i + 1);
+      if (p) {
+        const unsigned char* ref = in + p - 1;  // may overlap in + i
+        size_t len = 0, max = n - i;
+        while (len < max && ref[len] == in[i + len])
+          len++;
+        if (len >= LZP_MIN_LEN) {
+          size_t v = len - LZP_MIN_LEN + 1;
+          if (o + 2 + v / 255 > cap)
+            break;
+          out[o++] = *marker;
+          for (; v >= 255; v -= 255)
+            out[o++] = 255;
+          out[o++] = (unsigned char)v;
+          i += len;
+          continue;
+        }
+      }
+    }
+    if (o + 2 > cap)
+      break;
+    out[o++] = in[i];
+    if (in[i] == *marker)
+      out[o++] = 0;
+    i++;
+  }
+  free(table);
+  return i == n && o < cap ? o : 0;
+}
+
+/* Invert lzp_encode: expand len bytes of in into exactly out_len bytes of
+   out.  Returns out_len on success, 0 on corrupt input. */
+size_t lzp_decode(const unsigned char* in,
+                  size_t len,
+                  unsigned char marker,
+                  unsigned char* out,
+                  size_t out_len) {
+  uint32_t* table = calloc((size_t)1 << LZP_HASH_BITS, sizeof(uint32_t));
+  if (!table || out_len > UINT32_MAX - 1) {
+    free(table);
+    return 0;
+  }
+  size_t i = 0, o = 0;
+  int ok = 1;
+  while (ok && o < out_len) {
+    size_t p = 0;
+    if (o >= LZP_ORDER) {
+      uint32_t h = lzp_hash(out + o - LZP_ORDER);
+      p = table[h];
+      table[h] = (uint32_t)(o + 1);
+    }
+    if (i >= len) {
+      ok = 0;
+      break;
+    }
+    unsigned char c = in[i++];
+    if (c != marker) {
+      out[o++] = c;
+      continue;
+    }
+    size_t v = 0;
+    unsigned char b;
+    do {
+      if (i >= len) {
+        ok = 0;
+        break;
+      }
+      b = in[i++];
+      v += b;
+    } while (b == 255);
+    if (!ok)
+      break;
+    if (v == 0) {
+      out[o++] = marker;
+      continue;
+    }
+    size_t mlen = v + LZP_MIN_LEN - 1;
+    if (!p || mlen > out_len - o) {
+      ok = 0;
+      break;
+    }
+    // byte by byte: the source may overlap what is being written
+    const unsigned char* ref = out + p - 1;
+    for (size_t k = 0; k < mlen; k++)
+      out[o + k] = ref[k];
+    o += mlen;
+  }
+  free(table);
+  return ok && i == len ? out_len : 0;
+}
@@ -0,0 +1,235 @@
+// main_memory.c
+// Memory budget: block cost model, plans and the counted allocator (see
+// main_memory.h).
+//
+// Cost of one block of n bytes, from the buffers the pipeline allocates:
+//   compress       input n + BWT output n + suffix sorting 20n (sa, rank,
+//                  tmp, tmp_sa, counts; 4n each) = 22n; the parallel sorter
+//                  needs sa, rank and next plus group lists and sort keys,
+//                  up to 36n, so 38n.  The MTF/RLE/Huffman tail (input, BWT
+//                  output, 2n RLE, 2n payload) stays below either.
+//   in place (-L)  input n + suffix array 4n + type bitmaps (n/8 per
+//                  level) and, rarely, bucket counters that do not fit in
+//                  the array: 6n; the tail is input n + RLE 2n + payload
+//                  2n = 5n.
+//   decompress     payload up to 2n + the larger of RLE 2n + MTF n and
+//                  MTF n + LF 4(n+1) + output n = 8n.
+//   fast (-f)      input n + LZ77 payload n + n/255: 2n + n/128.
+// The LZP prefilter adds an n-byte buffer on the compression side; each
+// stage may also hold a 1 MiB table (LZP hash, Huffman tree and counts).
+// A finished payload is at most 2n (two Huffman symbols per byte at worst).
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main_memory.h"
+
+/* Code, stacks, stdio and small tables: not counted per block. */
+#define MEM_BASE (4u << 20)
+#define MEM_TABLES (1u << 20)
+/* Size prefix of a counted allocation; keeps the 16-byte alignment. */
+#define MEM_HEADER 16
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t freed = PTHREAD_COND_INITIALIZER;
+static uint64_t limit;
+static uint64_t reserved;
+static uint64_t in_use;
+static uint64_t peak;
+
+uint64_t mem_block_cost(enum mem_op op, uint64_t n, const struct mem_plan* p) {
+  uint64_t lzp = p && p->lzp ? n : 0;
+  switch (op) {
+    case MEM_COMPRESS:
+      if (p && p->sort_threads > 1 && n >= (1u << 16))
+        return 38 * n + lzp + MEM_TABLES;
+      return 22 * n + lzp + MEM_TABLES;
+    case MEM_COMPRESS_INPLACE:
+      return 6 * n + MEM_TABLES;
+    case MEM_DECOMPRESS:
+      return 8 * n + MEM_TABLES;
+    case MEM_COMPRESS_FAST:
+      return 2 * n + n / 128 + MEM_TABLES;
+  }
+  return 0;
+}
+
+uint64_t mem_plan_cost(enum mem_op op, const struct mem_plan* p) {
+  uint64_t payload = 2 * (uint64_t)p->block_size + 1024;
+  return MEM_BASE + (uint64_t)p->workers * mem_block_cost(op, p->block_size, p) +
+         (uint64_t)p->queue * payload;
+}
+
+int mem_plan_compress(uint64_t budget,
+                      enum mem_op op,
+                      int shrink_block,
+                      struct mem_plan* p) {
+  if (p->workers < 1)
+    p->workers = 1;
+  if (p->sort_threads < 1)
+    p->sort_threads = 1;
+  if (p->queue < 0)
+    p->queue = 0;
+  while (mem_plan_cost(op, p) > budget) {
+    if (p->queue > (p->workers > 1 ? 1 : 0))
+      p->queue--;
+    else if (p->workers > 1)
+      p->workers--;
+    else if (p->sort_threads > 1)
+      p->sort_threads = 1;
+    else if (shrink_block && p->block_size / 2 >= MEM_MIN_BLOCK)
+      p->block_size /= 2;
+    else
+      return -1;
+  }
+  return 0;
+}
+
+int mem_plan_decompress(uint64_t budget, struct mem_plan* p) {
+  p->sort_threads = 1;
+  return mem_plan_compress(budget, MEM_DECOMPRESS, 0, p);
+}
+
+void mem_set_limit(uint64_t bytes) {
+  pthread_mutex_lock(&lock);
+  limit = bytes;
+  pthread_mutex_unlock(&lock);
+}
+
+uint64_t mem_limit(void) {
+  pthread_mutex_lock(&lock);
+  uint64_t l = limit;
+  pthread_mutex_unlock(&lock);
+  return l;
+}
+
+int mem_acquire(uint64_t bytes) {
+  pthread_mutex_lock(&lock);
+  if (limit && bytes + MEM_BASE > limit) {
+    pthread_mutex_unlock(&lock);
+    return -1;
+  }
+  while (limit && reserved > 0 && reserved + bytes + MEM_BASE > limit)
+    pthread_cond_wait(&freed, &lock);
+  reserved += bytes;
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+void mem_release(uint64_t bytes) {
+  pthread_mutex_lock(&lock);
+  reserved -= bytes < reserved ? bytes : reserved;
+  pthread_cond_broadcast(&freed);
+  pthread_mutex_unlock(&lock);
+}
+
+/* Count n more bytes, unless that would pass the limit. */
+static int charge(size_t n) {
+  pthread_mutex_lock(&lock);
+  int ok = !limit || in_use + n <= limit;
+  if (ok) {
+    in_use += n;
+    if (in_use > peak)
+      peak = in_use;
+  }
+  pthread_mutex_unlock(&lock);
+  return ok ? 0 : -1;
+}
+
+static void uncharge(size_t n) {
+  pthread_mutex_lock(&lock);
+  in_use -= n;
+  pthread_mutex_unlock(&lock);
+}
+
+void* mem_alloc(size_t n) {
+  if (n > SIZE_MAX - MEM_HEADER || charge(n) != 0)
+    return NULL;
+  unsigned char* p = malloc(n + MEM_HEADER);
+  if (!p) {
+    uncharge(n);
+    return NULL;
+  }
+  memcpy(p, &n, sizeof(n));
+  return p + MEM_HEADER;
+}
+
+void* mem_calloc(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size)
+    return NULL;
+  void* p = mem_alloc(count * size);
+  if (p)
+    memset(p, 0, count * size);
+  return p;
+}
+
+void* mem_realloc(void* q, size_t n) {
+  if (!q)
+    return mem_alloc(n);
+  unsigned char* p = (unsigned char*)q - MEM_HEADER;
+  size_t old;
+  memcpy(&old, p, sizeof(old));
+  if (n > SIZE_MAX - MEM_HEADER ||
+      (n > old && charge(n - old) != 0))
+    return NULL;
+  unsigned char* grown = realloc(p, n + MEM_HEADER);
+  if (!grown) {
+    if (n > old)
+      uncharge(n - old);
+    return NULL;
+  }
+  if (n < old)
+    uncharge(old - n);
+  memcpy(grown, &n, sizeof(n));
+  return grown + MEM_HEADER;
+}
+
+void mem_free(void* q) {
+  if (!q)
+    return;
+  unsigned char* p = (unsigned char*)q - MEM_HEADER;
+  size_t n;
+  memcpy(&n, p, sizeof(n));
+  uncharge(n);
+  free(p);
+}
+
+void mem_usage(uint64_t* now, uint64_t* max) {
+  pthread_mutex_lock(&lock);
+  *now = in_use;
+  *max = peak;
+  pthread_mutex_unlock(&lock);
+}
+
+uint64_t mem_parse_size(const char* s) {
+  char* end;
+  unsigned long long v = strtoull(s, &end, 10);
+  int shift = 0;
+  if (*end == 'K' || *end == 'k')
+    shift = 10;
+  else if (*end == 'M' || *end == 'm')
+    shift = 20;
+  else if (*end == 'G' || *end == 'g')
+    shift = 30;
+  if (end == s || (shift && end[1] != '\0') || (!shift && *end != '\0') ||
+      v > (UINT64_MAX >> shift))
+    return 0;
+  return (uint64_t)v << shift;
+}
+
+int mem_take_option(int* argc, char** argv, uint64_t* budget) {
+  *budget = 0;
+  for (int a = 1; a < *argc; a++) {
+    if (strcmp(argv[a], "--max-memory") != 0)
+      continue;
+    if (a + 1 >= *argc || (*budget = mem_parse_size(argv[a + 1])) == 0)
+      return -1;
+    for (int b = a; b + 2 <= *argc; b++)
+      argv[b] = argv[b + 2];
+    *argc -= 2;
+    a--;
+  }
+  return 0;
+}
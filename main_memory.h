@@ -0,0 +1,79 @@
+// main_memory.h
+// Memory budget (main_memory.c).
+// Every block costs a fixed multiple of its size while it is being
+// (de)compressed, so a budget turns into a block size, a number of blocks in
+// flight and a number of finished payloads that may queue for the writer.
+// mem_plan_* fit those to the budget.  While running, each block reserves
+// its modelled cost (mem_acquire) before it starts, so the blocks in flight
+// never exceed the budget together, and the buffers that grow with the
+// block size are allocated through mem_alloc, which counts them and refuses
+// to go over the limit: an over-budget run fails with an error instead of
+// being killed by the OOM killer.
+
+#ifndef MAIN_MEMORY_H
+#define MAIN_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Smallest block mem_plan_compress shrinks to. */
+#define MEM_MIN_BLOCK (64u << 10)
+
+enum mem_op {
+  MEM_COMPRESS,          // compress_block
+  MEM_COMPRESS_INPLACE,  // compress_block_inplace (-L)
+  MEM_DECOMPRESS,        // decompress_block
+  MEM_COMPRESS_FAST,     // compress_block at the fast level (-f)
+};
+
+struct mem_plan {
+  uint32_t block_size;
+  int workers;       // blocks in flight at once
+  int sort_threads;  // threads inside one block's suffix sort
+  int queue;         // finished payloads waiting for the writer
+  int lzp;           // blocks go through the LZP prefilter
+};
+
+/* Peak bytes of one block of n bytes, including its input and output
+   buffers. */
+uint64_t mem_block_cost(enum mem_op op, uint64_t n, const struct mem_plan* p);
+/* Bytes of everything a plan keeps in flight. */
+uint64_t mem_plan_cost(enum mem_op op, const struct mem_plan* p);
+
+/* Shrink *p (filled in with the wanted values) until it fits budget: the
+   queue first, then workers, then sort threads, then, if shrink_block is
+   set, the block size down to MEM_MIN_BLOCK.  Returns 0, or -1 if even the
+   smallest plan does not fit. */
+int mem_plan_compress(uint64_t budget,
+                      enum mem_op op,
+                      int shrink_block,
+                      struct mem_plan* p);
+/* Same for decoding blocks of a given size (which cannot change). */
+int mem_plan_decompress(uint64_t budget, struct mem_plan* p);
+
+/* Process-wide limit; 0 (the default) means none. */
+void mem_set_limit(uint64_t bytes);
+uint64_t mem_limit(void);
+/* Reserve bytes for a block about to start, waiting while blocks already
+   running hold too much.  Returns -1 if bytes alone exceed the limit. */
+int mem_acquire(uint64_t bytes);
+void mem_release(uint64_t bytes);
+
+/* Counted allocations.  mem_alloc and mem_realloc fail once the counted
+   total would pass the limit; free with mem_free only. */
+void* mem_alloc(size_t n);
+void* mem_calloc(size_t count, size_t size);
+void* mem_realloc(void* p, size_t n);
+void mem_free(void* p);
+/* Counted bytes now and at the peak. */
+void mem_usage(uint64_t* in_use, uint64_t* peak);
+
+/* "512M", "2G", "65536" (K, M, G are powers of 1024).  Returns 0 on a
+   malformed value. */
+uint64_t mem_parse_size(const char* s);
+/* Remove "--max-memory <size>" from argv (anywhere after argv[0]) and store
+   the size in *budget, or 0 if the option is absent.  Returns -1 if the
+   value is missing or malformed. */
+int mem_take_option(int* argc, char** argv, uint64_t* budget);
+
+#endif
@@ -0,0 +1,382 @@
+// main_message.c
+// Self-contained frames for small payloads (e.g. one JSON event).
+// A block in output.bin carries a 1 KB frequency table, which dwarfs a
+// 200-byte message; a message frame instead names a pretrained Huffman table
+// by ID, so there is no header to store and no tree to build per message.
+// Table ID 0 means "no pretrained table": the frame then carries an inline
+// frequency table in the compact form (a 32-byte symbol bitmap plus the
+// counts of the symbols present), which is what the daemon uses when started
+// without tables.  A payload that does not shrink is stored as is.
+//
+// Frame layout (varints are LEB128):
+//   uint8_t version            MESSAGE_VERSION
+//   varint  table_id
+//   varint  raw_len            original bytes
+//   varint  primary            BWT primary index
+//   varint  sym_len            RLE bytes = Huffman symbols
+//   bitstream                  coded with the referenced table
+//                              (table_id 0: compress_huffman_compact payload)
+// A stored frame has table_id 0, primary 0 and sym_len 0 with raw_len > 0,
+// and the raw_len original bytes in place of the bitstream.  Version 1
+// frames (table_id 0 with the full 1 KB compress_huffman_buffer header, no
+// stored frames) are still decoded.
+//
+// A struct message_ctx holds the scratch buffers for one thread; it only
+// grows, so a long-lived worker stops allocating once it has seen its
+// largest message.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MESSAGE_VERSION 2
+#define MESSAGE_VERSION_FULL_HEADER 1
+#define MESSAGE_MAX_LEN (1u << 30)
+
+struct huff_table;
+struct bwt_workspace;
+
+struct bwt_workspace* bwt_workspace_create(void);     // from main_bwt.c
+void bwt_workspace_free(struct bwt_workspace* ws);    // from main_bwt.c
+int bwt_encode_ws(struct bwt_workspace* ws,
+                  const unsigned char* input,
+                  uint32_t n,
+                  unsigned char* out,
+                  uint32_t* primary_index);  // from main_bwt.c
+int bwt_decode_ws(struct bwt_workspace* ws,
+                  const unsigned char* bwt,
+                  uint32_t n,
+                  uint32_t primary_index,
+                  unsigned char* out);  // from main_bwt.c
+size_t mtf_rle_encode(unsigned char list[256],
+                      const unsigned char* input,
+                      size_t input_len,
+                      unsigned char* output,
+                      size_t output_capacity,
+                      unsigned freq[256]);  // from main_mtf.c
+void mtf_decode_buffer(const unsigned char* input,
+                       size_t input_len,
+                       unsigned char* out);  // from main_mtf.c
+size_t decompress_rle_buffer(const unsigned char* input,
+                             size_t input_len,
+                             unsigned char* output,
+                             size_t output_capacity);  // from main_rle.c
+uint32_t huff_table_id(const struct huff_table* t);  // from main_huffman.c
+size_t huffman_encode_table(const struct huff_table* t,
+                            const unsigned char* input,
+                            size_t input_len,
+                            unsigned char* output,
+                            size_t output_capacity);  // from main_huffman.c
+size_t huffman_decode_table(const struct huff_table* t,
+                            const unsigned char* input,
+                            size_t input_len,
+                            unsigned char* output,
+                            size_t output_len);  // from main_huffman.c
+size_t compress_huffman_compact(const unsigned char* input,
+                                size_t input_len,
+                                const unsigned freq[256],
+                                unsigned char* output,
+                                size_t output_capacity);  // from main_huffman.c
+size_t decompress_huffman_buffer(const unsigned char* input,
+                                 size_t input_len,
+                                 unsigned char* output,
+                                 size_t output_len);  // from main_huffman.c
+size_t decompress_huffman_compact(const unsigned char* input,
+                                  size_t input_len,
+                                  unsigned char* output,
+                                  size_t output_len);  // from main_huffman.c
+
+struct message_ctx {
+  struct bwt_workspace* ws;
+  unsigned char* a;  // BWT / MTF bytes
+  unsigned char* b;  // RLE bytes
+  unsigned char* c;  // decoded message; the inline frame when encoding
+  size_t cap_a, cap_b, cap_c;
+  unsigned freq[256];  // histogram of b, from the last message_transform
+};
+
+struct message_ctx* message_ctx_create(void) {
+  struct message_ctx* ctx = calloc(1, sizeof(*ctx));
+  if (ctx && !(ctx->ws = bwt_workspace_create())) {
+    free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+void message_ctx_free(struct message_ctx* ctx) {
+  if (!ctx)
+    return;
+  bwt_workspace_free(ctx->ws);
+  free(ctx->a);
+  free(ctx->b);
+  free(ctx->c);
+  free(ctx);
+}
+
+static int reserve(unsigned char** p, size_t* cap, size_t need) {
+  if (need <= *cap)
+    return 0;
+  unsigned char* q = realloc(*p, need);
+  if (!q)
+    return -1;
+  *p = q;
+  *cap = need;
+  return 0;
+}
+
+static size_t put_varint(unsigned char* out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (unsigned char)v;
+  return n;
+}
+
+static int get_varint(const unsigned char* in,
+                      size_t len,
+                      size_t* pos,
+                      uint64_t* v) {
+  uint64_t r = 0;
+  for (int shift = 0; shift < 64 && *pos < len; shift += 7) {
+    unsigned char b = in[(*pos)++];
+    r |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *v = r;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* BWT -> MTF + RLE for one message.  The RLE bytes are left in ctx->b,
+   their count in *rle_len and their histogram in ctx->freq.  Returns 0 on
+   success. */
+static int message_transform(struct message_ctx* ctx,
+                             const unsigned char* input,
+                             size_t input_len,
+                             uint32_t* primary,
+                             size_t* rle_len) {
+  size_t rle_cap = input_len * 2 + 16;
+  if (reserve(&ctx->a, &ctx->cap_a, input_len) ||
+      reserve(&ctx->b, &ctx->cap_b, rle_cap))
+    return -1;
+  if (bwt_encode_ws(ctx->ws, input, (uint32_t)input_len, ctx->a, primary) != 0)
+    return -1;
+  unsigned char list[256];
+  for (int i = 0; i < 256; ++i)
+    list[i] = (unsigned char)i;
+  memset(ctx->freq, 0, sizeof(ctx->freq));
+  *rle_len =
+      mtf_rle_encode(list, ctx->a, input_len, ctx->b, rle_cap, ctx->freq);
+  return *rle_len ? 0 : -1;
+}
+
+/* Add the RLE symbol histogram of one sample message to counts; used by the
+   `train` subcommand.  Returns 0 on success. */
+int message_train_sample(const unsigned char* input,
+                         size_t input_len,
+                         unsigned long long counts[256]) {
+  if (input_len == 0)
+    return 0;
+  if (input_len > MESSAGE_MAX_LEN)
+    return -1;
+  struct message_ctx* ctx = message_ctx_create();
+  uint32_t primary = 0;
+  size_t rle_len = 0;
+  if (!ctx || message_transform(ctx, input, input_len, &primary, &rle_len)) {
+    message_ctx_free(ctx);
+    return -1;
+  }
+  for (int i = 0; i < 256; i++)
+    counts[i] += ctx->freq[i];
+  message_ctx_free(ctx);
+  return 0;
+}
+
+/* Worst-case frame size for an input of input_len bytes. */
+size_t message_bound(size_t input_len) {
+  // header varints + compact frequency table (32-byte bitmap, 256 counts) +
+  // RLE (2 symbols per input byte); a skewed pretrained table can give a
+  // symbol a code of up to 64 bits
+  return 64 + 32 + 256 * sizeof(unsigned) + input_len * 2 * 8;
+}
+
+static size_t put_header(unsigned char* out,
+                         uint64_t table_id,
+                         uint64_t raw_len,
+                         uint64_t primary,
+                         uint64_t sym_len) {
+  size_t pos = 0;
+  out[pos++] = MESSAGE_VERSION;
+  pos += put_varint(out + pos, table_id);
+  pos += put_varint(out + pos, raw_len);
+  pos += put_varint(out + pos, primary);
+  pos += put_varint(out + pos, sym_len);
+  return pos;
+}
+
+/* Inline-table frame for the transformed message in ctx, written to out.
+   Returns its length, or 0 if it does not fit in cap. */
+static size_t put_inline_frame(struct message_ctx* ctx,
+                               size_t input_len,
+                               uint32_t primary,
+                               size_t rle_len,
+                               unsigned char* out,
+                               size_t cap) {
+  unsigned char head[64];
+  size_t pos = put_header(head, 0, input_len, primary, rle_len);
+  if (pos >= cap)
+    return 0;
+  memcpy(out, head, pos);
+  size_t bits =
+      compress_huffman_compact(ctx->b, rle_len, ctx->freq, out + pos, cap - pos);
+  return bits ? pos + bits : 0;
+}
+
+/* Compress one message.  With a pretrained table the frame refers to it
+   by ID, unless the message codes smaller with its own inline table; with
+   table == NULL the frame always carries its own.  Either way a message
+   that does not shrink goes out as a stored frame.  ctx may be NULL for a
+   one-off call.  Returns the frame length, or 0 on failure (output too
+   small, input too large). */
+size_t compress_message(struct message_ctx* ctx,
+                        const struct huff_table* table,
+                        const unsigned char* input,
+                        size_t input_len,
+                        unsigned char* output,
+                        size_t output_capacity) {
+  if ((!input && input_len) || !output || output_capacity < 64 ||
+      input_len > MESSAGE_MAX_LEN)
+    return 0;
+  if (!ctx) {
+    struct message_ctx* tmp = message_ctx_create();
+    size_t n = tmp ? compress_message(tmp, table, input, input_len, output,
+                                      output_capacity)
+                   : 0;
+    message_ctx_free(tmp);
+    return n;
+  }
+
+  uint32_t primary = 0;
+  size_t rle_len = 0;
+  if (input_len > 0 &&
+      message_transform(ctx, input, input_len, &primary, &rle_len) != 0)
+    return 0;
+
+  size_t best = 0;  // length of the coded frame in output, 0 if none
+  if (rle_len > 0 && table) {
+    size_t pos =
+        put_header(output, huff_table_id(table), input_len, primary, rle_len);
+    size_t bits = huffman_encode_table(table, ctx->b, rle_len, output + pos,
+                                       output_capacity - pos);
+    if (bits)
+      best = pos + bits;
+    // The inline frame only matters if it beats this one, so it is built in
+    // ctx->c with room for no more than that.
+    size_t cap = best ? best - 1 : output_capacity;
+    size_t n = reserve(&ctx->c, &ctx->cap_c, cap)
+                   ? 0
+                   : put_inline_frame(ctx, input_len, primary, rle_len, ctx->c,
+                                      cap);
+    if (n) {
+      memcpy(output, ctx->c, n);
+      best = n;
+    }
+  } else if (rle_len > 0) {
+    best = put_inline_frame(ctx, input_len, primary, rle_len, output,
+                            output_capacity);
+  }
+
+  unsigned char head[64];
+  size_t stored = put_header(head, 0, input_len, 0, 0);
+  if (best && best < stored + input_len)
+    return best;
+  if (stored + input_len > output_capacity)
+    return 0;
+  memcpy(output, head, stored);
+  if (input_len)
+    memcpy(output + stored, input, input_len);
+  return stored + input_len;
+}
+
+/* Decode one frame.  tables holds the pretrained tables available to the
+   caller; the one whose ID the frame names is used (frames with table ID 0
+   need none).  Frames that would decode to more than max_len bytes are
+   refused before anything is allocated for them.  Returns a pointer into
+   ctx that stays valid until the next call on ctx, with the length in
+   *output_len; NULL on failure. */
+const unsigned char* decompress_message(struct message_ctx* ctx,
+                                        struct huff_table* const* tables,
+                                        int ntables,
+                                        const unsigned char* input,
+                                        size_t input_len,
+                                        size_t max_len,
+                                        size_t* output_len) {
+  size_t pos = 0;
+  uint64_t table_id, raw_len, primary, sym_len;
+  int version = input && input_len ? input[pos++] : 0;
+  if (!ctx || (version != MESSAGE_VERSION &&
+               version != MESSAGE_VERSION_FULL_HEADER) ||
+      get_varint(input, input_len, &pos, &table_id) ||
+      get_varint(input, input_len, &pos, &raw_len) ||
+      get_varint(input, input_len, &pos, &primary) ||
+      get_varint(input, input_len, &pos, &sym_len) ||
+      raw_len > MESSAGE_MAX_LEN || raw_len > max_len ||
+      sym_len > raw_len * 2 || sym_len / 8 > input_len - pos ||  // >= 1 bit
+      (raw_len > 0 && sym_len == 0 &&  // stored
+       (version == MESSAGE_VERSION_FULL_HEADER || table_id != 0 ||
+        raw_len != input_len - pos))) {
+    fprintf(stderr, "Malformed message frame\n");
+    return NULL;
+  }
+
+  const struct huff_table* table = NULL;
+  for (int i = 0; i < ntables && table_id != 0; i++)
+    if (huff_table_id(tables[i]) == table_id)
+      table = tables[i];
+  if (table_id != 0 && !table) {
+    fprintf(stderr, "Message needs Huffman table %llu, which is not loaded\n",
+            (unsigned long long)table_id);
+    return NULL;
+  }
+
+  size_t n = (size_t)raw_len;
+  if (reserve(&ctx->a, &ctx->cap_a, n * 2 + 1) ||
+      reserve(&ctx->b, &ctx->cap_b, (size_t)sym_len + 1) ||
+      reserve(&ctx->c, &ctx->cap_c, n + 1))
+    return NULL;
+  *output_len = n;
+  if (n == 0)
+    return ctx->c;
+  if (sym_len == 0) {
+    memcpy(ctx->c, input + pos, n);
+    return ctx->c;
+  }
+
+  size_t got;
+  if (table)
+    got = huffman_decode_table(table, input + pos, input_len - pos, ctx->b,
+                               (size_t)sym_len);
+  else if (version == MESSAGE_VERSION_FULL_HEADER)
+    got = decompress_huffman_buffer(input + pos, input_len - pos, ctx->b,
+                                    (size_t)sym_len);
+  else
+    got = decompress_huffman_compact(input + pos, input_len - pos, ctx->b,
+                                     (size_t)sym_len);
+  if (got != sym_len ||
+      decompress_rle_buffer(ctx->b, (size_t)sym_len, ctx->a, n) != n) {
+    fprintf(stderr, "Corrupt message payload\n");
+    return NULL;
+  }
+  mtf_decode_buffer(ctx->a, n, ctx->a + n);
+  if (bwt_decode_ws(ctx->ws, ctx->a + n, (uint32_t)n, (uint32_t)primary,
+                    ctx->c) != 0) {
+    fprintf(stderr, "Corrupt message payload\n");
+    return NULL;
+  }
+  return ctx->c;
+}
@@ -3,25 +3,12 @@
 #include <string.h>
 
 
-unsigned char* mtf_encode(const unsigned char* input,
-                          size_t input_len,
-                          size_t* out_len) {
-  if (!input || input_len == 0) {
-    *out_len = 0;
-    return NULL;
-  }
-
-  // initialize list 0..255
-  unsigned char list[256];
-  for (int i = 0; i < 256; ++i)
-    list[i] = (unsigned char)i;
-
-  unsigned char* out = malloc(input_len);
-  if (!out) {
-    *out_len = 0;
-    return NULL;
-  }
-
+/* MTF one chunk of a longer stream: list carries the state between
+   chunks and must start as the identity 0..255. */
+void mtf_encode_chunk(unsigned char list[256],
+                      const unsigned char* input,
+                      size_t input_len,
+                      unsigned char* out) {
   for (size_t i = 0; i < input_len; ++i) {
     unsigned char symbol = input[i];
     // find index in list
@@ -37,33 +24,134 @@ unsigned char* mtf_encode(const unsigned char* input,
     memmove(&list[1], &list[0], pos);
     list[0] = symbol;
   }
+}
 
-  *out_len = input_len;
-  return out;
+/* Emit run_len copies of sym as RLE pairs of at most 255. */
+static int put_run(unsigned char* output,
+                   size_t output_capacity,
+                   size_t* o,
+                   unsigned char sym,
+                   size_t run_len,
+                   unsigned freq[256]) {
+  while (run_len > 0) {
+    unsigned char count = (unsigned char)(run_len < 255 ? run_len : 255);
+    if (*o + 2 > output_capacity)
+      return -1;
+    output[(*o)++] = count;
+    output[(*o)++] = sym;
+    freq[count]++;
+    freq[sym]++;
+    run_len -= count;
+  }
+  return 0;
 }
 
-unsigned char* mtf_decode(const unsigned char* input,
+/* Fused MTF + RLE over one chunk of BWT output.  Produces exactly what
+   mtf_encode_chunk followed by compress_rle_buffer would, i.e. (count,
+   index) pairs with runs split at 255, without materialising the MTF
+   indices, and adds the histogram of the produced bytes to freq so the
+   Huffman stage can skip its counting pass.  Runs of the front symbol (the
+   bulk of BWT output) are consumed without touching the list.  list carries
+   the MTF state as in mtf_encode_chunk.  Returns the output length, or 0 if
+   output_capacity (2 * input_len suffices) is too small. */
+size_t mtf_rle_encode(unsigned char list[256],
+                      const unsigned char* input,
+                      size_t input_len,
+                      unsigned char* output,
+                      size_t output_capacity,
+                      unsigned freq[256]) {
+  size_t i = 0, o = 0;
+  size_t run_len = 0;  // pending run of run_sym indices
+  unsigned char run_sym = 0;
+  while (i < input_len) {
+    unsigned char symbol = input[i];
+    unsigned char idx;
+    size_t len = 1;
+    if (symbol == list[0]) {
+      idx = 0;
+      while (i + len < input_len && input[i + len] == symbol)
+        len++;
+    } else {
+      int pos = 1;
+      while (pos < 255 && list[pos] != symbol)
+        pos++;
+      memmove(&list[1], &list[0], pos);
+      list[0] = symbol;
+      idx = (unsigned char)pos;
+    }
+    i += len;
+
+    if (run_len > 0 && idx == run_sym) {
+      run_len += len;
+      continue;
+    }
+    if (put_run(output, output_capacity, &o, run_sym, run_len, freq) != 0)
+      return 0;
+    run_sym = idx;
+    run_len = len;
+  }
+  if (put_run(output, output_capacity, &o, run_sym, run_len, freq) != 0)
+    return 0;
+  return o;
+}
+
+/* MTF into a caller-provided buffer of input_len bytes (may be input). */
+void mtf_encode_buffer(const unsigned char* input,
+                       size_t input_len,
+                       unsigned char* out) {
+  // initialize list 0..255
+  unsigned char list[256];
+  for (int i = 0; i < 256; ++i)
+    list[i] = (unsigned char)i;
+  mtf_encode_chunk(list, input, input_len, out);
+}
+
+unsigned char* mtf_encode(const unsigned char* input,
                           size_t input_len,
-                          size_t* output_len) {
+                          size_t* out_len) {
   if (!input || input_len == 0) {
-    *output_len = 0;
+    *out_len = 0;
     return NULL;
   }
 
   unsigned char* out = malloc(input_len);
   if (!out) {
-    *output_len = 0;
+    *out_len = 0;
     return NULL;
   }
+  mtf_encode_buffer(input, input_len, out);
 
-  unsigned char list[256];
-  for (int i = 0; i < 256; ++i)
-    list[i] = (unsigned char)i;
+  *out_len = input_len;
+  return out;
+}
 
+/* Initial MTF list for a block whose bytes are those set in in_use (bit b
+   of in_use[b / 8] for byte b): the k used bytes in ascending order, then
+   the unused ones.  Coding from this list gives the same indices as first
+   remapping the block to the dense alphabet 0..k-1, without that pass:
+   every index is below k and no search goes past position k - 1.  Returns
+   k. */
+int mtf_alphabet_list(const unsigned char in_use[32], unsigned char list[256]) {
+  int k = 0, u = 0;
+  unsigned char unused[256];
+  for (int b = 0; b < 256; b++) {
+    if (in_use[b >> 3] >> (b & 7) & 1)
+      list[k++] = (unsigned char)b;
+    else
+      unused[u++] = (unsigned char)b;
+  }
+  memcpy(list + k, unused, (size_t)u);
+  return k;
+}
+
+/* Inverse MTF of one chunk; list carries the state as in mtf_encode_chunk
+   (and may start from mtf_alphabet_list). */
+void mtf_decode_list(unsigned char list[256],
+                     const unsigned char* input,
+                     size_t input_len,
+                     unsigned char* out) {
   for (size_t i = 0; i < input_len; ++i) {
     unsigned int pos = input[i];  // position in the list
-    if (pos > 255)
-      pos = 255;  // defensive
     unsigned char symbol = list[pos];
     out[i] = symbol;
 
@@ -71,7 +159,33 @@ unsigned char* mtf_decode(const unsigned char* input,
     memmove(&list[1], &list[0], pos);
     list[0] = symbol;
   }
+}
+
+/* Inverse MTF into a caller-provided buffer of input_len bytes. */
+void mtf_decode_buffer(const unsigned char* input,
+                       size_t input_len,
+                       unsigned char* out) {
+  unsigned char list[256];
+  for (int i = 0; i < 256; ++i)
+    list[i] = (unsigned char)i;
+  mtf_decode_list(list, input, input_len, out);
+}
+
+unsigned char* mtf_decode(const unsigned char* input,
+                          size_t input_len,
+                          size_t* output_len) {
+  if (!input || input_len == 0) {
+    *output_len = 0;
+    return NULL;
+  }
+
+  unsigned char* out = malloc(input_len);
+  if (!out) {
+    *output_len = 0;
+    return NULL;
+  }
+  mtf_decode_buffer(input, input_len, out);
 
   *output_len = input_len;
   return out;
-}
\ No newline at end of file
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 void compress_rle(const char* input, const char* output) {
   FILE* in = fopen(input, "rb");
@@ -127,6 +128,26 @@ size_t compress_rle_buffer(const unsigned char* input,
   return out_pos;
 }
 
+/* Inverse of compress_rle_buffer.  Returns the number of bytes written, or 0
+   if the pairs would overflow output_capacity or the input is truncated. */
+size_t decompress_rle_buffer(const unsigned char* input,
+                             size_t input_len,
+                             unsigned char* output,
+                             size_t output_capacity) {
+  if (!input || !output || input_len % 2 != 0)
+    return 0;
+
+  size_t out_pos = 0;
+  for (size_t in_pos = 0; in_pos < input_len; in_pos += 2) {
+    unsigned char count = input[in_pos];
+    if (output_capacity - out_pos < count)
+      return 0;
+    memset(output + out_pos, input[in_pos + 1], count);
+    out_pos += count;
+  }
+  return out_pos;
+}
+
 // int main() {
 //   int choice;
 //   char input[260], output[260];
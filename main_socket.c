@@ -0,0 +1,132 @@
+// main_socket.c
+// Unix domain socket plumbing for the daemon, its client and the load
+// generator.  See main_socket.h for the framing.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "main_socket.h"
+
+static int fill_addr(struct sockaddr_un* addr, const char* path) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+    return -1;
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/* Bind and listen on path, replacing a stale socket file. */
+int sock_listen(const char* path) {
+  struct sockaddr_un addr;
+  if (fill_addr(&addr, path) != 0)
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 128) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int sock_connect(const char* path) {
+  struct sockaddr_un addr;
+  if (fill_addr(&addr, path) != 0)
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Returns 0 on success, 1 on a clean EOF before any byte, -1 on error. */
+int sock_read_all(int fd, void* buf, size_t len) {
+  unsigned char* p = buf;
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = read(fd, p + done, len - done);
+    if (n == 0)
+      return done == 0 ? 1 : -1;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    done += (size_t)n;
+  }
+  return 0;
+}
+
+int sock_write_all(int fd, const void* buf, size_t len) {
+  const unsigned char* p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+int sock_send(int fd, uint8_t tag, const void* payload, uint32_t len) {
+  unsigned char hdr[8] = {tag, 0, 0, 0};
+  memcpy(hdr + 4, &len, sizeof(len));
+  if (sock_write_all(fd, hdr, sizeof(hdr)) != 0)
+    return -1;
+  return len ? sock_write_all(fd, payload, len) : 0;
+}
+
+/* Same return convention as sock_read_all. */
+int sock_recv_header(int fd, uint8_t* tag, uint32_t* len) {
+  unsigned char hdr[8];
+  int r = sock_read_all(fd, hdr, sizeof(hdr));
+  if (r != 0)
+    return r;
+  *tag = hdr[0];
+  memcpy(len, hdr + 4, sizeof(*len));
+  return 0;
+}
+
+/* One request/response round trip.  *output (capacity *output_cap) is
+   grown as needed and reused across calls.  Returns 0 if a response was
+   received (check *status), -1 on a transport error. */
+int daemon_call(int fd,
+                uint8_t op,
+                const void* input,
+                uint32_t input_len,
+                unsigned char** output,
+                size_t* output_cap,
+                uint32_t* output_len,
+                uint8_t* status) {
+  if (sock_send(fd, op, input, input_len) != 0 ||
+      sock_recv_header(fd, status, output_len) != 0 ||
+      *output_len > DAEMON_MAX_PAYLOAD)
+    return -1;
+  if (*output_len + 1 > *output_cap) {
+    unsigned char* grown = realloc(*output, (size_t)*output_len + 1);
+    if (!grown)
+      return -1;
+    *output = grown;
+    *output_cap = (size_t)*output_len + 1;
+  }
+  return sock_read_all(fd, *output, *output_len) == 0 ? 0 : -1;
+}
@@ -0,0 +1,41 @@
+// main_socket.h
+// Wire protocol between the compression daemon and its clients.
+// Every message in either direction is a fixed 8-byte header followed by a
+// payload:
+//   uint8_t  tag        request: DAEMON_OP_*; response: DAEMON_STATUS_*
+//   uint8_t  reserved[3]
+//   uint32_t length     payload bytes (native endian; the socket is local)
+// A compress response carries a message frame (see main_message.c); on
+// error the payload is a short text explaining why.  A connection may carry
+// any number of request/response pairs.
+
+#ifndef MAIN_SOCKET_H
+#define MAIN_SOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DAEMON_DEFAULT_SOCKET "/tmp/text-compressor.sock"
+#define DAEMON_MAX_PAYLOAD (64u << 20)
+
+#define DAEMON_OP_COMPRESS 'C'
+#define DAEMON_OP_DECOMPRESS 'D'
+#define DAEMON_STATUS_OK 0
+#define DAEMON_STATUS_ERROR 1
+
+int sock_listen(const char* path);
+int sock_connect(const char* path);
+int sock_read_all(int fd, void* buf, size_t len);
+int sock_write_all(int fd, const void* buf, size_t len);
+int sock_send(int fd, uint8_t tag, const void* payload, uint32_t len);
+int sock_recv_header(int fd, uint8_t* tag, uint32_t* len);
+int daemon_call(int fd,
+                uint8_t op,
+                const void* input,
+                uint32_t input_len,
+                unsigned char** output,
+                size_t* output_cap,
+                uint32_t* output_len,
+                uint8_t* status);
+
+#endif
@@ -0,0 +1,102 @@
+// main_split.c
+// Content-adaptive block splitting (-S).
+// A fixed block size puts unrelated data (a JSON section followed by base64
+// blobs, say) into one BWT block under one Huffman code.  split_block looks
+// for the first point where the data changes character and ends the block
+// there, so blocks come out smaller and more homogeneous.
+//
+// The buffer is scanned in SPLIT_SEGMENT-byte segments.  Statistics are
+// order 1 over a coarse context, the high nibble of the previous byte (16
+// contexts x 256 bytes), which separates e.g. digits after letters from
+// digits after digits at little cost.  For each segment the splitter
+// estimates how many more bits per byte it would cost under the statistics
+// of the block so far than under its own: the Kullback-Leibler divergence
+// of the two distributions.  Once that passes SPLIT_THRESHOLD bits per byte
+// the block ends before the segment.  Homogeneous data stays below a
+// quarter of a bit (text at a few hundredths, random bytes highest, since
+// 16 KiB is a small sample of 4096 cells); a switch between text, base64
+// and binary costs two bits or more.
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SPLIT_SEGMENT (16u << 10)
+#define SPLIT_CONTEXTS 16
+/* Bits per byte of divergence that end a block. */
+#define SPLIT_THRESHOLD 1.0
+
+struct split_stats {
+  uint32_t count[SPLIT_CONTEXTS][256];
+  uint32_t total[SPLIT_CONTEXTS];
+};
+
+static void count_segment(const unsigned char* p,
+                          uint32_t len,
+                          unsigned char prev,
+                          struct split_stats* s) {
+  memset(s, 0, sizeof(*s));
+  for (uint32_t i = 0; i < len; i++) {
+    s->count[prev >> 4][p[i]]++;
+    prev = p[i];
+  }
+  for (int c = 0; c < SPLIT_CONTEXTS; c++) {
+    uint32_t t = 0;
+    for (int b = 0; b < 256; b++)
+      t += s->count[c][b];
+    s->total[c] = t;
+  }
+}
+
+/* Bits per byte the segment seg would lose under the statistics of block
+   instead of its own.  Block probabilities get half a count per byte value,
+   so a byte the block has not seen yet is expensive but finite. */
+static double divergence(const struct split_stats* seg,
+                         const struct split_stats* block,
+                         uint32_t seg_len) {
+  double bits = 0;
+  for (int c = 0; c < SPLIT_CONTEXTS; c++) {
+    if (seg->total[c] == 0)
+      continue;
+    double seg_total = seg->total[c];
+    double block_total = block->total[c] + 0.5 * 256;
+    for (int b = 0; b < 256; b++) {
+      uint32_t n = seg->count[c][b];
+      if (n == 0)
+        continue;
+      double own = n / seg_total;
+      double theirs = (block->count[c][b] + 0.5) / block_total;
+      bits += n * log2(own / theirs);
+    }
+  }
+  return bits / seg_len;
+}
+
+/* Where to end the block that starts at buf, given n bytes of it (n is the
+   largest block).  The cut is a multiple of SPLIT_SEGMENT no smaller than
+   min_len; with at_end set the n bytes are all that is left and the last
+   block is kept at min_len too.  Returns n when no shift is found. */
+uint32_t split_block(const unsigned char* buf,
+                     uint32_t n,
+                     uint32_t min_len,
+                     int at_end) {
+  static _Thread_local struct split_stats block, seg;  // 32 KiB: off stack
+  memset(&block, 0, sizeof(block));
+  unsigned char prev = 0;
+  uint32_t pos = 0;
+  while (n - pos > SPLIT_SEGMENT) {
+    uint32_t len = SPLIT_SEGMENT;
+    count_segment(buf + pos, len, prev, &seg);
+    if (pos >= min_len && (!at_end || n - pos >= min_len) &&
+        divergence(&seg, &block, len) > SPLIT_THRESHOLD)
+      return pos;
+    for (int c = 0; c < SPLIT_CONTEXTS; c++) {
+      for (int b = 0; b < 256; b++)
+        block.count[c][b] += seg.count[c][b];
+      block.total[c] += seg.total[c];
+    }
+    prev = buf[pos + len - 1];
+    pos += len;
+  }
+  return n;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Round trip through the deduplicating chunk store on the edge cases:
+# a file smaller than one chunk, a file whose last chunk is a few bytes,
+# and random bytes that must not grow beyond a stored frame.
+# Usage: tests/dedup_roundtrip.sh [bin-dir]   (default: the current directory)
+bin=${1:-.}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+printf 'hello dedup world\n' >"$dir/tiny"
+# Zeros never hit a content-defined cut, so the first chunk ends at the
+# 256 KiB maximum and the last one holds the 5 bytes after it.
+head -c 262149 /dev/zero >"$dir/short_tail"
+head -c 70003 /dev/urandom >"$dir/random"
+: >"$dir/empty"
+
+fail=0
+for name in tiny short_tail random empty; do
+  in="$dir/$name"
+  if "$bin/compressor" dedup "$dir/store" "$in" "$in.rcp" >"$dir/log" &&
+     "$bin/decompressor" restore "$dir/store" "$in.rcp" "$in.out" >>"$dir/log" &&
+     cmp -s "$in" "$in.out"; then
+    echo "ok   $name"
+  else
+    echo "FAIL $name"
+    cat "$dir/log"
+    fail=1
+  fi
+done
+
+# A chunk that does not compress is stored raw: a few bytes of frame header.
+size=$(find "$dir/store" -name '*.tcc' -size +65536c -exec wc -c {} + |
+       awk '$2 != "total" { print $1; exit }')
+if [ -z "$size" ] || [ "$size" -gt 70019 ]; then
+  echo "FAIL random chunk stored in ${size:-?} bytes"
+  fail=1
+else
+  echo "ok   random chunk stored in $size bytes"
+fi
+exit $fail